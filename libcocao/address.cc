@@ -1,6 +1,7 @@
 #include <netdb.h>
 #include <ifaddrs.h>
 #include "address.h"
+#include "resolver.h"
 #include "log.h"
 #include "endian.h"
 
@@ -17,7 +18,7 @@ template <class T>
 static uint32_t CountBytes (T value) {
     uint32_t result = 0;
     for (; value; ++ result) {
-        value &= value - 1
+        value &= value - 1;
     }
     return result;
 }
@@ -81,6 +82,21 @@ bool Address::Lookup (std::vector<Address::ptr>& result, const std::string &host
     }
 
     if (node.empty()) node = host;
+
+    //IP协议族、数字端口时走Resolver，等待DNS应答时只挂起协程；服务名、AF_UNIX等仍交给getaddrinfo
+    bool numeric_service = !service || (*service && strspn(service, "0123456789") == strlen(service));
+    if ((family == AF_INET || family == AF_INET6 || family == AF_UNSPEC) && numeric_service) {
+        std::vector<IPAddress::ptr> addrs;
+        uint16_t port = service ? atoi(service) : 0;
+        if (!ResolverMgr::GetInstance()->lookup(node, family, addrs, port)) {
+            LIBCOCAO_LOG_DEBUG(g_logger) << "Address::Lookup resolve(" << host << ", "
+                                         << family << ") failed";
+            return false;
+        }
+        result.insert(result.end(), addrs.begin(), addrs.end());
+        return true;
+    }
+
     int error = getaddrinfo(node.c_str(), service, &hints, &results);
     if (error) {
         LIBCOCAO_LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", "
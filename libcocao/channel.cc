@@ -0,0 +1,103 @@
+#include "channel.h"
+#include <algorithm>
+
+namespace libcocao {
+
+void ChannelBase::close() {
+    if (m_closed.exchange(true, std::memory_order_acq_rel)) return;
+    SpinLock::Lock lock(m_mutex);
+    notifyWatchers();
+    m_waiters[SEND].notifyAll(lock);
+    lock.lock();
+    m_waiters[RECV].notifyAll(lock);
+}
+
+void ChannelBase::watch(FiberSemaphore* sem) {
+    SpinLock::Lock lock(m_mutex);
+    m_watchers.push_back(sem);
+    m_watching.fetch_add(1);
+}
+
+void ChannelBase::unwatch(FiberSemaphore* sem) {
+    SpinLock::Lock lock(m_mutex);
+    auto it = std::find(m_watchers.begin(), m_watchers.end(), sem);
+    if (it != m_watchers.end()) {
+        m_watchers.erase(it);
+        m_watching.fetch_sub(1);
+    }
+}
+
+bool ChannelBase::wait(Side side, const std::function<bool()>& attempt) {
+    while (true) {
+        SpinLock::Lock lock(m_mutex);
+        m_waiting[side].fetch_add(1);
+        //登记之后再试一次，期间对面的notify()一定会看到登记而来拿锁
+        if (attempt()) {
+            m_waiting[side].fetch_sub(1);
+            return true;
+        }
+        if (isClosed()) {
+            m_waiting[side].fetch_sub(1);
+            return false;
+        }
+        m_waiters[side].wait(lock);
+        m_waiting[side].fetch_sub(1);
+    }
+}
+
+void ChannelBase::wake(Side side) {
+    SpinLock::Lock lock(m_mutex);
+    notifyWatchers();
+    //放入后唤醒一个接收方，取出后唤醒一个发送方
+    m_waiters[side ^ 1].notifyOne(lock);
+}
+
+void ChannelBase::notifyWatchers() {
+    //持有m_mutex时notify，unwatch返回后就不会再碰到对方的信号量
+    for (auto& i : m_watchers) {
+        i->notify();
+    }
+}
+
+int ChannelSelect::attempt() {
+    size_t closed = 0;
+    for (size_t i = 0; i < m_cases.size(); ++ i) {
+        int rt = m_cases[i].attempt();
+        if (rt > 0) return i;
+        if (rt < 0) ++ closed;
+    }
+    return closed == m_cases.size() ? -2 : -1;
+}
+
+int ChannelSelect::tryOnce() {
+    int rt = attempt();
+    return rt >= 0 ? rt : -1;
+}
+
+int ChannelSelect::wait() {
+    while (true) {
+        int rt = attempt();
+        if (rt >= 0) return rt;
+        if (rt == -2) return -1;
+
+        if (!m_sem) {
+            m_sem.reset(new FiberSemaphore);
+        }
+        for (auto& i : m_cases) {
+            i.channel->watch(m_sem.get());
+        }
+        //登记之前的变化可能已经错过，登记之后再试一次
+        rt = attempt();
+        if (rt == -1) {
+            m_sem->wait();
+        }
+        for (auto& i : m_cases) {
+            i.channel->unwatch(m_sem.get());
+        }
+        //登记期间攒下的通知作废
+        while (m_sem->tryWait());
+        if (rt >= 0) return rt;
+    }
+}
+
+}
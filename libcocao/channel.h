@@ -0,0 +1,257 @@
+#ifndef __LIBCOCAO_CHANNEL_H__
+#define __LIBCOCAO_CHANNEL_H__
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include "fiber_mutex.h"
+
+namespace libcocao {
+
+/**
+ * @brief 通道中与元素类型无关的部分：等待队列、关闭标记、select的登记
+ * @details 元素的存取是无锁的，只有需要挂起或唤醒对面时才拿m_mutex。
+ *          放入/取出成功后先看对面有没有在等，没人等就不碰锁，单生产者单消费者时基本没有争用
+ */
+class ChannelBase: Noncopyable {
+public:
+    virtual ~ChannelBase() {}
+
+    //关闭后send都失败，recv取完剩下的元素后失败，挂起的协程全部唤醒
+    void close();
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+    //select用：通道状态变化(放入、取出、关闭)时notify一次sem
+    void watch(FiberSemaphore* sem);
+    void unwatch(FiberSemaphore* sem);
+
+protected:
+    enum Side {
+        SEND = 0,
+        RECV = 1
+    };
+    /**
+     * @brief 放入或取出成功后调用，唤醒对面一个等待者和所有select
+     * @param[in] side 刚完成的是哪一边
+     */
+    void notify(Side side) {
+        //和等待方"先登记再重试"配对，保证要么对方重试成功，要么这里看到它在等
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting[side ^ 1].load(std::memory_order_relaxed)
+                || m_watching.load(std::memory_order_relaxed)) {
+            wake(side);
+        }
+    }
+    /**
+     * @brief 挂起直到attempt成功或通道关闭
+     * @param[in] attempt 在持有m_mutex时调用，成功返回true
+     * @return attempt成功返回true，通道已关闭返回false
+     */
+    bool wait(Side side, const std::function<bool()>& attempt);
+
+private:
+    void wake(Side side);
+    void notifyWatchers();
+
+private:
+    SpinLock m_mutex;
+    std::atomic<bool> m_closed{false};
+    std::atomic<uint32_t> m_waiting[2] = {{0}, {0}};    //挂起的发送方、接收方个数
+    std::atomic<uint32_t> m_watching{0};
+    FiberWaitQueue m_waiters[2];
+    std::vector<FiberSemaphore*> m_watchers;
+};
+
+/**
+ * @brief 协程之间传递数据的有界通道，类似Go的带缓冲channel
+ * @details 缓冲是定长的无锁环形队列(每个槽位带序号，多生产者多消费者都安全)。
+ *          满了send挂起、空了recv挂起，挂起的是协程不是线程；不在调度器里的线程调用时阻塞线程。
+ *          容量至少为1，不支持无缓冲的同步通道
+ */
+template<class T>
+class Channel: public ChannelBase {
+public:
+    typedef std::shared_ptr<Channel> ptr;
+
+    explicit Channel(size_t capacity)
+        : m_capacity(capacity ? capacity : 1)
+        , m_cells(new Cell[m_capacity]) {
+        for (size_t i = 0; i < m_capacity; ++ i) {
+            m_cells[i].seq.store(i * 2, std::memory_order_relaxed);
+        }
+    }
+    ~Channel() {
+        for (size_t pos = m_head; pos != m_tail; ++ pos) {
+            reinterpret_cast<T*>(&m_cells[pos % m_capacity].storage)->~T();
+        }
+    }
+
+    size_t capacity() const { return m_capacity; }
+    //大致的元素个数，并发时只能作参考
+    size_t size() const {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * @brief 放入一个元素，满了就挂起
+     * @return 通道已关闭返回false
+     */
+    bool send(const T& v) { return sendImpl(v); }
+    bool send(T&& v) { return sendImpl(std::move(v)); }
+    bool trySend(const T& v) { return trySendImpl(v); }
+    bool trySend(T&& v) { return trySendImpl(std::move(v)); }
+
+    /**
+     * @brief 取出一个元素，空了就挂起
+     * @return 通道已关闭且取空返回false
+     */
+    bool recv(T& v) {
+        if (tryRecv(v)) return true;
+        if (!wait(RECV, [this, &v]() { return pop(v); })) return false;
+        notify(RECV);
+        return true;
+    }
+    bool tryRecv(T& v) {
+        if (!pop(v)) return false;
+        notify(RECV);
+        return true;
+    }
+
+private:
+    template<class U>
+    bool sendImpl(U&& v) {
+        if (isClosed()) return false;
+        if (trySendImpl(std::forward<U>(v))) return true;
+        //push失败时v没有被移走，可以重试
+        if (!wait(SEND, [this, &v]() { return !isClosed() && push(std::forward<U>(v)); })) return false;
+        notify(SEND);
+        return true;
+    }
+    template<class U>
+    bool trySendImpl(U&& v) {
+        if (isClosed() || !push(std::forward<U>(v))) return false;
+        notify(SEND);
+        return true;
+    }
+
+    template<class U>
+    bool push(U&& v) {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = m_cells[pos % m_capacity];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos * 2);
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    new (&cell.storage) T(std::forward<U>(v));
+                    cell.seq.store(pos * 2 + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& v) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = m_cells[pos % m_capacity];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos * 2 + 1);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    T* p = reinterpret_cast<T*>(&cell.storage);
+                    v = std::move(*p);
+                    p->~T();
+                    cell.seq.store((pos + m_capacity) * 2, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    //槽位的序号等于pos*2时可写，等于pos*2+1时可读，容量为1时两种状态也不会混淆
+    struct Cell {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    size_t m_capacity;
+    std::unique_ptr<Cell[]> m_cells;
+    //生产者和消费者的下标放在不同的缓存行
+    char m_pad0[64];
+    std::atomic<size_t> m_tail{0};
+    char m_pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_head{0};
+    char m_pad2[64 - sizeof(std::atomic<size_t>)];
+};
+
+/**
+ * @brief 同时等待多个通道，类似Go的select
+ * @details 先按顺序把每个分支试一遍，都没就绪时在所有通道上登记后挂起，任一通道有变化就醒来重试。
+ *          已关闭的通道上的分支跳过，所有分支的通道都关闭时返回-1
+ */
+class ChannelSelect: Noncopyable {
+public:
+    //从ch取到元素后调用cb(v)
+    template<class T, class F>
+    ChannelSelect& recv(Channel<T>& ch, F cb) {
+        Channel<T>* p = &ch;
+        m_cases.push_back({p, [p, cb]() {
+            T v;
+            if (p->tryRecv(v)) {
+                cb(v);
+                return 1;
+            }
+            return p->isClosed() ? -1 : 0;
+        }});
+        return *this;
+    }
+    //把v放进ch后调用cb()
+    template<class T, class F>
+    ChannelSelect& send(Channel<T>& ch, const T& v, F cb) {
+        Channel<T>* p = &ch;
+        m_cases.push_back({p, [p, v, cb]() {
+            if (p->isClosed()) return -1;
+            if (p->trySend(v)) {
+                cb();
+                return 1;
+            }
+            return 0;
+        }});
+        return *this;
+    }
+
+    //挂起直到有一个分支完成，返回分支下标
+    int wait();
+    //不挂起，没有就绪的分支返回-1，相当于带default分支
+    int tryOnce();
+
+private:
+    //返回完成的分支下标；没有就绪的返回-1，全部关闭返回-2
+    int attempt();
+
+private:
+    struct Case {
+        ChannelBase* channel;
+        //1完成，0未就绪，-1通道已关闭
+        std::function<int()> attempt;
+    };
+    std::vector<Case> m_cases;
+    //通道会在别的线程上notify它，不能放在可能被换出的共享栈上，第一次挂起时再分配
+    std::unique_ptr<FiberSemaphore> m_sem;
+};
+
+}
+
+#endif
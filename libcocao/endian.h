@@ -67,7 +67,7 @@ T byteswapOnBigEndain (T t) {
  */
 template <class T>
 T byteswapOnLittleEndian (T t) {
-    return t;
+    return byteswap(t);
 }
 
 /**
@@ -75,7 +75,7 @@ T byteswapOnLittleEndian (T t) {
  */
 template <class T>
 T byteswapOnBigEndain (T t) {
-    return byteswap(t);
+    return t;
 }
 #endif
 
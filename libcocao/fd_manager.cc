@@ -7,6 +7,7 @@ namespace libcocao {
 FdCtx::FdCtx(int fd)
     : m_isInit(false)
     , m_isSocket(false)
+    , m_isPollable(false)
     , m_sysNonblock(false)
     , m_userNonblock(false)
     , m_isClosed(false)
@@ -28,22 +29,27 @@ bool FdCtx::init() {
     if (-1 == fstat(m_fd, &fd_stat)) {
         m_isInit = false;
         m_isSocket = false;
+        m_isPollable = false;
     } else {
         m_isInit = true;
         m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        //eventfd、timerfd、epoll这类匿名inode没有文件类型位
+        m_isPollable = m_isSocket || S_ISFIFO(fd_stat.st_mode) || (fd_stat.st_mode & S_IFMT) == 0;
     }
 
-    if (m_isSocket) {
+    if (m_isPollable) {
         int flags = fcntl_f(m_fd, F_GETFL, 0);
+        //创建时就带了SOCK_NONBLOCK、O_NONBLOCK、EFD_NONBLOCK的，是用户自己要非阻塞
+        m_userNonblock = flags & O_NONBLOCK;
         if (!(flags & O_NONBLOCK)) {
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
         }
         m_sysNonblock = true;
     } else {
         m_sysNonblock = false;
+        m_userNonblock = false;
     }
 
-    m_userNonblock = false;
     m_isClosed = false;
     return m_isInit;
 }
@@ -62,38 +68,70 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
-}
-
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-
-    if (fd == -1) {
-        return nullptr;
+    for (auto& i : m_chunks) {
+        i.store(nullptr, std::memory_order_relaxed);
     }
+}
 
-    RWMutexType::ReadLock  lock(m_mutex);
-    if ((int)m_datas.size() <= fd) {
-        if (auto_create == false) return nullptr;
-    } else {
-        if (m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+FdManager::~FdManager() {
+    for (auto& i : m_chunks) {
+        Chunk* chunk = i.load(std::memory_order_relaxed);
+        if (!chunk) continue;
+        for (auto& j : chunk->slots) {
+            delete j.load(std::memory_order_relaxed);
         }
+        delete chunk;
     }
-    lock.unlock();
+    for (auto& i : m_retired) {
+        delete i;
+    }
+}
 
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if (fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+FdCtx* FdManager::create(int fd) {
+    Mutex::Lock lock(m_mutex);
+    std::atomic<Chunk*>& slot = m_chunks[fd >> CHUNK_SHIFT];
+    Chunk* chunk = slot.load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new Chunk;
+        slot.store(chunk, std::memory_order_release);
+    }
+    std::atomic<FdCtx*>& cell = chunk->slots[fd & (CHUNK_SIZE - 1)];
+    //可能在拿锁期间被别的线程建好了
+    FdCtx* ctx = cell.load(std::memory_order_relaxed);
+    if (!ctx) {
+        ctx = new FdCtx(fd);
+        cell.store(ctx, std::memory_order_release);
     }
-    m_datas[fd] = ctx;
     return ctx;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if ((int)m_datas.size() <= fd) return;
-    m_datas[fd].reset();
+    if (fd < 0 || fd >= MAX_FDS) return;
+    Mutex::Lock lock(m_mutex);
+    Chunk* chunk = m_chunks[fd >> CHUNK_SHIFT].load(std::memory_order_relaxed);
+    if (!chunk) return;
+    FdCtx* ctx = chunk->slots[fd & (CHUNK_SIZE - 1)].exchange(nullptr, std::memory_order_acq_rel);
+    if (!ctx) return;
+    //摘下之后新的查找拿不到它，已经拿到的读区间可能还在用，不能马上释放
+    m_retired.push_back(ctx);
+    if (m_retired.size() < RECLAIM_BATCH) return;
+    lock.unlock();
+    reclaim();
 }
 
-}
\ No newline at end of file
+void FdManager::reclaim() {
+    Mutex::Lock reclaim_lock(m_reclaimMutex);
+    std::vector<FdCtx*> retired;
+    {
+        Mutex::Lock lock(m_mutex);
+        retired.swap(m_retired);
+    }
+    if (retired.empty()) return;
+    //等宽限期时不能持有m_mutex，读区间里的get(fd, true)会来拿它
+    m_grace.synchronize();
+    for (auto& i : retired) {
+        delete i;
+    }
+}
+
+}
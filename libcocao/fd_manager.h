@@ -1,6 +1,8 @@
 #ifndef __LIBCOCAO_FD_MANAGER_H__
 #define __LIBCOCAO_FD_MANAGER_H__
 #include <memory>
+#include <atomic>
+#include <vector>
 #include <sys/stat.h>
 #include "thread.h"
 #include "iomanager.h"
@@ -16,6 +18,8 @@ public:
     bool init();
     bool isInit() const { return m_isInit; }
     bool isSocket() const { return m_isSocket; }
+    //能否用epoll等待，hook只对这类fd做非阻塞调度
+    bool isPollable() const { return m_isPollable; }
     bool isClose() const { return m_isClosed; }
 
     void setUserNonblock(bool v) { m_userNonblock = v; }
@@ -33,6 +37,8 @@ private:
     bool m_isInit: 1;
     //是否为socket
     bool m_isSocket: 1;
+    //是否为socket、管道或eventfd之类的匿名inode
+    bool m_isPollable: 1;
     //是否hook非阻塞
     bool m_sysNonblock: 1;
     //是否用户主动设置非阻塞
@@ -48,17 +54,75 @@ private:
     libcocao::IOManager* m_iomanager;
 };
 
-class FdManager {
+/**
+ * @brief fd到FdCtx的映射表
+ * @details 按fd分块的只增数组，块和槽位都用原子指针发布，查找是两次load，不拿锁、不动引用计数。
+ *          新建和删除串行化在m_mutex上；删除的FdCtx先放进待回收列表，
+ *          攒够一批后等一个宽限期(所有读区间结束)再统一释放
+ */
+class FdManager: Noncopyable {
 public:
-    typedef RWMutex RWMutexType;
+    /**
+     * @brief 读区间，持有期间get()返回的FdCtx不会被释放
+     * @details 区间内不能挂起协程，也不要调用可能阻塞的函数，否则回收方会一直等
+     */
+    class ReadLock {
+    public:
+        ReadLock(FdManager* mgr)
+            : m_lock(mgr->m_grace) {}
+    private:
+        GracePeriod::ReadLock m_lock;
+    };
+
     FdManager();
+    ~FdManager();
 
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    /**
+     * @brief 取fd对应的FdCtx
+     * @param[in] auto_create 不存在时是否创建
+     * @return 不存在或fd超出范围返回nullptr；解引用需要在ReadLock区间内
+     */
+    FdCtx* get(int fd, bool auto_create = false) {
+        if (fd < 0 || fd >= MAX_FDS) return nullptr;
+        Chunk* chunk = m_chunks[fd >> CHUNK_SHIFT].load(std::memory_order_acquire);
+        if (chunk) {
+            FdCtx* ctx = chunk->slots[fd & (CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+            if (ctx || !auto_create) return ctx;
+        } else if (!auto_create) {
+            return nullptr;
+        }
+        return create(fd);
+    }
     void del(int fd);
 
 private:
-    RWMutexType m_mutex;
-    std::vector<FdCtx::ptr> m_datas;
+    FdCtx* create(int fd);
+    void reclaim();
+
+private:
+    static const int CHUNK_SHIFT = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+    static const int MAX_CHUNKS = 1024;
+    //超出的fd不做管理，hook按普通fd处理
+    static const int MAX_FDS = CHUNK_SIZE * MAX_CHUNKS;
+    //待回收个数达到这个值时等一次宽限期
+    static const size_t RECLAIM_BATCH = 64;
+
+    struct Chunk {
+        std::atomic<FdCtx*> slots[CHUNK_SIZE];
+        Chunk() {
+            for (auto& i : slots) {
+                i.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    };
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS];
+    //保护新建、删除和待回收列表
+    Mutex m_mutex;
+    std::vector<FdCtx*> m_retired;
+    //同一时间只有一个线程在等宽限期
+    Mutex m_reclaimMutex;
+    GracePeriod m_grace;
 };
 
 typedef Singleton<FdManager> FdMgr;
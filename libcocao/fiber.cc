@@ -1,5 +1,8 @@
 #include "fiber.h"
 #include "schedule.h"
+#include "fiber_stack.h"
+#include <assert.h>
+#include <string.h>
 
 
 namespace libcocao {
@@ -30,7 +33,7 @@ Fiber::State Fiber::getState() {
 Fiber::Fiber() {
     SetThis(this);
     m_state = RUNNING;
-    if (getcontext(&m_ctx)) {
+    if (!InitContext(m_ctx)) {
         LIBCOCAO_LOG_ERROR(g_logger) << "getcontext error";
     }
     s_fiber_count ++;
@@ -38,29 +41,31 @@ Fiber::Fiber() {
     LIBCOCAO_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, bool shared_stack)
     : m_id (s_fiber_id++)
     , m_cb (cb)
     , m_run_in_scheduler(run_in_scheduler){
     ++ s_fiber_count;
-    m_stacksize = stacksize ? stacksize : 1024 * 1024;
-    m_stack = malloc(m_stacksize);
+#ifdef LIBCOCAO_CONTEXT_ASM
+    m_useShared = shared_stack;
+#endif
+    if (m_useShared) return;
 
-    if (getcontext(&m_ctx) ) {
-        LIBCOCAO_LOG_ERROR(g_logger) << "getcontext error in Fiber::Fiber";
-    }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+    size_t size = stacksize ? stacksize : 1024 * 1024;
+    m_stack = StackPool::Alloc(size);
+    assert(m_stack);
+    m_stacksize = size;
 
-   makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
     if (m_stack) {
-        free(m_stack);
+        StackPool::Dealloc(m_stack, m_stacksize);
+    } else if (m_useShared) {
+        releaseShared();
+        free(m_saved);
     } else {
         Fiber *cur = t_fiber;
         if (cur == this) {
@@ -73,35 +78,86 @@ Fiber::~Fiber() {
 
 void Fiber::reset(std::function<void()> cb) {
     m_cb = cb;
-    getcontext(&m_ctx);
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if (m_useShared) {
+        releaseShared();
+        m_shared = nullptr;
+        m_savedSize = 0;
+    } else {
+        MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
+    }
     m_state = READY;
 }
 
+int Fiber::getPinnedThread() const {
+    return m_shared ? m_shared->getThreadId() : -1;
+}
+
+void Fiber::switchIn() {
+    SharedStack *stack = SharedStack::GetThis();
+    //栈上的地址不能搬家，只能在绑定的线程恢复；切入方也不能在共享栈上
+    assert(!m_shared || m_shared == stack);
+    assert(!t_fiber || !t_fiber->m_useShared);
+
+    SharedStack::MutexType::Lock lock(stack->m_mutex);
+    Fiber *occupant = stack->m_occupant;
+    if (occupant == this) return;
+    if (occupant) {
+        occupant->saveStack();
+    }
+    if (!m_shared) {
+        m_shared = stack;
+        MakeContext(m_ctx, stack->getStack(), stack->getSize(), &Fiber::MainFunc);
+    } else if (m_savedSize) {
+        memcpy(stack->getTop() - m_savedSize, m_saved, m_savedSize);
+    }
+    stack->m_occupant = this;
+}
+
+void Fiber::saveStack() {
+    char *sp = (char *)ContextStackPointer(m_ctx);
+    size_t used = m_shared->getTop() - sp;
+    m_savedSize = used;
+    if (!used) return;
+    //按实际用量分配，用量缩到一半以下时也重新分配
+    if (used > m_savedCap || used < m_savedCap / 2) {
+        free(m_saved);
+        m_saved = (char *)malloc(used);
+        m_savedCap = used;
+    }
+    memcpy(m_saved, sp, used);
+}
+
+void Fiber::releaseShared() {
+    if (!m_shared) return;
+    SharedStack::MutexType::Lock lock(m_shared->m_mutex);
+    if (m_shared->m_occupant == this) {
+        m_shared->m_occupant = nullptr;
+    }
+}
+
 void Fiber::yield() {
     SetThis(t_thread_fiber.get());
-    if (m_state != TERM) {
-        m_state = READY;
-    }
+    //状态留给resume()在切回之后修改，这里就改成READY的话，别的线程可能在现场保存完之前就恢复它
     if (m_run_in_scheduler) {
-        swapcontext(&m_ctx, &(Scheduler::GetMainFiber()->m_ctx));
+        SwapContext(m_ctx, Scheduler::GetMainFiber()->m_ctx);
     } else {
-        swapcontext(&m_ctx, &(t_fiber->m_ctx));
+        SwapContext(m_ctx, t_fiber->m_ctx);
     }
 }
 
 void Fiber::resume() {
+    if (m_useShared) {
+        switchIn();
+    }
     SetThis(this);
     if (m_state != TERM) m_state = RUNNING;
     if (m_run_in_scheduler) {
-        swapcontext(&(Scheduler::GetMainFiber()->m_ctx), &m_ctx);
+        SwapContext(Scheduler::GetMainFiber()->m_ctx, m_ctx);
     } else {
-        swapcontext(&(t_thread_fiber->m_ctx), &m_ctx);
+        SwapContext(t_thread_fiber->m_ctx, m_ctx);
     }
+    State running = RUNNING;
+    m_state.compare_exchange_strong(running, READY);
 }
 
 void Fiber::MainFunc() {
@@ -112,6 +168,10 @@ void Fiber::MainFunc() {
 
     auto raw_ptr = cur.get();
     cur.reset();
+    //已经结束的协程不需要再保存栈
+    if (raw_ptr->m_useShared) {
+        raw_ptr->releaseShared();
+    }
     raw_ptr->yield();
 }
 
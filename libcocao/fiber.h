@@ -1 +1 @@
-#ifndef __LIBCOCAO_FIBER_H__#define __LIBCOCAO_FIBER_H__#include <ucontext.h>#include <functional>#include <memory>#include <atomic>#include "thread.h"namespace libcocao {class Fiber : public std::enable_shared_from_this<Fiber>{friend class Scheduler;public:    typedef std::shared_ptr<Fiber> ptr;    enum State {        RUNNING,        TERM,        READY    };private:    Fiber();public:    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = false);    ~Fiber();    void reset (std::function<void()> cb);    void yield();    void resume();    State getState();    uint64_t getId() const { return m_id; }public:    static void SetThis(Fiber* f);    static Fiber::ptr GetThis();    static void MainFunc();    static uint64_t GetFiberId();private:    uint64_t m_id = 0;    uint32_t m_stacksize = 0;    State m_state = READY;    ucontext_t m_ctx;    void* m_stack = nullptr;    std::function<void()> m_cb;    bool m_run_in_scheduler;};}#endif
\ No newline at end of file
+#ifndef __LIBCOCAO_FIBER_H__#define __LIBCOCAO_FIBER_H__#include <functional>#include <memory>#include <atomic>#include "thread.h"#include "fiber_context.h"namespace libcocao {class SharedStack;class Fiber : public std::enable_shared_from_this<Fiber>{friend class Scheduler;public:    typedef std::shared_ptr<Fiber> ptr;    enum State {        RUNNING,        TERM,        READY    };private:    Fiber();public:    /**     * @param[in] shared_stack 在线程共享栈上运行，切出后只保存已用的部分，需要汇编切换后端     */    Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = false,          bool shared_stack = false);    ~Fiber();    void reset (std::function<void()> cb);    void yield();    void resume();    State getState();    uint64_t getId() const { return m_id; }    /**     * @brief 共享栈协程第一次运行后只能在该线程恢复，返回线程id，否则返回-1     */    int getPinnedThread() const;    /**     * @brief 是否运行在共享栈上，栈上的缓冲区在协程切出后会被别的协程覆盖     */    bool isSharedStack() const { return m_useShared; }public:    static void SetThis(Fiber* f);    static Fiber::ptr GetThis();    static void MainFunc();    static uint64_t GetFiberId();private:    void switchIn();        //切入前把共享栈占用者的现场拷出，再恢复自己的    void saveStack();       //拷出共享栈上已用的部分    void releaseShared();   //不再占用共享栈private:    uint64_t m_id = 0;    uint32_t m_stacksize = 0;    //切出时由恢复方在现场保存好之后置为READY，其他线程据此判断能否恢复    std::atomic<State> m_state{READY};    FiberContext m_ctx;    void* m_stack = nullptr;    std::function<void()> m_cb;    bool m_run_in_scheduler;    bool m_useShared = false;    SharedStack *m_shared = nullptr;    //第一次切入时绑定    char *m_saved = nullptr;            //被换出时保存的栈内容    size_t m_savedSize = 0;    size_t m_savedCap = 0;};}#endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#include "fiber_context.h"
+#include <stdint.h>
+
+#ifdef LIBCOCAO_CONTEXT_ASM
+
+/**
+ * libcocao_context_swap(void **from_sp, void *to_sp)
+ * 把callee-saved寄存器压到当前栈上，栈顶写入*from_sp，再从to_sp恢复
+ * libcocao_context_entry 是新协程第一次切入时的返回地址，入口函数放在被恢复的寄存器里
+ */
+#if defined(__x86_64__)
+// 栈布局(低->高): mxcsr/x87cw, r12, r13, r14, r15, rbx, rbp, 返回地址
+asm(R"(
+    .text
+    .globl  libcocao_context_swap
+    .hidden libcocao_context_swap
+    .type   libcocao_context_swap, @function
+    .align  16
+libcocao_context_swap:
+    pushq   %rbp
+    pushq   %rbx
+    pushq   %r15
+    pushq   %r14
+    pushq   %r13
+    pushq   %r12
+    subq    $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw  4(%rsp)
+    movq    %rsp, (%rdi)
+    movq    %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw   4(%rsp)
+    addq    $8, %rsp
+    popq    %r12
+    popq    %r13
+    popq    %r14
+    popq    %r15
+    popq    %rbx
+    popq    %rbp
+    ret
+    .size   libcocao_context_swap, .-libcocao_context_swap
+
+    .globl  libcocao_context_entry
+    .hidden libcocao_context_entry
+    .type   libcocao_context_entry, @function
+    .align  16
+libcocao_context_entry:
+    callq   *%r12
+    ud2
+    .size   libcocao_context_entry, .-libcocao_context_entry
+)");
+#elif defined(__aarch64__)
+// 栈布局(低->高): d8-d15, x19-x28, x29, x30(返回地址)
+asm(R"(
+    .text
+    .globl  libcocao_context_swap
+    .hidden libcocao_context_swap
+    .type   libcocao_context_swap, %function
+    .align  4
+libcocao_context_swap:
+    sub     sp, sp, #0xa0
+    stp     d8, d9, [sp, #0x00]
+    stp     d10, d11, [sp, #0x10]
+    stp     d12, d13, [sp, #0x20]
+    stp     d14, d15, [sp, #0x30]
+    stp     x19, x20, [sp, #0x40]
+    stp     x21, x22, [sp, #0x50]
+    stp     x23, x24, [sp, #0x60]
+    stp     x25, x26, [sp, #0x70]
+    stp     x27, x28, [sp, #0x80]
+    stp     x29, x30, [sp, #0x90]
+    mov     x9, sp
+    str     x9, [x0]
+    mov     sp, x1
+    ldp     d8, d9, [sp, #0x00]
+    ldp     d10, d11, [sp, #0x10]
+    ldp     d12, d13, [sp, #0x20]
+    ldp     d14, d15, [sp, #0x30]
+    ldp     x19, x20, [sp, #0x40]
+    ldp     x21, x22, [sp, #0x50]
+    ldp     x23, x24, [sp, #0x60]
+    ldp     x25, x26, [sp, #0x70]
+    ldp     x27, x28, [sp, #0x80]
+    ldp     x29, x30, [sp, #0x90]
+    add     sp, sp, #0xa0
+    ret
+    .size   libcocao_context_swap, .-libcocao_context_swap
+
+    .globl  libcocao_context_entry
+    .hidden libcocao_context_entry
+    .type   libcocao_context_entry, %function
+    .align  4
+libcocao_context_entry:
+    blr     x19
+    brk     #0
+    .size   libcocao_context_entry, .-libcocao_context_entry
+)");
+#endif
+
+extern "C" void libcocao_context_entry();
+
+#endif
+
+namespace libcocao {
+
+#ifdef LIBCOCAO_CONTEXT_ASM
+
+bool InitContext(FiberContext &ctx) {
+    ctx.sp = nullptr;
+    return true;
+}
+
+void MakeContext(FiberContext &ctx, void *stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    void **sp = (void **)(top - 8 * sizeof(void *));
+    uint32_t fpctl[2];
+    asm volatile("stmxcsr %0" : "=m"(fpctl[0]));
+    asm volatile("fnstcw %0" : "=m"(fpctl[1]));
+    ((uint32_t *)sp)[0] = fpctl[0];
+    ((uint32_t *)sp)[1] = fpctl[1];
+    sp[1] = (void *)fn;                             //r12
+    sp[2] = sp[3] = sp[4] = sp[5] = sp[6] = nullptr;//r13 r14 r15 rbx rbp
+    sp[7] = (void *)&libcocao_context_entry;        //返回地址
+#elif defined(__aarch64__)
+    void **sp = (void **)(top - 0xa0);
+    for (int i = 0; i < 20; ++ i) {
+        sp[i] = nullptr;
+    }
+    sp[8] = (void *)fn;                             //x19
+    sp[19] = (void *)&libcocao_context_entry;       //x30
+#endif
+    ctx.sp = sp;
+}
+
+const char *ContextBackend() {
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
+#else
+
+bool InitContext(FiberContext &ctx) {
+    return getcontext(&ctx.ctx) == 0;
+}
+
+void MakeContext(FiberContext &ctx, void *stack, size_t size, void (*fn)()) {
+    getcontext(&ctx.ctx);
+    ctx.ctx.uc_link = nullptr;
+    ctx.ctx.uc_stack.ss_sp = stack;
+    ctx.ctx.uc_stack.ss_size = size;
+    makecontext(&ctx.ctx, fn, 0);
+}
+
+const char *ContextBackend() {
+    return "ucontext";
+}
+
+#endif
+
+}
@@ -0,0 +1,72 @@
+#ifndef __LIBCOCAO_FIBER_CONTEXT_H__
+#define __LIBCOCAO_FIBER_CONTEXT_H__
+
+#include <stddef.h>
+#include <ucontext.h>
+
+/**
+ * 协程上下文切换后端，编译期选择
+ * 定义了LIBCOCAO_FIBER_ASM并且是x86-64/aarch64时使用汇编实现，只保存callee-saved寄存器，不会产生系统调用
+ * 否则退回ucontext，swapcontext每次切换都要rt_sigprocmask保存信号掩码
+ */
+#if defined(LIBCOCAO_FIBER_ASM) && (defined(__x86_64__) || defined(__aarch64__))
+#define LIBCOCAO_CONTEXT_ASM 1
+#endif
+
+#ifdef LIBCOCAO_CONTEXT_ASM
+extern "C" void libcocao_context_swap(void **from_sp, void *to_sp);
+#endif
+
+namespace libcocao {
+
+struct FiberContext {
+#ifdef LIBCOCAO_CONTEXT_ASM
+    /// 切出时寄存器保存在栈上，这里只记录栈顶
+    void *sp = nullptr;
+#else
+    ucontext_t ctx;
+#endif
+};
+
+/**
+ * @brief 初始化线程主协程的上下文
+ * @details 主协程直接使用线程栈，第一次切出时保存现场
+ */
+bool InitContext(FiberContext &ctx);
+
+/**
+ * @brief 在指定的栈上创建上下文，切入后执行fn
+ * @attention fn不能返回
+ */
+void MakeContext(FiberContext &ctx, void *stack, size_t size, void (*fn)());
+
+/**
+ * @brief 保存当前现场到from，切换到to
+ */
+inline void SwapContext(FiberContext &from, FiberContext &to) {
+#ifdef LIBCOCAO_CONTEXT_ASM
+    libcocao_context_swap(&from.sp, to.sp);
+#else
+    swapcontext(&from.ctx, &to.ctx);
+#endif
+}
+
+/**
+ * @brief 返回切出时保存的栈顶，ucontext后端返回nullptr
+ */
+inline void *ContextStackPointer(const FiberContext &ctx) {
+#ifdef LIBCOCAO_CONTEXT_ASM
+    return ctx.sp;
+#else
+    return nullptr;
+#endif
+}
+
+/**
+ * @brief 返回编译选择的切换后端名称
+ */
+const char *ContextBackend();
+
+}
+
+#endif
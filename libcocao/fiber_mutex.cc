@@ -0,0 +1,207 @@
+#include "fiber_mutex.h"
+#include "schedule.h"
+#include <assert.h>
+
+namespace libcocao {
+
+//挂起之前最多自旋的次数，单核上自旋没有意义
+static const int s_spin_count = std::thread::hardware_concurrency() > 1 ? 64 : 0;
+
+void FiberWaiter::wake() {
+    if (fiber) {
+        //共享栈协程会被schedule()自动投递回绑定的线程
+        scheduler->schedule(std::move(fiber));
+    } else {
+        sem->notity();
+    }
+}
+
+void FiberWaitQueue::wait(SpinLock::Lock& lock, const std::function<void()>& before_park) {
+    Scheduler* scheduler = Scheduler::GetThis();
+    if (scheduler && Fiber::GetThis().get() != Scheduler::GetMainFiber()) {
+        m_waiters.push_back(FiberWaiter());
+        FiberWaiter& waiter = m_waiters.back();
+        waiter.fiber = Fiber::GetThis();
+        waiter.scheduler = scheduler;
+        lock.unlock();
+        if (before_park) before_park();
+        //唤醒方可能在yield之前就schedule了，协程切出完成前调度器不会恢复它
+        Fiber::GetThis()->yield();
+    } else {
+        Semaphore sem;
+        m_waiters.push_back(FiberWaiter());
+        m_waiters.back().sem = &sem;
+        lock.unlock();
+        if (before_park) before_park();
+        sem.wait();
+    }
+}
+
+bool FiberWaitQueue::notifyOne(SpinLock::Lock& lock) {
+    if (m_waiters.empty()) {
+        lock.unlock();
+        return false;
+    }
+    FiberWaiter waiter = std::move(m_waiters.front());
+    m_waiters.pop_front();
+    lock.unlock();
+    waiter.wake();
+    return true;
+}
+
+size_t FiberWaitQueue::notifyAll(SpinLock::Lock& lock) {
+    std::deque<FiberWaiter> waiters;
+    waiters.swap(m_waiters);
+    lock.unlock();
+    for (auto& i : waiters) {
+        i.wake();
+    }
+    return waiters.size();
+}
+
+bool FiberMutex::tryLock() {
+    uint32_t state = m_state.load(std::memory_order_relaxed);
+    return !(state & LOCKED)
+        && m_state.compare_exchange_strong(state, state | LOCKED, std::memory_order_acquire);
+}
+
+void FiberMutex::lock() {
+    if (tryLock()) return;
+    for (int i = 0; i < s_spin_count; ++ i) {
+        CpuRelax();
+        if (tryLock()) return;
+    }
+
+    SpinLock::Lock lock(m_mutex);
+    uint32_t state = m_state.load(std::memory_order_relaxed);
+    while (true) {
+        if (!(state & LOCKED)) {
+            if (m_state.compare_exchange_weak(state, state | LOCKED, std::memory_order_acquire)) return;
+        } else if (m_state.compare_exchange_weak(state, state | WAITING, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    //被唤醒时锁已经交到手上
+    m_waiters.wait(lock);
+}
+
+void FiberMutex::unlock() {
+    uint32_t state = LOCKED;
+    if (m_state.compare_exchange_strong(state, 0, std::memory_order_release)) return;
+
+    SpinLock::Lock lock(m_mutex);
+    assert(m_state & LOCKED);
+    if (m_waiters.size() <= 1) {
+        //交给最后一个等待者，锁保持LOCKED
+        m_state.store(LOCKED, std::memory_order_release);
+    }
+    if (!m_waiters.notifyOne(lock)) {
+        m_state.store(0, std::memory_order_release);
+    }
+}
+
+bool FiberRWMutex::tryRdlockNoLock() {
+    if (m_writer || !m_writeWaiters.empty()) return false;
+    ++ m_readers;
+    return true;
+}
+
+bool FiberRWMutex::tryWrlockNoLock() {
+    if (m_writer || m_readers) return false;
+    m_writer = true;
+    return true;
+}
+
+void FiberRWMutex::rdlock() {
+    SpinLock::Lock lock(m_mutex);
+    for (int i = 0; !tryRdlockNoLock(); ++ i) {
+        if (i >= s_spin_count) {
+            m_readWaiters.wait(lock);
+            return;
+        }
+        lock.unlock();
+        CpuRelax();
+        lock.lock();
+    }
+}
+
+void FiberRWMutex::wrlock() {
+    SpinLock::Lock lock(m_mutex);
+    for (int i = 0; !tryWrlockNoLock(); ++ i) {
+        if (i >= s_spin_count) {
+            m_writeWaiters.wait(lock);
+            return;
+        }
+        lock.unlock();
+        CpuRelax();
+        lock.lock();
+    }
+}
+
+void FiberRWMutex::unlock() {
+    SpinLock::Lock lock(m_mutex);
+    bool from_writer = m_writer;
+    if (m_writer) {
+        m_writer = false;
+    } else {
+        assert(m_readers > 0);
+        if (-- m_readers) return;
+    }
+    //写者释放时先放行排队的读者，最后一个读者释放时放行一个写者
+    if ((from_writer || m_writeWaiters.empty()) && !m_readWaiters.empty()) {
+        m_readers += m_readWaiters.size();
+        m_readWaiters.notifyAll(lock);
+    } else if (!m_writeWaiters.empty()) {
+        m_writer = true;
+        m_writeWaiters.notifyOne(lock);
+    }
+}
+
+bool FiberSemaphore::tryWait() {
+    uint32_t count = m_count.load(std::memory_order_relaxed);
+    while (count) {
+        if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) return true;
+    }
+    return false;
+}
+
+void FiberSemaphore::wait() {
+    if (tryWait()) return;
+    for (int i = 0; i < s_spin_count; ++ i) {
+        CpuRelax();
+        if (tryWait()) return;
+    }
+
+    SpinLock::Lock lock(m_mutex);
+    //有等待者时计数只会在持有m_mutex时增加，这里再试一次不会漏掉notify()
+    if (tryWait()) return;
+    m_waiters.wait(lock);
+}
+
+void FiberSemaphore::notify() {
+    SpinLock::Lock lock(m_mutex);
+    if (m_waiters.empty()) {
+        m_count.fetch_add(1, std::memory_order_release);
+        return;
+    }
+    m_waiters.notifyOne(lock);
+}
+
+void FiberCondVar::wait(FiberMutex& mutex) {
+    SpinLock::Lock lock(m_mutex);
+    //先登记再释放互斥量，之后的notify一定能看到自己
+    m_waiters.wait(lock, [&mutex]() { mutex.unlock(); });
+    mutex.lock();
+}
+
+void FiberCondVar::notifyOne() {
+    SpinLock::Lock lock(m_mutex);
+    m_waiters.notifyOne(lock);
+}
+
+void FiberCondVar::notifyAll() {
+    SpinLock::Lock lock(m_mutex);
+    m_waiters.notifyAll(lock);
+}
+
+}
@@ -0,0 +1,137 @@
+#ifndef __LIBCOCAO_FIBER_MUTEX_H__
+#define __LIBCOCAO_FIBER_MUTEX_H__
+
+#include <deque>
+#include <atomic>
+#include <functional>
+#include "mutex.h"
+#include "fiber.h"
+
+namespace libcocao {
+
+class Scheduler;
+
+/**
+ * @brief 挂起中的协程或线程
+ * @details 调度器里的协程记下协程和调度器，唤醒时重新schedule()，可以在调度器的任意线程恢复；
+ *          不在调度器里的线程阻塞在自己栈上的信号量上
+ */
+struct FiberWaiter {
+    Fiber::ptr fiber;
+    Scheduler* scheduler = nullptr;
+    Semaphore* sem = nullptr;
+
+    void wake();
+};
+
+/**
+ * @brief 协程同步原语共用的等待队列，由外部的SpinLock保护
+ */
+class FiberWaitQueue: Noncopyable {
+public:
+    /**
+     * @brief 把当前协程或线程登记到队尾并挂起，被唤醒后返回
+     * @param[in] lock 保护队列的锁，登记后释放，返回时不持有
+     * @param[in] before_park 释放lock之后、挂起之前调用，条件变量用来释放互斥量
+     */
+    void wait(SpinLock::Lock& lock, const std::function<void()>& before_park = nullptr);
+
+    //以下在持有外部锁时调用，唤醒发生在释放lock之后
+    bool empty() const { return m_waiters.empty(); }
+    size_t size() const { return m_waiters.size(); }
+    bool notifyOne(SpinLock::Lock& lock);
+    size_t notifyAll(SpinLock::Lock& lock);
+
+private:
+    std::deque<FiberWaiter> m_waiters;
+};
+
+/**
+ * @brief 协程互斥量
+ * @details 拿不到锁时先自旋一小会儿，再把协程挂起让出线程，解锁时把锁直接交给队头的等待者并重新调度它。
+ *          没有竞争时加锁解锁各一次CAS
+ */
+class FiberMutex: Noncopyable {
+public:
+    typedef ScopeLockImp1<FiberMutex> Lock;
+
+    void lock();
+    bool tryLock();
+    void unlock();
+
+private:
+    enum {
+        LOCKED = 1,
+        WAITING = 2     //等待队列非空，只在持有m_mutex时修改
+    };
+    std::atomic<uint32_t> m_state{0};
+    SpinLock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程读写锁
+ * @details 有写者在等时新的读者也排队，写者释放时优先放行排队的读者，读写两边都不会饿死
+ */
+class FiberRWMutex: Noncopyable {
+public:
+    typedef ReadScopeLockImp1<FiberRWMutex> ReadLock;
+    typedef WriteScopeLockImp1<FiberRWMutex> WriteLock;
+
+    void rdlock();
+    void wrlock();
+    void unlock();
+
+private:
+    bool tryRdlockNoLock();
+    bool tryWrlockNoLock();
+
+private:
+    SpinLock m_mutex;
+    uint32_t m_readers = 0;     //持有读锁的数量
+    bool m_writer = false;      //是否有写者持有
+    FiberWaitQueue m_readWaiters;
+    FiberWaitQueue m_writeWaiters;
+};
+
+/**
+ * @brief 协程信号量
+ * @details 计数大于0时CAS减一直接返回，否则挂起；notify()有等待者时直接交给它，不经过计数
+ */
+class FiberSemaphore: Noncopyable {
+public:
+    FiberSemaphore(uint32_t count = 0)
+        : m_count(count) {}
+
+    void wait();
+    bool tryWait();
+    void notify();
+
+private:
+    std::atomic<uint32_t> m_count;
+    SpinLock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+/**
+ * @brief 协程条件变量，配合FiberMutex使用
+ */
+class FiberCondVar: Noncopyable {
+public:
+    //调用时必须持有mutex，返回时重新持有
+    void wait(FiberMutex& mutex);
+    template<class Predicate>
+    void wait(FiberMutex& mutex, Predicate pred) {
+        while (!pred()) wait(mutex);
+    }
+    void notifyOne();
+    void notifyAll();
+
+private:
+    SpinLock m_mutex;
+    FiberWaitQueue m_waiters;
+};
+
+}
+
+#endif
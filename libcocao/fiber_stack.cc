@@ -0,0 +1,136 @@
+#include "fiber_stack.h"
+#include "log.h"
+#include "utils.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace libcocao {
+
+static Logger::ptr g_logger = LIBCOCAO_LOG_NAME("system");
+
+static const size_t s_class_size[] = {64 * 1024, 256 * 1024, 1024 * 1024};
+/// 共享栈大小，只有被访问到的页才占用物理内存
+static const size_t s_shared_stack_size = 8 * 1024 * 1024;
+/// 每个档位最多缓存的栈数，按档位从小到大
+static const size_t s_class_cache[] = {256, 64, 16};
+/// 每个档位缓存顶部保持常驻的栈数，更深的栈交还物理页
+static const size_t s_class_hot[] = {16, 4, 2};
+
+/// 线程退出时池先于部分协程析构，之后归还的栈直接释放
+static thread_local bool t_pool_destroyed = false;
+
+static size_t GetPageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+StackPool::~StackPool() {
+    t_pool_destroyed = true;
+    for (int i = 0; i < CLASS_COUNT; ++ i) {
+        for (void *sp : m_free[i]) {
+            Unmap(sp, s_class_size[i]);
+        }
+    }
+}
+
+StackPool *StackPool::GetThis() {
+    static thread_local StackPool t_pool;
+    return &t_pool;
+}
+
+int StackPool::GetClass(size_t size) {
+    for (int i = 0; i < CLASS_COUNT; ++ i) {
+        if (size <= s_class_size[i]) return i;
+    }
+    return -1;
+}
+
+void *StackPool::Alloc(size_t &size) {
+    int cls = GetClass(size);
+    if (cls < 0) {
+        size_t page = GetPageSize();
+        size = (size + page - 1) & ~(page - 1);
+        return Map(size);
+    }
+
+    size = s_class_size[cls];
+    if (t_pool_destroyed) return Map(size);
+    StackPool *pool = GetThis();
+    std::vector<void *> &free_list = pool->m_free[cls];
+    if (!free_list.empty()) {
+        void *sp = free_list.back();
+        free_list.pop_back();
+        if (pool->m_released[cls] > free_list.size()) {
+            pool->m_released[cls] = free_list.size();
+        }
+        return sp;
+    }
+    return Map(size);
+}
+
+void StackPool::Dealloc(void *sp, size_t size) {
+    if (!sp) return;
+    int cls = GetClass(size);
+    if (cls < 0 || t_pool_destroyed) {
+        Unmap(sp, size);
+        return;
+    }
+    StackPool *pool = GetThis();
+    std::vector<void *> &free_list = pool->m_free[cls];
+    if (free_list.size() >= s_class_cache[cls]) {
+        Unmap(sp, size);
+        return;
+    }
+    free_list.push_back(sp);
+    //后进先出，被压到常驻数以下的栈短时间内不会复用，把物理页还给内核
+    //只处理新压下去的，反复在边界进出的栈不会重复madvise
+    size_t &released = pool->m_released[cls];
+    while (released + s_class_hot[cls] < free_list.size()) {
+        madvise(free_list[released], size, MADV_DONTNEED);
+        ++ released;
+    }
+}
+
+void *StackPool::Map(size_t size) {
+    size_t page = GetPageSize();
+    void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        LIBCOCAO_LOG_ERROR(g_logger) << "StackPool mmap size=" << size << " errno=" << errno
+                                     << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    if (mprotect(base, page, PROT_NONE)) {
+        LIBCOCAO_LOG_ERROR(g_logger) << "StackPool mprotect errno=" << errno
+                                     << " errstr=" << strerror(errno);
+        munmap(base, size + page);
+        return nullptr;
+    }
+    return (char *)base + page;
+}
+
+void StackPool::Unmap(void *sp, size_t size) {
+    size_t page = GetPageSize();
+    munmap((char *)sp - page, size + page);
+}
+
+SharedStack *SharedStack::GetThis() {
+    static thread_local SharedStack t_shared_stack;
+    return &t_shared_stack;
+}
+
+SharedStack::SharedStack()
+    : m_size(s_shared_stack_size)
+    , m_threadId(libcocao::GetThreadId()) {
+    m_stack = StackPool::Alloc(m_size);
+    assert(m_stack);
+}
+
+SharedStack::~SharedStack() {
+    StackPool::Dealloc(m_stack, m_size);
+}
+
+}
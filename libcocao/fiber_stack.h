@@ -0,0 +1,92 @@
+#ifndef __LIBCOCAO_FIBER_STACK_H__
+#define __LIBCOCAO_FIBER_STACK_H__
+
+#include <stddef.h>
+#include <vector>
+#include "noncopyable.h"
+#include "mutex.h"
+
+namespace libcocao {
+
+/**
+ * @brief 协程栈池
+ * @details 每个线程一个，按64K/256K/1M三档分配，超过1M的直接mmap
+ *          栈底留一页PROT_NONE做溢出保护，物理页在第一次访问时才提交
+ *          释放的栈按档位缓存起来，后进先出复用，超过上限的直接munmap
+ *          缓存顶部的几个栈保持常驻，更深的用MADV_DONTNEED交还物理页，
+ *          复用时重新缺页；缓存占用的常驻内存每线程不超过4M
+ */
+class StackPool : Noncopyable {
+public:
+    /**
+     * @brief 分配协程栈
+     * @param[in, out] size 申请的大小，返回时改为实际可用大小
+     * @return 栈的可用区域起始地址(保护页之上)，失败返回nullptr
+     */
+    static void *Alloc(size_t &size);
+
+    /**
+     * @brief 归还协程栈到当前线程的池
+     * @param[in] sp Alloc返回的地址
+     * @param[in] size Alloc返回的大小
+     */
+    static void Dealloc(void *sp, size_t size);
+
+    ~StackPool();
+
+private:
+    static StackPool *GetThis();
+    static int GetClass(size_t size);
+
+    static void *Map(size_t size);
+    static void Unmap(void *sp, size_t size);
+
+private:
+    enum { CLASS_COUNT = 3 };
+    /// 每个档位缓存的空闲栈
+    std::vector<void *> m_free[CLASS_COUNT];
+    /// 每个档位m_free前多少个已经交还了物理页
+    size_t m_released[CLASS_COUNT] = {0};
+};
+
+class Fiber;
+
+/**
+ * @brief 共享栈
+ * @details 每个线程一个大栈，共享栈模式的协程都在上面运行
+ *          同一时刻只有一个协程占用，其他协程切入时才把占用者已用的部分拷贝出去
+ */
+class SharedStack : Noncopyable {
+friend class Fiber;
+public:
+    typedef SpinLock MutexType;
+
+    /**
+     * @brief 返回当前线程的共享栈，第一次调用时创建
+     */
+    static SharedStack *GetThis();
+
+    ~SharedStack();
+
+    void *getStack() const { return m_stack; }
+    size_t getSize() const { return m_size; }
+    /// 栈顶(高地址)
+    char *getTop() const { return (char *)m_stack + m_size; }
+    int getThreadId() const { return m_threadId; }
+
+private:
+    SharedStack();
+
+private:
+    void *m_stack = nullptr;
+    size_t m_size = 0;
+    int m_threadId = -1;
+    /// 当前栈上保存着现场的协程
+    Fiber *m_occupant = nullptr;
+    /// 保护m_occupant，协程可能在其他线程析构
+    MutexType m_mutex;
+};
+
+}
+
+#endif
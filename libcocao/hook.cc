@@ -1,4 +1,5 @@
 #include "hook.h"
+#include <algorithm>
 
 static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_NAME("system");
 
@@ -13,17 +14,29 @@ static thread_local bool t_hook_enable = false;
         XX(socket)   \
         XX(connect)   \
         XX(accept)   \
+        XX(accept4)   \
         XX(read)   \
         XX(readv)   \
         XX(recv)   \
         XX(recvfrom)   \
         XX(recvmsg)   \
+        XX(recvmmsg)   \
         XX(write)   \
         XX(writev)   \
         XX(send)   \
         XX(sendto)   \
         XX(sendmsg)   \
+        XX(sendmmsg)   \
         XX(close)   \
+        XX(dup)   \
+        XX(dup2)   \
+        XX(dup3)   \
+        XX(pipe)   \
+        XX(pipe2)   \
+        XX(eventfd)   \
+        XX(poll)   \
+        XX(select)   \
+        XX(epoll_wait)   \
         XX(fcntl)   \
         XX(ioctl)   \
         XX(getsockopt)   \
@@ -49,7 +62,7 @@ struct _HookIniter {
 
 static _HookIniter s_hook_initer;
 
-bool is_Hook_enable() {
+bool is_hook_enable() {
     return t_hook_enable;
 }
 
@@ -59,35 +72,75 @@ void set_hook_enable(bool flag) {
 
 }
 
-struct timer_info {
-    int cancelled = 0;
+enum FdHookState {
+    FD_UNMANAGED,       //FdManager里没有这个fd
+    FD_CLOSED,          //FdCtx已标记关闭
+    FD_ORIGIN,          //不能用epoll等待或用户设置了非阻塞，直接调原函数
+    FD_HOOK             //由hook做非阻塞调度
 };
 
+/**
+ * @brief 在FdManager的读区间里取出fd的状态和超时，出了函数不再碰FdCtx
+ * @details 读区间里不能挂起也不能阻塞，原函数和yield都放在区间外
+ */
+static FdHookState get_fd_state(int fd, int timeout_so, uint64_t &to, bool *is_socket = nullptr) {
+    libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+    libcocao::FdManager::ReadLock lock(mgr);
+    libcocao::FdCtx *ctx = mgr->get(fd);
+    if (!ctx) return FD_UNMANAGED;
+    if (ctx->isClose()) return FD_CLOSED;
+    if (!ctx->isPollable() || ctx->getUserNonblock()) return FD_ORIGIN;
+    to = ctx->getTimeout(timeout_so);
+    if (is_socket) *is_socket = ctx->isSocket();
+    return FD_HOOK;
+}
+
+/**
+ * @brief io_uring后端直接提交读写，不走EAGAIN->addEvent->唤醒->重试
+ * @return 不适用(未开启hook、非socket、用户设置了非阻塞、提交失败)时返回false，由do_io处理
+ */
+static bool do_uring_io(int fd, libcocao::IoUring::Op op, int timeout_so, void *addr, uint32_t len,
+                        uint64_t off, uint32_t op_flags, ssize_t &n) {
+    if (!libcocao::t_hook_enable) return false;
+
+    libcocao::IOManager *iom = libcocao::IOManager::GetThis();
+    if (!iom || !iom->isUring()) return false;
+    //共享栈协程切出后栈被别的协程覆盖，内核异步读写的缓冲区、iovec、msghdr可能就在栈上，只能走epoll
+    if (libcocao::Fiber::GetThis()->isSharedStack()) return false;
+
+    uint64_t to = -1;
+    bool is_socket = false;
+    if (get_fd_state(fd, timeout_so, to, &is_socket) != FD_HOOK) return false;
+    //READ/WRITE提交的是RECV/SEND，pipe、eventfd上会报ENOTSOCK，这些fd走epoll
+    if (!is_socket) return false;
+
+    int rt = iom->submitIO(op, fd, addr, len, off, op_flags, to);
+    if (rt == -EAGAIN) return false;
+    if (rt < 0) {
+        errno = -rt;
+        n = -1;
+    } else {
+        n = rt;
+    }
+    return true;
+}
+
 template<typename OriginFun, typename... Args>
 static ssize_t do_io (int fd, OriginFun fun, const char* hook_fun_name, uint32_t event, int timeout_so, Args &&... args) {
     if (!libcocao::t_hook_enable) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(fd);
-
-    if (!ctx) {
-        int rt = fun(fd, std::forward<Args>(args)...);
-        return rt;
-    }
-
-    if (ctx->isClose()) {
+    uint64_t to = -1;     //超时时间
+    FdHookState state = get_fd_state(fd, timeout_so, to);
+    if (state == FD_CLOSED) {
         errno = EBADF;
         return -1;
     }
-
-    if (!ctx->isSocket() || ctx->getUserNonblock()) {
+    if (state != FD_HOOK) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    uint64_t to = ctx->getTimeout(timeout_so);      //取出超时时间
-    std::shared_ptr<timer_info> tinfo(new timer_info);//设置超时条件
-
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
 
@@ -95,44 +148,145 @@ retry:
         n = fun(fd, std::forward<Args>(args)...);       //如果读取不成功且是被系统中断，读了多次还没有读到操作会换为EAGIN
     }
     if (n == -1 && errno == EAGAIN) {           //如果读取不成功且需要再次读
+        //挂起到fd就绪再重试；超时或添加事件失败时errno已经设置好
         libcocao::IOManager *iom = libcocao::IOManager::GetThis();
-        libcocao::Timer::ptr timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
-
-        if (to != (uint64_t)-1) {   //超时时间不为-1，即已设置了超时时间
-            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {  //添加条件超时定时器
-                auto t = winfo.lock();  //拿出条件变量并唤醒
-                if (!t || t->cancelled) return;     //有这个条件且未被设置错误
-                t->cancelled = ETIMEDOUT;  //取消时间不需要做，已经超时了
-                iom->cancelEvent(fd, (libcocao::IOManager::Event)event);
-            }, winfo);
+        if (iom->waitEvent(fd, (libcocao::IOManager::Event)event, to)) {
+            return -1;
+        }
+        goto retry;
+    }
+    return n;
+}
+
+/**
+ * @brief 登记hook里新得到的fd
+ * @details 号码被复用时先丢掉残留的FdCtx；del可能要等宽限期，不能在读区间里调用
+ */
+static void register_fd(int fd) {
+    libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+    if (mgr->get(fd)) mgr->del(fd);
+    mgr->get(fd, true);
+}
+
+/**
+ * @brief fd即将被关闭或被dup2覆盖：唤醒在它上面等待的协程，摘掉FdCtx
+ */
+static void release_fd(int fd) {
+    if (libcocao::FdMgr::GetInstance()->get(fd)) {
+        auto iom = libcocao::IOManager::GetThis();
+        if (iom) iom->cancelAll(fd);
+        libcocao::FdMgr::GetInstance()->del(fd);
+    }
+}
+
+/**
+ * @brief dup出来的newfd沿用oldfd的非阻塞和超时设置，oldfd不归FdManager管时newfd也不管
+ */
+static void dup_fd_ctx(int oldfd, int newfd) {
+    libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+    bool managed = false;
+    bool user_nonblock = false;
+    uint64_t recv_timeout = -1;
+    uint64_t send_timeout = -1;
+    {
+        libcocao::FdManager::ReadLock lock(mgr);
+        libcocao::FdCtx *old = mgr->get(oldfd);
+        if (old && !old->isClose()) {
+            managed = true;
+            user_nonblock = old->getUserNonblock();
+            recv_timeout = old->getTimeout(SO_RCVTIMEO);
+            send_timeout = old->getTimeout(SO_SNDTIMEO);
         }
-        int c = 0;
-        int rt = iom->addEvent(fd, (libcocao::IOManager::Event)(event));
-        if (rt) {
-            //添加失败，定时器取消
-            if (c) {
-                LIBCOCAO_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
-                                                << fd << ", " << event << ")";
+    }
+    if (!managed) {
+        if (mgr->get(newfd)) mgr->del(newfd);
+        return;
+    }
+    register_fd(newfd);
+    libcocao::FdManager::ReadLock lock(mgr);
+    libcocao::FdCtx *ctx = mgr->get(newfd);
+    if (!ctx) return;
+    //共享同一个打开的文件，O_NONBLOCK已经是hook设置的，用户设置以oldfd为准
+    ctx->setUserNonblock(user_nonblock);
+    ctx->setTimeoout(SO_RCVTIMEO, recv_timeout);
+    ctx->setTimeoout(SO_SNDTIMEO, send_timeout);
+}
+
+/**
+ * @brief 协程版poll的等待状态，IO事件和超时谁先到谁唤醒协程，只唤醒一次
+ */
+struct PollWaiter {
+    std::atomic<bool> woken{false};
+    libcocao::Fiber::ptr fiber;
+    libcocao::IOManager *iom = nullptr;
+
+    void wake() {
+        if (!woken.exchange(true)) iom->schedule(fiber);
+    }
+};
+
+//距离deadline还剩多少毫秒，deadline为~0ull表示不超时，返回-1
+static int remain_ms(uint64_t deadline) {
+    if (deadline == ~0ull) return -1;
+    uint64_t now = libcocao::GetMonotonicMS();
+    return now >= deadline ? 0 : (int)(deadline - now);
+}
+
+/**
+ * @brief 协程版poll
+ * @details 先非阻塞poll一次，没有就绪的就把每个fd的读写事件登记到IOManager，连同超时定时器一起等，
+ *          醒来后撤掉剩下的事件再非阻塞poll一次。fd上已经有协程在等同一个事件时不能再登记，
+ *          和IOManager的约束一样；有fd登记失败(比如普通文件)时退回阻塞的poll
+ */
+static int do_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    int rt = poll_f(fds, nfds, 0);
+    if (rt != 0 || timeout == 0) return rt;
+
+    libcocao::IOManager *iom = libcocao::IOManager::GetThis();
+    uint64_t deadline = timeout > 0 ? libcocao::GetMonotonicMS() + timeout : ~0ull;
+    std::vector<std::pair<int, libcocao::IOManager::Event> > registered;
+    while (true) {
+        std::shared_ptr<PollWaiter> waiter(new PollWaiter);
+        waiter->fiber = libcocao::Fiber::GetThis();
+        waiter->iom = iom;
+        registered.clear();
+        bool failed = false;
+        for (nfds_t i = 0; i < nfds && !failed; ++ i) {
+            if (fds[i].fd < 0) continue;
+            libcocao::IOManager::Event events[2] = {libcocao::IOManager::NONE, libcocao::IOManager::NONE};
+            if (fds[i].events & (POLLIN | POLLPRI | POLLRDHUP)) events[0] = libcocao::IOManager::READ;
+            if (fds[i].events & POLLOUT) events[1] = libcocao::IOManager::WRITE;
+            for (auto event : events) {
+                if (event == libcocao::IOManager::NONE) continue;
+                //同一个fd在数组里出现多次时只登记一次
+                auto key = std::make_pair(fds[i].fd, event);
+                if (std::find(registered.begin(), registered.end(), key) != registered.end()) continue;
+                if (iom->addEvent(fds[i].fd, event, [waiter]() { waiter->wake(); })) {
+                    failed = true;
+                    break;
+                }
+                registered.push_back(key);
             }
-            if (timer) {
-                timer->cancel();
+        }
+
+        if (!failed) {
+            libcocao::Timer::ptr timer;
+            int wait = remain_ms(deadline);
+            if (wait >= 0) {
+                timer = iom->addTimer(wait, [waiter]() { waiter->wake(); });
             }
-            return -1;
-        } else {
-            //添加成功后，让出时间
-            LIBCOCAO_LOG_INFO(g_logger) << "do_io" << hook_fun_name << ">";
             libcocao::Fiber::GetThis()->yield();
-            LIBCOCAO_LOG_INFO(g_logger) << "do_io" << hook_fun_name << ">";
             if (timer) timer->cancel();
-            if (tinfo->cancelled) {
-                errno = tinfo->cancelled;
-                return -1;
-            }
-            goto retry;
         }
+        //已经触发的事件delEvent返回false，回调晚到时woken已置位，不会重复唤醒
+        for (auto &i : registered) {
+            iom->delEvent(i.first, i.second);
+        }
+        if (failed) return poll_f(fds, nfds, remain_ms(deadline));
+
+        rt = poll_f(fds, nfds, 0);
+        if (rt != 0 || remain_ms(deadline) == 0) return rt;
     }
-    return n;
 }
 
 
@@ -157,7 +311,7 @@ int usleep(useconds_t usec) {
 
     libcocao::Fiber::ptr fiber = libcocao::Fiber::GetThis();
     libcocao::IOManager* iom = libcocao::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(libcocao::Scheduler::*)
+    iom->addTimerUS(usec, std::bind((void(libcocao::Scheduler::*)
                     (libcocao::Fiber::ptr, int thread))&libcocao::IOManager::schedule,
                                          iom, fiber, -1));
     libcocao::Fiber::GetThis()->yield();
@@ -167,11 +321,11 @@ int usleep(useconds_t usec) {
 int nanosleep(const struct timespec *req, struct timespec *rem) {
     if (!libcocao::t_hook_enable) return nanosleep_f(req, rem);
 
-    int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    uint64_t timeout_us = req->tv_sec * 1000 * 1000ul + req->tv_nsec / 1000;
 
     libcocao::Fiber::ptr fiber = libcocao::Fiber::GetThis();
     libcocao::IOManager* iom = libcocao::IOManager::GetThis();
-    iom->addTimer(timeout_ms, [iom, fiber]() {
+    iom->addTimerUS(timeout_us, [iom, fiber]() {
         iom->schedule(fiber);
     });
     libcocao::Fiber::GetThis()->yield();
@@ -184,49 +338,27 @@ int socket(int domain, int type, int protocol) {
     int fd = socket_f(domain, type, protocol);
     if (fd == -1) return fd;
 
-    libcocao::FdMgr::GetInstance()->get(fd, true);
+    register_fd(fd);
     return fd;
 }
 
 int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout) {
     if (!libcocao::t_hook_enable) return connect_f(fd, addr, addrlen);
-    libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(fd);
-    if (!ctx || ctx->isClose()) {
+    uint64_t to = -1;
+    FdHookState state = get_fd_state(fd, SO_SNDTIMEO, to);
+    if (state == FD_UNMANAGED || state == FD_CLOSED) {
         errno = EBADF;
         return -1;
     }
-
-    if (!ctx->isSocket()) return connect_f(fd, addr, addrlen);
-    if (ctx->getUserNonblock()) return connect_f(fd, addr, addrlen);
+    if (state == FD_ORIGIN) return connect_f(fd, addr, addrlen);
 
     int n = connect_f(fd, addr, addrlen);
     if (n == 0) return 0;
     else if (n != -1 || errno != EINPROGRESS) return n;
 
     libcocao::IOManager* iom = libcocao::IOManager::GetThis();
-    libcocao::Timer::ptr timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    if (timeout != (uint64_t)-1) {
-        timer = iom->addConditionTimer(timeout, [winfo, fd, iom]() {
-            auto t = winfo.lock();
-            if (!t || t->cancelled) return;
-            t->cancelled = ETIMEDOUT;
-            iom->cancelEvent(fd, libcocao::IOManager::WRITE);
-        }, winfo);
-    }
-
-    int rt = iom->addEvent(fd, libcocao::IOManager::WRITE);
-    if(rt == 0) {
-        libcocao::Fiber::GetThis()->yield();
-        if (timer) timer->cancel();
-        if (tinfo->cancelled) {
-            errno = tinfo->cancelled;
-            return -1;
-        }
-    }  else {
-        if (timer) timer->cancel();
+    if (iom->waitEvent(fd, libcocao::IOManager::WRITE, timeout)) {
+        if (errno == ETIMEDOUT) return -1;
         LIBCOCAO_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
@@ -246,20 +378,39 @@ int connect (int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr* addr, socklen_t *addrlen) {
-    int fd = do_io (s, accept_f, "accept", libcocao::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
-    if (fd >= 0) libcocao::FdMgr::GetInstance()->get(fd, true);
+    ssize_t n;
+    int fd;
+    if (do_uring_io(s, libcocao::IoUring::ACCEPT, SO_RCVTIMEO, addr, 0, (uint64_t)addrlen, 0, n)) {
+        fd = n;
+    } else {
+        fd = do_io (s, accept_f, "accept", libcocao::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    }
+    if (fd >= 0 && libcocao::t_hook_enable) register_fd(fd);
+    return fd;
+}
+
+int accept4(int s, struct sockaddr* addr, socklen_t *addrlen, int flags) {
+    int fd = do_io(s, accept4_f, "accept4", libcocao::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    //带SOCK_NONBLOCK时FdCtx初始化会记为用户非阻塞
+    if (fd >= 0 && libcocao::t_hook_enable) register_fd(fd);
     return fd;
 }
 
 ssize_t read(int fd, void* buf, size_t count) {
+    ssize_t n;
+    if (do_uring_io(fd, libcocao::IoUring::READ, SO_RCVTIMEO, buf, count, 0, 0, n)) return n;
     return do_io(fd, read_f, "read", libcocao::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+    ssize_t n;
+    if (do_uring_io(fd, libcocao::IoUring::READV, SO_RCVTIMEO, (void*)iov, iovcnt, 0, 0, n)) return n;
     return do_io(fd, readv_f, "readv", libcocao::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
+    ssize_t n;
+    if (do_uring_io(sockfd, libcocao::IoUring::READ, SO_RCVTIMEO, buf, len, 0, flags, n)) return n;
     return do_io(sockfd, recv_f, "recv", libcocao::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
@@ -268,18 +419,30 @@ ssize_t recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr*
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    ssize_t n;
+    if (do_uring_io(sockfd, libcocao::IoUring::RECVMSG, SO_RCVTIMEO, msg, 1, 0, flags, n)) return n;
     return do_io(sockfd, recvmsg_f, "recvmsg", libcocao::IOManager::READ, SO_RCVTIMEO, msg,flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout) {
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", libcocao::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 ssize_t write(int fd, const void *buf, size_t count) {
+    ssize_t n;
+    if (do_uring_io(fd, libcocao::IoUring::WRITE, SO_SNDTIMEO, (void*)buf, count, 0, 0, n)) return n;
     return do_io(fd, write_f, "write", libcocao::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+    if (do_uring_io(fd, libcocao::IoUring::WRITEV, SO_SNDTIMEO, (void*)iov, iovcnt, 0, 0, n)) return n;
     return do_io(fd, writev_f, "writev", libcocao::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
+    ssize_t n;
+    if (do_uring_io(sockfd, libcocao::IoUring::WRITE, SO_SNDTIMEO, (void*)buf, len, 0, flags, n)) return n;
     return do_io(sockfd, send_f, "send", libcocao::IOManager::WRITE, SO_SNDTIMEO, buf, len, flags);
 }
 
@@ -288,21 +451,155 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags, const struct
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+    ssize_t n;
+    if (do_uring_io(sockfd, libcocao::IoUring::SENDMSG, SO_SNDTIMEO, (void*)msg, 1, 0, flags, n)) return n;
     return do_io(sockfd, sendmsg_f, "sendmsg", libcocao::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", libcocao::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
 int close(int fd) {
-    if (libcocao::t_hook_enable) return close_f(fd);
+    if (!libcocao::t_hook_enable) return close_f(fd);
 
-    libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(fd);
-    if (ctx) {
-        auto iom = libcocao::IOManager::GetThis();
-        if (iom) iom->cancelAll(fd);
-        libcocao::FdMgr::GetInstance()->del(fd);
-    }
+    release_fd(fd);
     return close_f(fd);
 }
 
+int dup(int oldfd) {
+    int fd = dup_f(oldfd);
+    if (fd >= 0 && libcocao::t_hook_enable) dup_fd_ctx(oldfd, fd);
+    return fd;
+}
+
+int dup2(int oldfd, int newfd) {
+    if (!libcocao::t_hook_enable || oldfd == newfd) return dup2_f(oldfd, newfd);
+
+    //newfd原来打开的文件会被内核悄悄关掉，先按close处理
+    release_fd(newfd);
+    int fd = dup2_f(oldfd, newfd);
+    if (fd >= 0) dup_fd_ctx(oldfd, fd);
+    return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    if (!libcocao::t_hook_enable || oldfd == newfd) return dup3_f(oldfd, newfd, flags);
+
+    release_fd(newfd);
+    int fd = dup3_f(oldfd, newfd, flags);
+    if (fd >= 0) dup_fd_ctx(oldfd, fd);
+    return fd;
+}
+
+int pipe(int pipefd[2]) {
+    if (!libcocao::t_hook_enable) return pipe_f(pipefd);
+
+    int rt = pipe_f(pipefd);
+    if (rt == 0) {
+        register_fd(pipefd[0]);
+        register_fd(pipefd[1]);
+    }
+    return rt;
+}
+
+int pipe2(int pipefd[2], int flags) {
+    if (!libcocao::t_hook_enable) return pipe2_f(pipefd, flags);
+
+    int rt = pipe2_f(pipefd, flags);
+    if (rt == 0) {
+        register_fd(pipefd[0]);
+        register_fd(pipefd[1]);
+    }
+    return rt;
+}
+
+int eventfd(unsigned int initval, int flags) {
+    if (!libcocao::t_hook_enable) return eventfd_f(initval, flags);
+
+    //glibc的eventfd_read/eventfd_write不经过hook，协程里要用read/write
+    int fd = eventfd_f(initval, flags);
+    if (fd >= 0) register_fd(fd);
+    return fd;
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    if (!libcocao::t_hook_enable) return poll_f(fds, nfds, timeout);
+    return do_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout) {
+    if (!libcocao::t_hook_enable) return select_f(nfds, readfds, writefds, exceptfds, timeout);
+
+    int timeout_ms = -1;
+    if (timeout) timeout_ms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+    std::vector<struct pollfd> pfds;
+    for (int fd = 0; fd < nfds; ++ fd) {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds)) events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds)) events |= POLLOUT;
+        if (exceptfds && FD_ISSET(fd, exceptfds)) events |= POLLPRI;
+        if (events) pfds.push_back({fd, events, 0});
+    }
+
+    uint64_t begin = libcocao::GetMonotonicMS();
+    int rt = do_poll(pfds.data(), pfds.size(), timeout_ms);
+    if (rt < 0) return rt;
+    for (auto &i : pfds) {
+        //select对无效fd整体失败，集合保持不变
+        if (i.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+
+    if (readfds) FD_ZERO(readfds);
+    if (writefds) FD_ZERO(writefds);
+    if (exceptfds) FD_ZERO(exceptfds);
+    rt = 0;
+    for (auto &i : pfds) {
+        if ((i.events & POLLIN) && (i.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(i.fd, readfds);
+            ++ rt;
+        }
+        if ((i.events & POLLOUT) && (i.revents & (POLLOUT | POLLERR))) {
+            FD_SET(i.fd, writefds);
+            ++ rt;
+        }
+        if ((i.events & POLLPRI) && (i.revents & POLLPRI)) {
+            FD_SET(i.fd, exceptfds);
+            ++ rt;
+        }
+    }
+    //和Linux一样把剩余时间写回timeout
+    if (timeout) {
+        uint64_t used = libcocao::GetMonotonicMS() - begin;
+        uint64_t left = (uint64_t)timeout_ms > used ? timeout_ms - used : 0;
+        timeout->tv_sec = left / 1000;
+        timeout->tv_usec = left % 1000 * 1000;
+    }
+    return rt;
+}
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if (!libcocao::t_hook_enable) return epoll_wait_f(epfd, events, maxevents, timeout);
+
+    int rt = epoll_wait_f(epfd, events, maxevents, 0);
+    if (rt != 0 || timeout == 0) return rt;
+
+    //epoll fd上有就绪事件时它自己可读，等它的READ事件
+    libcocao::IOManager *iom = libcocao::IOManager::GetThis();
+    uint64_t deadline = timeout > 0 ? libcocao::GetMonotonicMS() + timeout : ~0ull;
+    while (true) {
+        if (iom->waitEvent(epfd, libcocao::IOManager::READ, remain_ms(deadline))) {
+            if (errno == ETIMEDOUT) return epoll_wait_f(epfd, events, maxevents, 0);
+            return epoll_wait_f(epfd, events, maxevents, remain_ms(deadline));
+        }
+        rt = epoll_wait_f(epfd, events, maxevents, 0);
+        if (rt != 0 || remain_ms(deadline) == 0) return rt;
+    }
+}
+
 int fcntl(int fd, int cmd, ... /* arg */ ) {
 //    if (!libcocao::t_hook_enable) return fcntl_f(fd, cmd);
 
@@ -313,15 +610,18 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
         {
             int arg = va_arg(va, int);
             va_end(va);
-            libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(fd);
-            if (!ctx || ctx->isClose() || !ctx->isSocket()) {
-                return fcntl_f(fd, cmd, arg);
-            }
-            ctx->setUserNonblock(arg & O_NONBLOCK);
-            if (ctx->getSysNonblock()) {
-                arg |= O_NONBLOCK;
-            } else {
-                arg &= ~O_NONBLOCK;
+            {
+                libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+                libcocao::FdManager::ReadLock lock(mgr);
+                libcocao::FdCtx *ctx = mgr->get(fd);
+                if (ctx && !ctx->isClose() && ctx->isPollable()) {
+                    ctx->setUserNonblock(arg & O_NONBLOCK);
+                    if (ctx->getSysNonblock()) {
+                        arg |= O_NONBLOCK;
+                    } else {
+                        arg &= ~O_NONBLOCK;
+                    }
+                }
             }
             return fcntl_f(fd, cmd, arg);
         }
@@ -330,8 +630,10 @@ int fcntl(int fd, int cmd, ... /* arg */ ) {
         {
             va_end(va);
             int arg = fcntl_f(fd, cmd);
-            libcocao::FdCtx::ptr ctx = libcocao::FdMgr ::GetInstance()->get(fd);
-            if (!ctx || ctx->isClose() || !ctx->isSocket()) return arg;
+            libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+            libcocao::FdManager::ReadLock lock(mgr);
+            libcocao::FdCtx *ctx = mgr->get(fd);
+            if (!ctx || ctx->isClose() || !ctx->isPollable()) return arg;
             if (ctx->getUserNonblock()) return arg | O_NONBLOCK;
             else return arg & ~O_NONBLOCK;
         }
@@ -394,9 +696,10 @@ int ioctl(int fd, unsigned long request, ...) {
 
     if (FIONBIO == request) {
         bool user_nonblock = !!*(int*)arg;
-        libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(fd);
-        if (!ctx || ctx->isClose() || !ctx->isSocket()) return ioctl_f(fd, request, arg);
-        ctx->setUserNonblock(user_nonblock);
+        libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+        libcocao::FdManager::ReadLock lock(mgr);
+        libcocao::FdCtx *ctx = mgr->get(fd);
+        if (ctx && !ctx->isClose() && ctx->isPollable()) ctx->setUserNonblock(user_nonblock);
     }
     return ioctl_f(fd, request, arg);
 }
@@ -407,9 +710,10 @@ int getsockopt(int sockfd, int level, int optname, void *optval, socklen_t *optl
 
 int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen) {
     if (!libcocao::t_hook_enable) return setsockopt_f(sockfd, level, optname, optval, optlen);
-    if (level == SOL_SOCKET) {}
-    if (optname == SO_RCVTIMEO || SO_SNDTIMEO) {
-        libcocao::FdCtx::ptr ctx = libcocao::FdMgr::GetInstance()->get(sockfd);
+    if (level == SOL_SOCKET && (optname == SO_RCVTIMEO || optname == SO_SNDTIMEO)) {
+        libcocao::FdManager *mgr = libcocao::FdMgr::GetInstance();
+        libcocao::FdManager::ReadLock lock(mgr);
+        libcocao::FdCtx *ctx = mgr->get(sockfd);
         if (ctx) {
             const timeval * v = (const timeval*)optval;
             ctx->setTimeoout(optname, v->tv_sec * 1000 + v->tv_usec / 1000);
@@ -7,6 +7,10 @@
 #include <time.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <iostream>
 #include <functional>
 #include <dlfcn.h>
@@ -43,6 +47,9 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr* addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int s, struct sockaddr* addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
 
 //read
 typedef ssize_t (*read_fun)(int fd, void* buf, size_t);
@@ -60,6 +67,9 @@ extern recvfrom_fun recvfrom_f;
 typedef ssize_t (*recvmsg_fun)(int sockfd, struct msghdr* msg, int flags);
 extern recvmsg_fun recvmsg_f;
 
+typedef int (*recvmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+extern recvmmsg_fun recvmmsg_f;
+
 
 //write
 typedef ssize_t (*write_fun)(int fd, const void *buf, size_t count);
@@ -77,12 +87,46 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int sockfd, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef int (*sendmmsg_fun)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+extern sendmmsg_fun sendmmsg_f;
+
 
 //close
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
 
+//新建fd，新fd登记到FdManager
+typedef int (*dup_fun)(int oldfd);
+extern dup_fun dup_f;
+
+typedef int (*dup2_fun)(int oldfd, int newfd);
+extern dup2_fun dup2_f;
+
+typedef int (*dup3_fun)(int oldfd, int newfd, int flags);
+extern dup3_fun dup3_f;
+
+typedef int (*pipe_fun)(int pipefd[2]);
+extern pipe_fun pipe_f;
+
+typedef int (*pipe2_fun)(int pipefd[2], int flags);
+extern pipe2_fun pipe2_f;
+
+typedef int (*eventfd_fun)(unsigned int initval, int flags);
+extern eventfd_fun eventfd_f;
+
+
+//多路复用，等待期间让出协程
+typedef int (*poll_fun)(struct pollfd *fds, nfds_t nfds, int timeout);
+extern poll_fun poll_f;
+
+typedef int (*select_fun)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout);
+extern select_fun select_f;
+
+typedef int (*epoll_wait_fun)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+extern epoll_wait_fun epoll_wait_f;
+
+
 typedef int (*fcntl_fun)(int fd, int cmd, .../* arg */);
 extern fcntl_fun fcntl_f;
 
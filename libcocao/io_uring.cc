@@ -0,0 +1,328 @@
+#include "io_uring.h"
+#include "log.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef LIBCOCAO_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+namespace libcocao {
+
+static Logger::ptr g_logger = LIBCOCAO_LOG_NAME("system");
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if (m_sqes) munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing) munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing) munmap(m_sqRing, m_sqRingSize);
+    if (m_eventFd >= 0) close(m_eventFd);
+    if (m_fd >= 0) close(m_fd);
+}
+
+#ifdef LIBCOCAO_IO_URING
+
+static_assert(sizeof(IoUring::Timeout) == sizeof(__kernel_timespec), "Timeout layout");
+
+/// 需要内核支持的操作
+static const uint8_t s_required_ops[] = {
+    IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READV, IORING_OP_WRITEV,
+    IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT, IORING_OP_LINK_TIMEOUT,
+    IORING_OP_ASYNC_CANCEL,
+};
+
+static bool ProbeOps(int fd) {
+    size_t len = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::vector<char> buf(len, 0);
+    io_uring_probe *probe = (io_uring_probe *)&buf[0];
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    for (uint8_t op : s_required_ops) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    m_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (m_fd < 0) {
+        LIBCOCAO_LOG_INFO(g_logger) << "io_uring_setup errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_NODROP) || !ProbeOps(m_fd)) {
+        LIBCOCAO_LOG_INFO(g_logger) << "io_uring lacks required features=" << params.features;
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if (single_mmap) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED) {
+        m_sqes = nullptr;
+        return false;
+    }
+
+    char *sq = (char *)m_sqRing;
+    m_sqHead = (unsigned *)(sq + params.sq_off.head);
+    m_sqTail = (unsigned *)(sq + params.sq_off.tail);
+    m_sqArray = (unsigned *)(sq + params.sq_off.array);
+    m_sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqLocalTail = *m_sqTail;
+
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (unsigned *)(cq + params.cq_off.head);
+    m_cqTail = (unsigned *)(cq + params.cq_off.tail);
+    m_cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    m_cqes = cq + params.cq_off.cqes;
+
+    m_cancelByFd = probeCancelFd();
+    if (!m_cancelByFd) {
+        LIBCOCAO_LOG_INFO(g_logger) << "io_uring lacks IORING_ASYNC_CANCEL_FD, cancel ops one by one";
+    }
+
+    m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventFd < 0) return false;
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) < 0) {
+        LIBCOCAO_LOG_ERROR(g_logger) << "io_uring register eventfd errno=" << errno
+                                     << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IoUring::enter() {
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    while (m_toSubmit) {
+        int rt = syscall(__NR_io_uring_enter, m_fd, m_toSubmit, 0, 0, nullptr, 0);
+        if (rt < 0 && errno == EINTR) continue;
+        //EAGAIN/EBUSY也算失败：空闲循环不会主动再enter，留在队列里的SQE要等到下一次有完成或提交才走
+        if (rt <= 0) return false;
+        m_toSubmit -= rt;
+    }
+    return true;
+}
+
+bool IoUring::probeCancelFd() {
+#ifdef IORING_ASYNC_CANCEL_FD
+    unsigned idx = m_sqLocalTail & m_sqMask;
+    io_uring_sqe *sqe = &((io_uring_sqe *)m_sqes)[idx];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = m_fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD;
+    m_sqArray[idx] = idx;
+    ++ m_sqLocalTail;
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    int rt = syscall(__NR_io_uring_enter, m_fd, 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (rt != 1) {
+        if (rt < 0) {
+            -- m_sqLocalTail;
+            __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+        }
+        return false;
+    }
+    unsigned head = *m_cqHead;
+    if (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) return false;
+    int res = ((io_uring_cqe *)m_cqes)[head & m_cqMask].res;
+    __atomic_store_n(m_cqHead, head + 1, __ATOMIC_RELEASE);
+    //认识这个标志的内核找不到要取消的操作，返回-ENOENT；不认识的旧内核返回-EINVAL
+    return res != -EINVAL;
+#else
+    return false;
+#endif
+}
+
+bool IoUring::submit(Op op, int fd, void *addr, uint32_t len, uint64_t off, uint32_t op_flags,
+                     Timeout *timeout, uint64_t data, uint64_t timeout_data) {
+    static const uint8_t s_opcodes[] = {
+        IORING_OP_RECV, IORING_OP_SEND, IORING_OP_READV, IORING_OP_WRITEV,
+        IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT,
+    };
+    unsigned need = timeout ? 2 : 1;
+
+    MutexType::Lock lock(m_sqMutex);
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail - head + need > m_sqEntries) {
+        return false;
+    }
+
+    io_uring_sqe *sqes = (io_uring_sqe *)m_sqes;
+    unsigned idx = m_sqLocalTail & m_sqMask;
+    io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = s_opcodes[op];
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->msg_flags = op_flags;
+    sqe->user_data = data;
+    m_sqArray[idx] = idx;
+    ++ m_sqLocalTail;
+
+    if (timeout) {
+        sqe->flags |= IOSQE_IO_LINK;
+        idx = m_sqLocalTail & m_sqMask;
+        io_uring_sqe *tsqe = &sqes[idx];
+        memset(tsqe, 0, sizeof *tsqe);
+        tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+        tsqe->fd = -1;
+        tsqe->addr = (uint64_t)timeout;
+        tsqe->len = 1;
+        tsqe->user_data = timeout_data;
+        m_sqArray[idx] = idx;
+        ++ m_sqLocalTail;
+    }
+    m_toSubmit += need;
+
+    if (!enter()) {
+        //没提交的SQE在队尾，本次放进去的在最后。一个都没被取走就撤回，调用方改走epoll；
+        //留在队列里的话以后的enter会替已经放弃的调用方提交，缓冲区可能早已失效
+        LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "io_uring_enter errno=" << errno
+            << " errstr=" << strerror(errno);
+        if (m_toSubmit >= need) {
+            m_sqLocalTail -= need;
+            m_toSubmit -= need;
+            __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+            return false;
+        }
+        //操作已经交给内核，只剩链接的超时没提交，撤回超时，操作照常等完成
+        m_sqLocalTail -= m_toSubmit;
+        m_toSubmit = 0;
+        __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    }
+    if (!m_cancelByFd) {
+        m_inflight[fd].insert(data);
+        m_inflightFd[data] = fd;
+    }
+    return true;
+}
+
+void IoUring::cancel(int fd) {
+    MutexType::Lock lock(m_sqMutex);
+    io_uring_sqe *sqes = (io_uring_sqe *)m_sqes;
+    //放一个取消请求，队列满时先把已有的交给内核腾出位置
+    auto push_cancel = [&](int cancel_fd, uint64_t cancel_data, uint32_t flags) {
+        unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqLocalTail - head >= m_sqEntries) {
+            enter();
+            head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+            if (m_sqLocalTail - head >= m_sqEntries) {
+                LIBCOCAO_LOG_ERROR(g_logger) << "io_uring cancel fd=" << fd << " submission queue full";
+                return false;
+            }
+        }
+        unsigned idx = m_sqLocalTail & m_sqMask;
+        io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof *sqe);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = cancel_fd;
+        sqe->addr = cancel_data;
+        sqe->cancel_flags = flags;
+        sqe->user_data = 0;
+        m_sqArray[idx] = idx;
+        ++ m_sqLocalTail;
+        ++ m_toSubmit;
+        __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+        return true;
+    };
+
+    if (m_cancelByFd) {
+#ifdef IORING_ASYNC_CANCEL_FD
+        push_cancel(fd, 0, IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL);
+#endif
+    } else {
+        //记录在完成时才删除，这里只发取消请求
+        auto it = m_inflight.find(fd);
+        if (it == m_inflight.end()) return;
+        for (uint64_t data : it->second) {
+            if (!push_cancel(-1, data, 0)) break;
+        }
+    }
+    enter();
+}
+
+void IoUring::reap(std::vector<std::pair<uint64_t, int> > &completions) {
+    size_t begin = completions.size();
+    MutexType::Lock lock(m_cqMutex);
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    io_uring_cqe *cqes = (io_uring_cqe *)m_cqes;
+    for (; head != tail; ++ head) {
+        io_uring_cqe &cqe = cqes[head & m_cqMask];
+        if (cqe.user_data) {
+            completions.push_back(std::make_pair((uint64_t)cqe.user_data, cqe.res));
+        }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    lock.unlock();
+
+    //上次enter因为完成队列满而没提交完的，趁腾出空间再提交
+    MutexType::Lock lock2(m_sqMutex);
+    if (!m_cancelByFd) {
+        for (size_t i = begin; i < completions.size(); ++ i) {
+            auto it = m_inflightFd.find(completions[i].first);
+            if (it == m_inflightFd.end()) continue;
+            auto fit = m_inflight.find(it->second);
+            fit->second.erase(it->first);
+            if (fit->second.empty()) m_inflight.erase(fit);
+            m_inflightFd.erase(it);
+        }
+    }
+    enter();
+}
+
+#else
+
+bool IoUring::init(unsigned entries) {
+    return false;
+}
+
+bool IoUring::submit(Op op, int fd, void *addr, uint32_t len, uint64_t off, uint32_t op_flags,
+                     Timeout *timeout, uint64_t data, uint64_t timeout_data) {
+    return false;
+}
+
+void IoUring::cancel(int fd) {
+}
+
+void IoUring::reap(std::vector<std::pair<uint64_t, int> > &completions) {
+}
+
+#endif
+
+}
@@ -0,0 +1,123 @@
+#ifndef __LIBCOCAO_IO_URING_H__
+#define __LIBCOCAO_IO_URING_H__
+
+#include <stdint.h>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include "noncopyable.h"
+#include "mutex.h"
+
+namespace libcocao {
+
+/**
+ * @brief io_uring的最小封装，直接走系统调用，不依赖liburing
+ * @details 提交队列和完成队列各一把锁，多个线程可以同时提交和收割
+ *          完成事件通过注册的eventfd通知，由IOManager放进epoll里等待
+ *          编译期没有定义LIBCOCAO_IO_URING，或者内核不支持需要的操作时init返回false
+ */
+class IoUring : Noncopyable {
+public:
+    typedef SpinLock MutexType;
+
+    /// 支持的操作，socket上的读写用RECV/SEND实现
+    enum Op {
+        READ,
+        WRITE,
+        READV,
+        WRITEV,
+        RECVMSG,
+        SENDMSG,
+        ACCEPT,
+    };
+
+    /// 与__kernel_timespec布局相同
+    struct Timeout {
+        int64_t tv_sec = 0;
+        long long tv_nsec = 0;
+    };
+
+    IoUring();
+    ~IoUring();
+
+    /**
+     * @brief 创建ring并注册eventfd
+     * @param[in] entries 提交队列长度
+     * @return 内核不支持时返回false
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @brief 提交一个操作
+     * @param[in] op 操作类型
+     * @param[in] fd 文件句柄
+     * @param[in] addr 缓冲区/iovec/msghdr/sockaddr
+     * @param[in] len 长度或iovec个数
+     * @param[in] off 偏移，ACCEPT时为socklen_t*
+     * @param[in] op_flags recv/send/accept的flags
+     * @param[in] timeout 不为空时链接一个超时，超时后操作以-ECANCELED完成
+     * @param[in] data 操作完成时返回的标识
+     * @param[in] timeout_data 超时完成时返回的标识
+     * @return 队列已满或者io_uring_enter出错(包括EAGAIN/EBUSY)返回false，这时操作没有提交
+     */
+    bool submit(Op op, int fd, void *addr, uint32_t len, uint64_t off, uint32_t op_flags,
+                Timeout *timeout, uint64_t data, uint64_t timeout_data);
+
+    /**
+     * @brief 取消fd上所有未完成的操作，被取消的操作以-ECANCELED完成
+     * @details 内核支持IORING_ASYNC_CANCEL_FD(5.19起)时一个请求取消整个fd，否则按记录的标识逐个取消
+     */
+    void cancel(int fd);
+
+    /**
+     * @brief 收割所有已完成的操作
+     * @param[out] completions <标识, 结果>，标识为0的(取消请求)不返回
+     */
+    void reap(std::vector<std::pair<uint64_t, int> > &completions);
+
+    int getEventFd() const { return m_eventFd; }
+
+private:
+    bool enter();   //提交尚未提交的SQE，EINTR重试，出错或者没有进展时返回false，剩下的留在队列里
+    bool probeCancelFd();   //同步提交一次按fd取消，看内核是否认识这个标志
+
+private:
+    int m_fd = -1;
+    int m_eventFd = -1;
+
+    void *m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void *m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    void *m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned *m_sqHead = nullptr;
+    unsigned *m_sqTail = nullptr;
+    unsigned *m_sqArray = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    /// 本地的提交队列尾，enter时写回ring
+    unsigned m_sqLocalTail = 0;
+    /// 已经放进队列但还没有被内核接收的SQE数
+    unsigned m_toSubmit = 0;
+
+    unsigned *m_cqHead = nullptr;
+    unsigned *m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    void *m_cqes = nullptr;
+
+    MutexType m_sqMutex;
+    MutexType m_cqMutex;
+    /// 内核是否支持按fd取消
+    bool m_cancelByFd = false;
+    /// 不支持按fd取消时记录未完成的操作，fd -> 标识，由m_sqMutex保护
+    std::unordered_map<int, std::unordered_set<uint64_t> > m_inflight;
+    /// 标识 -> fd，完成时据此从m_inflight里删除
+    std::unordered_map<uint64_t, int> m_inflightFd;
+};
+
+}
+
+#endif
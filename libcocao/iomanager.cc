@@ -1,8 +1,9 @@
 #include "iomanager.h"
+#include "hook.h"
 #include "log.h"
-#include <unistd.h>    // for pipe()
+#include <unistd.h>    // for close()
 #include <sys/epoll.h> // for epoll_xxx()
-#include <fcntl.h>     // for fcntl()
+#include <sys/eventfd.h> // for eventfd()
 #include <cstring>
 
 namespace libcocao {
@@ -25,38 +26,79 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx) {
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.thread = -1;
 }
 
 void IOManager::FdContext::triggerEvent(Event event) {
     events = (Event)(events & ~event);
     EventContext& ctx = getEventContext(event);
     if (ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, ctx.thread);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, ctx.thread);
     }
     ctx.scheduler = nullptr;
     return;
 }
 
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
-    : Scheduler(threads, use_caller, name){
-
-    m_epfd = epoll_create(5000);
-
-    int rt = pipe(m_tickleFds);
-    assert(!rt);
+/**
+ * @brief 一次io_uring操作的上下文
+ * @details 带超时的操作会有两个完成事件，都收到后才恢复协程
+ */
+struct UringOp {
+    Scheduler *scheduler = nullptr;
+    Fiber::ptr fiber;
+    int res = 0;
+    bool timedout = false;
+    std::atomic<int> pending{1};
+    IoUring::Timeout timeout;
+};
+
+/// 超时完成事件的标识在UringOp地址上置最低位
+static const uint64_t s_uring_timeout_tag = 1;
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, Backend backend,
+                     TimerManager::Type timer_type, EpollMode epoll_mode)
+    : Scheduler(threads, use_caller, name)
+    , TimerManager(timer_type) {
+
+    size_t pollers = epoll_mode == PER_THREAD_EPOLL ? getQueueCount() : 1;
     epoll_event event;
-    memset (&event, 0, sizeof event);
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    assert(!rt);
+    int rt = 0;
+    for (size_t i = 0; i < pollers; ++ i) {
+        Poller *poller = new Poller;
+        poller->epfd = epoll_create(5000);
+        assert(poller->epfd >= 0);
+        poller->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        assert(poller->tickleFd >= 0);
+        memset (&event, 0, sizeof event);
+        //边沿触发，一次写入只唤醒一个epoll_wait的线程
+        event.events = EPOLLIN | EPOLLET;
+        //和fd的事件一样用指针区分，不会和FdContext的地址混淆
+        event.data.ptr = poller;
+        rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, poller->tickleFd, &event);
+        assert(!rt);
+        m_pollers.push_back(poller);
+    }
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    assert(!rt);
+    if (backend == IO_URING && m_pollers.size() > 1) {
+        //完成事件只能通知一个epoll，协程也会被恢复到任意线程，和每线程epoll的目的冲突
+        LIBCOCAO_LOG_INFO(g_logger) << "name=" << name << " io_uring unsupported with per-thread epoll, fallback to epoll";
+    } else if (backend == IO_URING) {
+        m_uring = new IoUring;
+        if (m_uring->init(4096)) {
+            memset (&event, 0, sizeof event);
+            event.events = EPOLLIN | EPOLLET;
+            event.data.ptr = m_uring;
+            rt = epoll_ctl(m_pollers[0]->epfd, EPOLL_CTL_ADD, m_uring->getEventFd(), &event);
+            assert(!rt);
+        } else {
+            LIBCOCAO_LOG_INFO(g_logger) << "name=" << name << " io_uring unavailable, fallback to epoll";
+            delete m_uring;
+            m_uring = nullptr;
+        }
+    }
     contextResize(32);
 
     start();
@@ -64,9 +106,12 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    for (auto &i : m_pollers) {
+        close(i->epfd);
+        close(i->tickleFd);
+        delete i;
+    }
+    delete m_uring;
 
     for (size_t i = 0; i < m_fdContexts.size(); ++ i) {
         if (m_fdContexts[i]) {}
@@ -76,10 +121,44 @@ IOManager::~IOManager() {
 
 
 void IOManager::tickle() {
+    //不能用hasIdleThreads()提前返回：线程取任务失败之后、计入空闲之前投递的任务会没人唤醒，
+    //让它在epoll_wait里一直睡到超时；重复的唤醒由ticklePending合并
+    if (m_pollers.size() == 1) {
+        wakePoller(m_pollers[0]);
+        return;
+    }
+    //每个线程一个epoll时找一个阻塞在epoll_wait上的线程，让它来取没有绑定线程的任务
+    size_t n = m_pollers.size();
+    size_t start = m_nextTickle++;
+    for (size_t i = 0; i < n; ++ i) {
+        Poller *poller = m_pollers[(start + i) % n];
+        if (poller->idle) {
+            wakePoller(poller);
+            return;
+        }
+    }
+}
+
+void IOManager::tickleThread(int index) {
+    if (m_pollers.size() == 1) {
+        tickle();
+        return;
+    }
+    //线程正忙时标记会留到它下次epoll_wait，最多多一次空唤醒
+    wakePoller(m_pollers[index]);
+}
+
+void IOManager::wakePoller(Poller *poller) {
+    if (poller->ticklePending.exchange(true)) return;
     LIBCOCAO_LOG_DEBUG(g_logger) << "tickle";
-    if (hasIdleThreads()) return;
-    int rt = write (m_tickleFds[1], "T", 1);
-    assert(rt == 1);
+    int rt = eventfd_write(poller->tickleFd, 1);
+    assert(rt == 0);
+}
+
+IOManager::Poller *IOManager::getPoller() {
+    if (m_pollers.size() == 1) return m_pollers[0];
+    int index = getQueueIndex();
+    return m_pollers[index >= 0 ? index : 0];
 }
 
 void IOManager::contextResize(size_t size) {
@@ -102,29 +181,40 @@ void IOManager::idle() {
         delete []ptr;
     });
 
+    //到期的定时器回调，跨轮复用容量
+    std::vector<std::function<void()>> cbs;
+    Poller *poller = getPoller();
     while (true) {
+        //本轮事件循环的时间，定时器都基于这个缓存计算，不再各自取时钟
+        libcocao::UpdateCachedMonotonicUS();
         uint64_t next_timeout = 0;
-        if (stopping()) {
+        //先标记空闲再检查能否退出，stop()里的tickle要么看到标记，要么这里看到m_stopping
+        poller->idle = true;
+        if (stopping(next_timeout)) {
+            poller->idle = false;
             LIBCOCAO_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+            libcocao::ClearCachedMonotonic();
+            //每次只唤醒一个线程，退出前接力唤醒下一个
+            tickle();
             break;
         }
+        //标记空闲之后再看一次队列，tickle没看到空闲标记时不会唤醒这个线程，这里就不能睡
+        if (hasStealableTask()) next_timeout = 0;
 
         //阻塞在epoll_wait上，等待事件的发生或定时器超时
         int rt = 0;
         do {
             static const int MAX_TIMEOUT = 5000;
-            if (next_timeout != ~0ull) {
-                next_timeout = std::min((int)next_timeout, MAX_TIMEOUT);
-            } else {
-                next_timeout = MAX_TIMEOUT;
-            }
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+            next_timeout = std::min(next_timeout, (uint64_t)MAX_TIMEOUT);
+            //开了hook的线程里epoll_wait会被换成协程版，这里要真正阻塞
+            rt = epoll_wait_f(poller->epfd, events, MAX_EVENTS, (int)next_timeout);
             if(rt < 0 && errno == EINTR) continue;
             else break;
         } while(true);
+        poller->idle = false;
+        libcocao::UpdateCachedMonotonicUS();
 
         //收集所有已超时的定时器，执行回调函数
-        std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
 
         if (!cbs.empty()) {
@@ -134,9 +224,18 @@ void IOManager::idle() {
 
         for (int i = 0; i < rt; ++ i) {
             epoll_event event = events[i];
-            if (event.data.fd == m_tickleFds[0]) {
-                uint8_t  dummy[256];
-                while (read(m_tickleFds[0], dummy, sizeof dummy) > 0);
+            if (event.data.ptr == poller) {
+                //先读后清标记，清标记之前的tickle由本线程回到run()后处理
+                eventfd_t dummy;
+                eventfd_read(poller->tickleFd, &dummy);
+                poller->ticklePending = false;
+                continue;
+            }
+
+            if (m_uring && event.data.ptr == m_uring) {
+                eventfd_t dummy;
+                eventfd_read(m_uring->getEventFd(), &dummy);
+                reapUring();
                 continue;
             }
 
@@ -156,9 +255,9 @@ void IOManager::idle() {
             int op = left_events ? EPOLL_CTL_MOD: EPOLL_CTL_DEL;
             event.events = EPOLLET | left_events;
 
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int rt2 = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &event);
             if (rt2) {
-                LIBCOCAO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "epoll_ctl(" << fd_ctx->epfd << ", "
                                             << op << ", " << fd_ctx->fd << ", " << event.events << "):"
                                             << rt2 << "(" << errno << ") (" << strerror(errno) << ")";
                 continue;
@@ -180,28 +279,87 @@ void IOManager::idle() {
     }
 }
 
-int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb) {
-    FdContext *fd_ctx = nullptr;
+int IOManager::submitIO(IoUring::Op op, int fd, void *addr, uint32_t len, uint64_t off,
+                        uint32_t op_flags, uint64_t timeout) {
+    UringOp *uop = new UringOp;
+    uop->scheduler = Scheduler::GetThis();
+    uop->fiber = Fiber::GetThis();
+    IoUring::Timeout *ts = nullptr;
+    if (timeout != (uint64_t)-1) {
+        uop->timeout.tv_sec = timeout / 1000;
+        uop->timeout.tv_nsec = (timeout % 1000) * 1000 * 1000;
+        uop->pending = 2;
+        ts = &uop->timeout;
+    }
+
+    ++m_pendingEventCount;
+    if (!m_uring->submit(op, fd, addr, len, off, op_flags, ts,
+                         (uint64_t)uop, (uint64_t)uop | s_uring_timeout_tag)) {
+        --m_pendingEventCount;
+        delete uop;
+        return -EAGAIN;
+    }
+
+    Fiber::GetThis()->yield();
+
+    int res = uop->res;
+    if (res == -ECANCELED) {
+        //链接的超时到期，或者fd被cancelAll取消
+        res = uop->timedout ? -ETIMEDOUT : -EBADF;
+    }
+    delete uop;
+    return res;
+}
+
+void IOManager::reapUring() {
+    std::vector<std::pair<uint64_t, int> > completions;
+    m_uring->reap(completions);
+    for (auto &i : completions) {
+        UringOp *uop = (UringOp *)(i.first & ~s_uring_timeout_tag);
+        if (i.first & s_uring_timeout_tag) {
+            if (i.second == -ETIME) uop->timedout = true;
+        } else {
+            uop->res = i.second;
+        }
+        if (-- uop->pending == 0) {
+            --m_pendingEventCount;
+            uop->scheduler->schedule(&uop->fiber);
+        }
+    }
+}
+
+IOManager::FdContext *IOManager::getFdContext(int fd) {
     RWMutexType::ReadLock lock(m_mutex);
     if ((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+        return m_fdContexts[fd];
     }
+    lock.unlock();
+    RWMutexType::WriteLock lock2(m_mutex);
+    //放锁期间可能已经被别的线程扩过了，fd为0时fd * 1.5也不够
+    if ((int)m_fdContexts.size() <= fd) {
+        contextResize(fd * 1.5 + 1);
+    }
+    return m_fdContexts[fd];
+}
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb) {
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    return addEventNoLock(fd_ctx, event, cb);
+}
+
+int IOManager::addEventNoLock(FdContext *fd_ctx, Event event, std::function<void()> &cb) {
+    int fd = fd_ctx->fd;
+    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    //第一次注册时加到当前线程的epoll上，之后的修改都在同一个epoll上
+    int epfd = fd_ctx->events ? fd_ctx->epfd : getPoller()->epfd;
     epoll_event epevent;
     epevent.events = EPOLLET | fd_ctx->events | event;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if (rt) {
-        LIBCOCAO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+        LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "epoll_ctl(" << epfd << ", "
                                     << op << ", " << fd << ", " << epevent.events << rt << "("
                                     << errno << ")" << ") (" << strerror(errno) << ") fd_ctx->events:"
                                     << fd_ctx->events;
@@ -209,11 +367,14 @@ int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb
     }
 
     ++m_pendingEventCount;
+    fd_ctx->epfd = epfd;
     fd_ctx->events = (Event)(fd_ctx->events | event);
     FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
     assert(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
 
     event_ctx.scheduler = Scheduler::GetThis();
+    //每个线程一个epoll时，事件就绪后回到注册它的线程
+    event_ctx.thread = (m_pollers.size() > 1 && getQueueIndex() >= 0) ? libcocao::GetThreadId() : -1;
     if (cb) {
         event_ctx.cb.swap(cb);
     } else {
@@ -223,6 +384,53 @@ int IOManager::addEvent(int fd, IOManager::Event event, std::function<void()> cb
     return 0;
 }
 
+int IOManager::waitEvent(int fd, IOManager::Event event, uint64_t timeout) {
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    std::function<void()> cb;
+    if (addEventNoLock(fd_ctx, event, cb)) return -1;
+
+    FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+    uint32_t seq = ++ event_ctx.waitSeq;
+    event_ctx.timedout = false;
+    if (timeout != (uint64_t)-1) {
+        if (!event_ctx.timer) event_ctx.timer = createTimer();
+        uint32_t tag = seq << 3 | event;
+        //只捕获16字节的平凡类型，std::function放在内部缓冲里，不分配内存
+        event_ctx.timer->restart(timeout * 1000, [this, fd, tag]() {
+            onWaitTimeout(fd, tag);
+        });
+    }
+    lock.unlock();
+    Fiber::GetThis()->yield();
+
+    lock.lock();
+    //序号变了说明期间有别的协程在同一个fd上开始了新的等待，定时器归它
+    bool timedout = false;
+    if (event_ctx.waitSeq == seq) {
+        timedout = event_ctx.timedout;
+        ++ event_ctx.waitSeq;
+        if (event_ctx.timer) event_ctx.timer->cancel();
+    }
+    lock.unlock();
+    if (timedout) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return 0;
+}
+
+void IOManager::onWaitTimeout(int fd, uint32_t tag) {
+    Event event = (Event)(tag & (READ | WRITE));
+    FdContext *fd_ctx = getFdContext(fd);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    FdContext::EventContext &event_ctx = fd_ctx->getEventContext(event);
+    //等待已经结束，或者已经是下一次等待
+    if ((event_ctx.waitSeq << 3) != (tag & ~7u) || !(fd_ctx->events & event)) return;
+    event_ctx.timedout = true;
+    cancelEventNoLock(fd_ctx, event);
+}
+
 bool IOManager::delEvent(int fd, IOManager::Event event) {
     RWMutexType::ReadLock lock(m_mutex);
     if ((int)m_fdContexts.size() <= fd) return false;
@@ -239,9 +447,9 @@ bool IOManager::delEvent(int fd, IOManager::Event event) {
     epevent.events = EPOLLET | new_events;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
     if (rt) {
-        LIBCOCAO_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
+        LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "epoll_ctl (" << fd_ctx->epfd << ", "
                                      << op << ", " << fd << ", " << epevent.events << "):"
                                      << rt << "(" << errno << ") (" << strerror(errno) << ") ";
         return false;
@@ -265,6 +473,10 @@ bool IOManager::cancelEvent(int fd, IOManager::Event event) {
     lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    return cancelEventNoLock(fd_ctx, event);
+}
+
+bool IOManager::cancelEventNoLock(FdContext *fd_ctx, Event event) {
     if (!(fd_ctx->events & event)) return false;
 
     Event new_events = (Event) (fd_ctx->events & ~event);
@@ -273,10 +485,10 @@ bool IOManager::cancelEvent(int fd, IOManager::Event event) {
     epevent.events = EPOLLET | new_events;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(fd_ctx->epfd, op, fd_ctx->fd, &epevent);
     if (rt) {
-        LIBCOCAO_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                                    << op << ", " << fd << ", " << epevent.events
+        LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                                    << op << ", " << fd_ctx->fd << ", " << epevent.events
                                     << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
     }
@@ -287,10 +499,20 @@ bool IOManager::cancelEvent(int fd, IOManager::Event event) {
 }
 
 bool IOManager::stopping() {
-    return m_pendingEventCount == 0 && Scheduler::stopping();
+    uint64_t timeout = 0;
+    return stopping(timeout);
+}
+
+bool IOManager::stopping(uint64_t &timeout) {
+    //还有定时器没触发时不能退出，否则sleep中的协程会丢失
+    timeout = getNextTimer();
+    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 bool IOManager::cancelAll(int fd) {
+    if (m_uring) {
+        m_uring->cancel(fd);
+    }
     RWMutexType::ReadLock lock(m_mutex);
     if ((int) m_fdContexts.size() <= fd) return false;
 
@@ -305,9 +527,9 @@ bool IOManager::cancelAll(int fd) {
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(fd_ctx->epfd, op, fd, &epevent);
     if(rt) {
-        LIBCOCAO_LOG_ERROR(g_logger) << "epoll_ctl (" << m_epfd << ", "
+        LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "epoll_ctl (" << fd_ctx->epfd << ", "
                                     << op << ", " << fd << ", " << epevent.events << ", "
                                     << rt << " (" << errno << strerror(errno) << ")";
         return false;
@@ -330,7 +552,7 @@ IOManager *IOManager::GetThis() {
 }
 
 void IOManager::onTimerInsertAtFront() {
-
+    tickle();
 }
 
 
@@ -3,6 +3,7 @@
 
 #include "schedule.h"
 #include "timer.h"
+#include "io_uring.h"
 #include "assert.h"
 
 namespace libcocao {
@@ -10,7 +11,7 @@ namespace libcocao {
     class IOManager : public Scheduler, public TimerManager {
     public:
         typedef std::shared_ptr<IOManager> ptr;
-        typedef RWMutex RWMutexType;
+        typedef FutexRWMutex RWMutexType;
 
         /**
          * @brief IO事件，继承自epoll对事件的定义
@@ -25,6 +26,26 @@ namespace libcocao {
             WRITE = 0x4,
         };
 
+        /**
+         * @brief IO后端
+         */
+        enum Backend {
+            /// 就绪通知，EAGAIN后注册epoll事件再重试
+            EPOLL = 0,
+            /// 直接向io_uring提交读写，内核不支持时退回EPOLL
+            IO_URING = 1,
+        };
+
+        /**
+         * @brief epoll实例的组织方式
+         */
+        enum EpollMode {
+            /// 所有线程共用一个epoll，IO事件就绪后的协程可以被任意线程执行
+            SHARED_EPOLL = 0,
+            /// 每个线程一个epoll，fd注册到等待它的线程上，就绪后协程回到这个线程执行，不支持IO_URING
+            PER_THREAD_EPOLL = 1,
+        };
+
     private:
         /**
          * @brief socket fd上下文类
@@ -44,6 +65,14 @@ namespace libcocao {
                 Fiber::ptr fiber;
                 /// 事件回调函数
                 std::function<void()> cb;
+                /// 回调要投递到的线程，PER_THREAD_EPOLL时是注册事件的线程，否则为-1
+                int thread = -1;
+                /// waitEvent的超时定时器，第一次带超时等待时创建，之后反复使用
+                Timer::ptr timer;
+                /// waitEvent的等待序号，对不上的超时回调是过期的
+                uint32_t waitSeq = 0;
+                /// 本次waitEvent是否超时
+                bool timedout = false;
             };
 
             /**
@@ -72,20 +101,41 @@ namespace libcocao {
             EventContext write;
             /// 事件关联的句柄
             int fd = 0;
+            /// fd注册在哪个epoll上，events不为NONE时有效
+            int epfd = -1;
             /// 该fd添加了哪些事件的回调函数，或者说该fd关心哪些事件
             Event events = NONE;
             /// 事件的Mutex
             MutexType mutex;
         };
 
+        /**
+         * @brief 一个epoll实例和唤醒它用的eventfd
+         */
+        struct Poller {
+            /// epoll 文件句柄
+            int epfd = -1;
+            /// eventfd 文件句柄，用于唤醒epoll_wait
+            int tickleFd = -1;
+            /// 是否已有唤醒在途，被唤醒的线程读完eventfd后清除
+            std::atomic<bool> ticklePending = {false};
+            /// 是否有线程阻塞在这个epoll上，PER_THREAD_EPOLL时tickle据此挑选线程
+            std::atomic<bool> idle = {false};
+        };
+
     public:
         /**
          * @brief 构造函数
          * @param[in] threads 线程数量
          * @param[in] use_caller 是否将调用线程包含进去
          * @param[in] name 调度器的名称
+         * @param[in] backend IO后端
+         * @param[in] timer_type 定时器的组织方式
+         * @param[in] epoll_mode epoll实例的组织方式
          */
-        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+        IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager",
+                  Backend backend = EPOLL, TimerManager::Type timer_type = TimerManager::HEAP,
+                  EpollMode epoll_mode = SHARED_EPOLL);
 
         /**
          * @brief 析构函数
@@ -102,6 +152,16 @@ namespace libcocao {
          */
         int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
+        /**
+         * @brief 挂起当前协程直到fd上的event就绪、被取消或者超时
+         * @details 超时定时器挂在fd的事件上下文里反复使用，稳定后一次等待不分配内存
+         * @param[in] fd socket句柄
+         * @param[in] event 事件类型
+         * @param[in] timeout 超时时间(ms)，-1表示不超时
+         * @return 就绪或被取消返回0；超时返回-1，errno为ETIMEDOUT；添加事件失败返回-1
+         */
+        int waitEvent(int fd, Event event, uint64_t timeout);
+
         /**
          * @brief 删除事件
          * @param[in] fd socket句柄
@@ -128,6 +188,27 @@ namespace libcocao {
          */
         bool cancelAll(int fd);
 
+        /**
+         * @brief 是否每个线程一个epoll
+         */
+        bool isPerThreadEpoll() const { return m_pollers.size() > 1; }
+
+        /**
+         * @brief 是否使用io_uring后端
+         */
+        bool isUring() const { return m_uring != nullptr; }
+
+        /**
+         * @brief 通过io_uring提交一次IO，挂起当前协程直到完成
+         * @param[in] op 操作类型
+         * @param[in] fd socket句柄
+         * @param[in] addr,len,off,op_flags 见IoUring::submit
+         * @param[in] timeout 超时时间(ms)，-1表示不超时
+         * @return 成功返回结果，失败返回-errno，提交队列满或提交失败时返回-EAGAIN，调用方改走epoll
+         */
+        int submitIO(IoUring::Op op, int fd, void *addr, uint32_t len, uint64_t off,
+                     uint32_t op_flags, uint64_t timeout);
+
         /**
          * @brief 返回当前的IOManager
          */
@@ -136,10 +217,16 @@ namespace libcocao {
     protected:
         /**
          * @brief 通知调度器有任务要调度
-         * @details 写pipe让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
+         * @details 写eventfd让一个idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
+         *          已经有一次唤醒在途时直接返回，还没进入epoll_wait的线程会在下次epoll_wait时立即返回
          */
         void tickle() override;
 
+        /**
+         * @brief 通知指定线程有绑定给它的任务，PER_THREAD_EPOLL时唤醒这个线程自己的epoll
+         */
+        void tickleThread(int index) override;
+
         /**
          * @brief 判断是否可以停止
          * @details 判断条件是Scheduler::stopping()外加IOManager的m_pendingEventCount为0，表示没有IO事件可调度了
@@ -170,11 +257,45 @@ namespace libcocao {
          */
         void contextResize(size_t size);
 
+        /**
+         * @brief 当前线程使用的epoll实例，不是本调度器的线程使用第一个
+         */
+        Poller *getPoller();
+
+        /**
+         * @brief 写eventfd唤醒poller上的epoll_wait，已有唤醒在途时直接返回
+         */
+        void wakePoller(Poller *poller);
+
+        /**
+         * @brief 取fd的上下文，容器不够大时扩容
+         */
+        FdContext *getFdContext(int fd);
+
+        /**
+         * @brief addEvent/cancelEvent的实际操作，调用时持有fd_ctx->mutex
+         */
+        int addEventNoLock(FdContext *fd_ctx, Event event, std::function<void()> &cb);
+        bool cancelEventNoLock(FdContext *fd_ctx, Event event);
+
+        /**
+         * @brief waitEvent的超时回调
+         * @param[in] tag 等待序号左移3位，低3位是事件类型
+         */
+        void onWaitTimeout(int fd, uint32_t tag);
+
+        /**
+         * @brief 收割io_uring的完成事件，恢复等待的协程
+         */
+        void reapUring();
+
     private:
-        /// epoll 文件句柄
-        int m_epfd = 0;
-        /// pipe 文件句柄，fd[0]读端，fd[1]写端
-        int m_tickleFds[2];
+        /// epoll实例，SHARED_EPOLL时只有一个，PER_THREAD_EPOLL时下标是线程的本地队列下标
+        std::vector<Poller *> m_pollers;
+        /// PER_THREAD_EPOLL时tickle轮流从这里开始找空闲线程
+        std::atomic<size_t> m_nextTickle = {0};
+        /// io_uring后端，使用epoll时为空
+        IoUring *m_uring = nullptr;
         /// 当前等待执行的IO事件数量
         std::atomic<size_t> m_pendingEventCount = {0};
         /// IOManager的Mutex
@@ -1,11 +1,14 @@
 #include "address.h"
+#include "channel.h"
 #include "endian.h"
 #include "fd_manager.h"
 #include "fiber.h"
+#include "fiber_mutex.h"
 #include "hook.h"
 #include "iomanager.h"
 #include "log.h"
 #include "noncopyable.h"
+#include "resolver.h"
 #include "schedule.h"
 #include "singleton.h"
 #include "tcp_server.h"
@@ -1,4 +1,10 @@
 #include "log.h"
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
 
 namespace libcocao {
 
@@ -39,120 +45,87 @@ LogLevel::Level LogLevel::FromString(const std::string &str) {
     return LogLevel::UNKNOW;
 }
 
-class StringFormatItem: public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const char str)
-        : m_string(str){
-    }
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << m_string;
-    }
-private:
-    char m_string;
-};
-
-class DateTimeSormatItem: public LogFormatter::FormatItem {
-public:
-    DateTimeSormatItem(const std::string& format = "%Y:%M:%d %H:%M:%S")
-        : m_format(format){
-        if (m_format.empty())
-            m_format = "%Y-%M-%d %H:%M:%S";
-    }
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof buf, m_format.c_str(), &tm);
-        os << buf;
-    }
-private:
-    std::string m_format;
-};
-
-class TabFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
-    }
-};
-
-class NewLineFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
-    }
-};
-
-class EalpseFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getElapse();
-    }
-};
+LogStream::~LogStream() {
+    if (m_heap) free(m_buf);
+}
 
-class ThreadIdFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getThreadId();
+void LogStream::grow(size_t need) {
+    size_t cap = std::max(need, m_cap * 2);
+    if (m_heap) {
+        m_buf = (char *)realloc(m_buf, cap);
+    } else {
+        char *buf = (char *)malloc(cap);
+        memcpy(buf, m_buf, m_len);
+        m_buf = buf;
+        m_heap = true;
     }
-};
+    m_cap = cap;
+}
 
-class LevelFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << LogLevel::ToString(level);
-    }
-};
+void LogStream::appendUInt(uint64_t v, int width) {
+    char tmp[24];
+    char *p = tmp + sizeof tmp;
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (tmp + sizeof tmp - p < width) *--p = '0';
+    append(p, tmp + sizeof tmp - p);
+}
 
-class FiberIdFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getFiberId();
+void LogStream::appendInt(int64_t v) {
+    if (v < 0) {
+        append('-');
+        appendUInt(0 - (uint64_t)v);
+    } else {
+        appendUInt(v);
     }
-};
+}
 
-class FileFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getFile();
-    }
-};
+LogStream& LogStream::operator<<(double v) {
+    //和iostream默认的输出保持一致
+    commit(snprintf(reserve(32), 32, "%g", v));
+    return *this;
+}
 
-class LineFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream &os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getLine();
-    }
-};
+LogStream& LogStream::operator<<(const void *v) {
+    commit(snprintf(reserve(32), 32, "%p", v));
+    return *this;
+}
 
-class MessageFormatItem:public LogFormatter::FormatItem {
-public:
-    void format(std::ostream &os, LogLevel::Level level, LogEvent::ptr event) {
-        os << event->getContent();
+LogStream& LogStream::operator<<(std::ostream& (*manip)(std::ostream&)) {
+    if (manip == static_cast<std::ostream& (*)(std::ostream&)>(std::endl)) {
+        append('\n');
     }
-};
-
+    return *this;
+}
 
 LogEvent::LogEvent(LogLevel::Level level, const char *file, int32_t line, uint32_t elapse, uint32_t thread_id,
-                   uint32_t fiber_id, uint64_t time, const std::string &threadname):
+                   uint32_t fiber_id, uint64_t time_us, const char *threadname):
                      m_file(file)
                    , m_line(line)
                    , m_elapse(elapse)
                    , m_threadId(thread_id)
                    , m_fiberId(fiber_id)
-                   , m_time(time)
+                   , m_time(time_us / 1000000)
+                   , m_usec(time_us % 1000000)
                    , m_level(level)
-                   , m_threadName(threadname){
+                   , m_threadName(threadname)
+                   , m_ss(m_content, sizeof m_content) {
 }
 
 void LogEvent::format(const char *fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if (len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+    va_list copy;
+    va_copy(copy, al);
+    size_t avail = m_ss.available();
+    int len = vsnprintf(m_ss.reserve(0), avail, fmt, al);
+    if (len >= 0) {
+        if ((size_t)len >= avail) {
+            vsnprintf(m_ss.reserve(len + 1), len + 1, fmt, copy);
+        }
+        m_ss.commit(len);
     }
+    va_end(copy);
 }
 
 void LogEvent::format(const char *fmt, ...) {
@@ -162,75 +135,242 @@ void LogEvent::format(const char *fmt, ...) {
     va_end(al);
 }
 
+static std::atomic<uint32_t> s_log_site_id = {0};
+
+LogSite::LogSite(const char *file, int32_t line, LogLevel::Level level, const char *fmt)
+    : file(file)
+    , line(line)
+    , level(level)
+    , fmt(fmt)
+    , id(++ s_log_site_id) {
+}
+
+void LogSite::render(LogStream &out, const char *args, size_t len) const {
+    const char *end = args + len;
+    const char *p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            const char *next = strchr(p, '%');
+            if (!next) next = p + strlen(p);
+            out.append(p, next - p);
+            p = next;
+            continue;
+        }
+        if (p[1] == '%') {
+            out.append('%');
+            p += 2;
+            continue;
+        }
+
+        //拆出flags、宽度、精度，长度修饰和转换符按参数的实际类型重写
+        const char *spec = p++;
+        while (*p && strchr("-+ #0", *p)) ++ p;
+        while ((*p >= '0' && *p <= '9') || *p == '.') ++ p;
+        const char *spec_end = p;
+        while (*p && strchr("hlLqjzt", *p)) ++ p;
+        char conv = *p;
+        if (conv) ++ p;
+        if (args >= end || spec_end - spec > 20) {
+            out.append(spec, p - spec);
+            continue;
+        }
+
+        char buf[32];
+        size_t n = spec_end - spec;
+        memcpy(buf, spec, n);
+        char tag = *args++;
+        union {
+            int64_t i;
+            uint64_t u;
+            double f;
+        } v;
+        v.u = 0;
+        const char *str = nullptr;
+        uint32_t str_len = 0;
+        std::string tmp;
+        bool cstr = false;
+        if (tag == 's') {
+            memcpy(&str_len, args, 4);
+            str = args + 4;
+            args += 4 + str_len;
+            if (memchr(spec, '.', n)) {
+                //带了精度，只能给一个以0结尾的串
+                tmp.assign(str, std::min((size_t)str_len, (size_t)(end - str)));
+                str = tmp.c_str();
+                cstr = true;
+                buf[n++] = 's';
+            } else {
+                buf[n++] = '.';
+                buf[n++] = '*';
+                buf[n++] = 's';
+            }
+        } else {
+            memcpy(&v, args, 8);
+            args += 8;
+            if (tag == 'f') {
+                buf[n++] = strchr("eEfFgGaA", conv) ? conv : 'g';
+            } else if (tag == 'p') {
+                buf[n++] = 'p';
+            } else if (conv == 'c') {
+                buf[n++] = 'c';
+            } else {
+                buf[n++] = 'l';
+                buf[n++] = 'l';
+                if (tag == 'i') buf[n++] = strchr("dixXuo", conv) ? conv : 'd';
+                else buf[n++] = strchr("uxXo", conv) ? conv : 'u';
+            }
+        }
+        buf[n] = 0;
+        if (args > end) break;
+
+        //先按剩余空间写，不够再按实际长度重写
+        for (int i = 0; i < 2; ++ i) {
+            size_t avail = std::max(out.available(), (size_t)64);
+            char *dst = out.reserve(avail);
+            int rt = 0;
+            if (tag == 's' && cstr) rt = snprintf(dst, avail, buf, str);
+            else if (tag == 's') rt = snprintf(dst, avail, buf, (int)str_len, str);
+            else if (tag == 'f') rt = snprintf(dst, avail, buf, v.f);
+            else if (tag == 'p') rt = snprintf(dst, avail, buf, (void *)v.u);
+            else if (conv == 'c') rt = snprintf(dst, avail, buf, (int)v.i);
+            else rt = snprintf(dst, avail, buf, v.i);
+            if (rt < 0) break;
+            if ((size_t)rt < avail) {
+                out.commit(rt);
+                break;
+            }
+            out.reserve(rt + 1);
+        }
+    }
+}
+
+/**
+ * @brief 当前线程格式化用的缓冲，每次取都会清空
+ */
+static LogStream& GetFormatBuffer() {
+    static thread_local char s_buf[4096];
+    static thread_local LogStream s_stream(s_buf, sizeof s_buf);
+    s_stream.clear();
+    return s_stream;
+}
+
 LogFormatter::LogFormatter(const std::string &pattern)
     : m_pattern(pattern){
     init();
 }
 //    dTmTtTlTFTf:r
 void LogFormatter::init() {
-    for (size_t i = 0; i < m_pattern.size(); ++ i) {
-        if (m_pattern[i] == 'T') {
-            m_items.push_back(FormatItem::ptr(new TabFormatItem()));
-        } else if (m_pattern[i] == 'd') {
-            m_items.push_back(FormatItem::ptr(new DateTimeSormatItem()));
-        } else if (m_pattern[i] == 'm') {
-            m_items.push_back(FormatItem::ptr(new EalpseFormatItem()));
-        } else if (m_pattern[i] == 't') {
-            m_items.push_back(FormatItem::ptr(new ThreadIdFormatItem()));
-        } else if (m_pattern[i] == 'l') {
-            m_items.push_back(FormatItem::ptr(new LevelFormatItem()));
-        } else if (m_pattern[i] == 'F') {
-            m_items.push_back(FormatItem::ptr(new FiberIdFormatItem()));
-        } else if (m_pattern[i] == 'f') {
-            m_items.push_back(FormatItem::ptr(new FileFormatItem()));
-        } else if (m_pattern[i] == 'r') {
-            m_items.push_back(FormatItem::ptr(new LineFormatItem()));
-        } else if (m_pattern[i] == 'C'){
-            m_items.push_back(FormatItem::ptr(new MessageFormatItem()));
-        } else {
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(m_pattern[i])));
+    m_items.assign(m_pattern.begin(), m_pattern.end());
+}
+
+void LogFormatter::format(LogStream &out, LogLevel::Level level, const LogEvent &event) {
+    for (char c : m_items) {
+        switch (c) {
+            case 'T':
+                out.append('\t');
+                break;
+            case 'd': {
+                static thread_local TimeFormatCache s_date("%Y-%m-%d %H:%M:%S");
+                size_t len = 0;
+                const char *date = s_date.format(event.getTime(), len);
+                out.append(date, len);
+                break;
+            }
+            case 'S':
+                out.append('.');
+                out.appendUInt(event.getUsec() / 1000, 3);
+                break;
+            case 'U':
+                out.append('.');
+                out.appendUInt(event.getUsec(), 6);
+                break;
+            case 'm':
+                out.appendUInt(event.getElapse());
+                break;
+            case 't':
+                out.appendInt(event.getThreadId());
+                break;
+            case 'l':
+                out << LogLevel::ToString(level);
+                break;
+            case 'F':
+                out.appendUInt(event.getFiberId());
+                break;
+            case 'f':
+                out << event.getFile();
+                break;
+            case 'r':
+                out.appendInt(event.getLine());
+                break;
+            case 'C':
+                if (event.getSite()) {
+                    event.getSite()->render(out, event.getContentData(), event.getContentSize());
+                } else {
+                    out.append(event.getContentData(), event.getContentSize());
+                }
+                break;
+            default:
+                out.append(c);
+                break;
         }
     }
-    m_items.push_back(FormatItem::ptr(new NewLineFormatItem()));
+    out.append('\n');
 }
 
-std::string LogFormatter::format(LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for (auto& it: m_items) {
-        it->format(ss, level, event);
-    }
-    return ss.str();
+std::string LogFormatter::format(LogLevel::Level level, const LogEvent &event) {
+    LogStream& buf = GetFormatBuffer();
+    format(buf, level, event);
+    return std::string(buf.data(), buf.size());
 }
 
 Logger::Logger(const std::string &name)
-    : m_name(name), m_level(LogLevel::DEBUG) {
+    : m_name(name), m_level(LogLevel::DEBUG), m_appenders(new AppenderList) {
     m_formatter.reset(new LogFormatter);
 }
 
+Logger::~Logger() {
+    delete m_appenders.load();
+}
+
 void Logger::addAppender (LoggerAppender::ptr appender) {
+    Mutex::Lock lock(m_mutex);
     if (!appender->getFormatter()) {
         appender->m_formatter = m_formatter;
     }
-    m_appenders.push_back(appender);
+    AppenderList* appenders = new AppenderList(*m_appenders.load());
+    appenders->push_back(appender);
+    setAppenders(appenders);
 }
 
 void Logger::delAppender (LoggerAppender::ptr appender) {
-    for (auto it = m_appenders.begin(); it != m_appenders.end(); ++ it)
+    Mutex::Lock lock(m_mutex);
+    AppenderList* appenders = new AppenderList(*m_appenders.load());
+    for (auto it = appenders->begin(); it != appenders->end(); ++ it)
         if (*it == appender) {
-            m_appenders.erase(it);
+            appenders->erase(it);
             break;
         }
+    setAppenders(appenders);
 }
 
 void Logger::clearAppenders () {
-    m_appenders.clear();
+    Mutex::Lock lock(m_mutex);
+    setAppenders(new AppenderList);
 }
 
-void Logger::log(LogLevel::Level level, const LogEvent::ptr &event) {
+void Logger::setAppenders(AppenderList* appenders) {
+    const AppenderList* old = m_appenders.exchange(appenders);
+    m_grace.synchronize();
+    //删掉的输出地在这里析构，此时已经没有线程在用
+    delete old;
+}
+
+void Logger::log(LogLevel::Level level, const LogEvent &event) {
     if (level >= m_level) {
-        auto self = shared_from_this();
-        if (!m_appenders.empty()) {
-            for (auto & it: m_appenders) {
+        GracePeriod::ReadLock lock(m_grace);
+        const AppenderList* appenders = m_appenders.load();
+        if (!appenders->empty()) {
+            for (auto & it: *appenders) {
                 it->log(level, event);
             }
         } else if (m_root) {
@@ -239,85 +379,619 @@ void Logger::log(LogLevel::Level level, const LogEvent::ptr &event) {
     }
 }
 
-void Logger::debug(LogEvent::ptr event) {
+void Logger::debug(const LogEvent& event) {
     log(LogLevel::DEBUG, event);
 }
 
-void Logger::info(LogEvent::ptr event) {
+void Logger::info(const LogEvent& event) {
     log(LogLevel::INFO, event);
 }
 
-void Logger::warn(LogEvent::ptr event) {
+void Logger::warn(const LogEvent& event) {
     log(LogLevel::WARN, event);
 }
 
-void Logger::error(LogEvent::ptr event) {
+void Logger::error(const LogEvent& event) {
     log(LogLevel::ERROR, event);
 }
 
-void Logger::fatal(LogEvent::ptr event) {
+void Logger::fatal(const LogEvent& event) {
     log(LogLevel::FATAL, event);
 }
 
 
-void StdoutLogAppender::log(LogLevel::Level level, LogEvent::ptr event) {
+void StdoutLogAppender::log(LogLevel::Level level, const LogEvent& event) {
     if (level >= m_level) {
-        std::cout << m_formatter->format(level, event);
+        LogStream& buf = GetFormatBuffer();
+        m_formatter->format(buf, level, event);
+        std::cout.write(buf.data(), buf.size());
     }
 }
 
-FileLogAppender::FileLogAppender(const std::string &filename)
-    : m_filename(filename) {
-    reopen();
+void StdoutLogAppender::write(const char *data, size_t len) {
+    std::cout.write(data, len);
+}
+
+void StdoutLogAppender::flush() {
+    std::cout.flush();
+}
+
+/**
+ * @brief 按本地时间对齐的下一个切分时刻
+ */
+static time_t NextRotateTime(time_t now, uint32_t interval) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return ((now + tm.tm_gmtoff) / interval + 1) * interval - tm.tm_gmtoff;
+}
+
+FileLogAppender::FileLogAppender(const std::string &filename, uint64_t max_size,
+                                 uint32_t rotate_interval, uint32_t max_files)
+    : m_filename(filename)
+    , m_maxSize(max_size)
+    , m_rotateInterval(rotate_interval)
+    , m_maxFiles(max_files) {
+    m_buffer.reserve(BUFFER_SIZE);
+    Mutex::Lock lock(m_mutex);
+    time_t now = time(0);
+    prepare(now, 0);
+    m_lastFlush = now;
+}
+
+FileLogAppender::~FileLogAppender() {
+    Mutex::Lock lock(m_mutex);
+    flushBuffer();
+    if (m_fd >= 0) close(m_fd);
 }
 
 bool FileLogAppender::reopen() {
-    if (m_filestream) {
-        m_filestream.close();
+    Mutex::Lock lock(m_mutex);
+    flushBuffer();
+    return openFile();
+}
+
+bool FileLogAppender::openFile() {
+    if (m_fd >= 0) close(m_fd);
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        std::cerr << "FileLogAppender open " << m_filename << " fail: " << strerror(errno) << std::endl;
+        return false;
     }
-    m_filestream.open(m_filename, std::ios::app);
-    return !!m_filestream;
+    struct stat st;
+    m_size = fstat(m_fd, &st) ? 0 : st.st_size;
+    return true;
 }
 
-void FileLogAppender::log(LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        uint64_t now = time(0);
-        if (now != m_lastTime) {
-            reopen();
-            m_lastTime = now;
+void FileLogAppender::prepare(time_t now, size_t len) {
+    if (m_fd < 0 || now >= m_nextCheck) {
+        //文件被挪走或删除，名字对应的inode和手上的fd不一致了
+        struct stat name_st;
+        struct stat fd_st;
+        if (m_fd < 0 || stat(m_filename.c_str(), &name_st) || fstat(m_fd, &fd_st)
+            || name_st.st_ino != fd_st.st_ino || name_st.st_dev != fd_st.st_dev) {
+            flushBuffer();
+            openFile();
+        }
+        m_nextCheck = now + CHECK_INTERVAL;
+    }
+
+    if (m_rotateInterval && !m_nextRotate) {
+        m_nextRotate = NextRotateTime(now, m_rotateInterval);
+    }
+    uint64_t size = m_size + m_buffer.size();
+    if ((m_maxSize && size && size + len > m_maxSize)
+        || (m_rotateInterval && now >= m_nextRotate)) {
+        rotate(now);
+    }
+}
+
+void FileLogAppender::rotate(time_t now) {
+    flushBuffer();
+    if (m_fd >= 0 && m_size) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        char buf[32];
+        strftime(buf, sizeof buf, ".%Y%m%d-%H%M%S", &tm);
+        std::string name = m_filename + buf;
+        //同一秒切了多次时加序号
+        for (int i = 1; access(name.c_str(), F_OK) == 0; ++ i) {
+            name = m_filename + buf + "." + std::to_string(i);
+        }
+        if (rename(m_filename.c_str(), name.c_str())) {
+            std::cerr << "FileLogAppender rename " << m_filename << " fail: " << strerror(errno) << std::endl;
+        }
+        openFile();
+        removeOldFiles();
+    }
+    if (m_rotateInterval) {
+        m_nextRotate = NextRotateTime(now, m_rotateInterval);
+    }
+}
+
+void FileLogAppender::removeOldFiles() {
+    if (!m_maxFiles) return;
+    size_t pos = m_filename.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : m_filename.substr(0, pos);
+    std::string prefix = (pos == std::string::npos ? m_filename : m_filename.substr(pos + 1)) + ".";
+
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    std::vector<std::string> files;
+    while (struct dirent *entry = readdir(d)) {
+        //只认切分出来的文件名：前缀后面跟着日期
+        if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) == 0
+            && isdigit(entry->d_name[prefix.size()])) {
+            files.push_back(entry->d_name);
         }
-        m_filestream << m_formatter->format(level, event);
+    }
+    closedir(d);
+    if (files.size() <= m_maxFiles) return;
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i + m_maxFiles < files.size(); ++ i) {
+        unlink((dir + "/" + files[i]).c_str());
     }
 }
 
-LogEventWarp::LogEventWarp(Logger::ptr logger, LogEvent::ptr event)
-    : m_event(event)
-    , m_logger(logger){
+void FileLogAppender::writeFile(const struct iovec *iov, int count) {
+    if (m_fd < 0) return;
+    for (int i = 0; i < count; ) {
+        int n = std::min(count - i, IOV_MAX);
+        size_t total = 0;
+        for (int j = i; j < i + n; ++ j) total += iov[j].iov_len;
+        ssize_t rt = ::writev(m_fd, iov + i, n);
+        if (rt < 0 && errno == EINTR) continue;
+        if (rt < 0) {
+            std::cerr << "FileLogAppender write " << m_filename << " fail: " << strerror(errno) << std::endl;
+            return;
+        }
+        m_size += rt;
+        if ((size_t)rt < total) {
+            //只写了一部分，剩下的逐段补上
+            size_t skip = rt;
+            for (int j = i; j < i + n; ++ j) {
+                const char *p = (const char *)iov[j].iov_base;
+                size_t len = iov[j].iov_len;
+                if (skip >= len) {
+                    skip -= len;
+                    continue;
+                }
+                p += skip;
+                len -= skip;
+                skip = 0;
+                while (len) {
+                    ssize_t w = ::write(m_fd, p, len);
+                    if (w < 0 && errno == EINTR) continue;
+                    if (w <= 0) return;
+                    p += w;
+                    len -= w;
+                    m_size += w;
+                }
+            }
+        }
+        i += n;
+    }
+}
+
+void FileLogAppender::flushBuffer() {
+    if (m_buffer.empty()) return;
+    struct iovec iov = {(void *)m_buffer.data(), m_buffer.size()};
+    writeFile(&iov, 1);
+    m_buffer.clear();
+}
+
+void FileLogAppender::log(LogLevel::Level level, const LogEvent& event) {
+    if (level < m_level) return;
+    LogStream& buf = GetFormatBuffer();
+    m_formatter->format(buf, level, event);
+
+    Mutex::Lock lock(m_mutex);
+    time_t now = event.getTime();
+    prepare(now, buf.size());
+    if (level < LogLevel::ERROR && now == m_lastFlush
+        && m_buffer.size() + buf.size() <= BUFFER_SIZE) {
+        m_buffer.append(buf.data(), buf.size());
+        return;
+    }
+    struct iovec iov[2] = {{(void *)m_buffer.data(), m_buffer.size()},
+                           {(void *)buf.data(), buf.size()}};
+    writeFile(iov, 2);
+    m_buffer.clear();
+    m_lastFlush = now;
+}
+
+void FileLogAppender::write(const char *data, size_t len) {
+    struct iovec iov = {(void *)data, len};
+    writev(&iov, 1);
+}
+
+void FileLogAppender::writev(const struct iovec *iov, int count) {
+    size_t len = 0;
+    for (int i = 0; i < count; ++ i) len += iov[i].iov_len;
+    Mutex::Lock lock(m_mutex);
+    prepare(time(0), len);
+    flushBuffer();
+    writeFile(iov, count);
+}
+
+void FileLogAppender::flush() {
+    Mutex::Lock lock(m_mutex);
+    flushBuffer();
+}
+
+static std::atomic<uint32_t> s_log_shard = {0};
+static thread_local int t_log_shard = -1;
+
+AsyncLogAppender::AsyncLogAppender(LoggerAppender::ptr sink, Overflow overflow, size_t buffer_size,
+                                   size_t max_buffers, uint32_t flush_interval_ms)
+    : m_sink(sink)
+    , m_overflow(overflow)
+    , m_bufferSize(buffer_size)
+    , m_maxBuffers(max_buffers ? max_buffers : 1)
+    , m_flushInterval(flush_interval_ms) {
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "log_writer"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_writerCond.notify_one();
+    m_producerCond.notify_all();
+    m_thread->join();
+}
+
+void AsyncLogAppender::log(LogLevel::Level level, const LogEvent& event) {
+    if (level < m_level) return;
+    LogStream& msg = GetFormatBuffer();
+    m_formatter->format(msg, level, event);
+
+    if (t_log_shard < 0) {
+        t_log_shard = s_log_shard++ % SHARD_COUNT;
+    }
+    Shard &shard = m_shards[t_log_shard];
+    while (true) {
+        BufferPtr full;
+        {
+            SpinLock::Lock lock(shard.mutex);
+            //超长的日志单独占一个缓冲区
+            if (shard.buffer && (shard.buffer->empty()
+                                 || shard.buffer->size() + msg.size() <= m_bufferSize)) {
+                shard.buffer->append(msg.data(), msg.size());
+                break;
+            }
+            full = std::move(shard.buffer);
+        }
+
+        BufferPtr fresh = exchange(std::move(full), level);
+        if (!fresh) {
+            ++ m_dropped;
+            return;
+        }
+        SpinLock::Lock lock(shard.mutex);
+        if (shard.buffer) {
+            //同分片的其他线程已经装好了，还回去
+            lock.unlock();
+            std::lock_guard<std::mutex> lock2(m_mutex);
+            m_free.push_back(std::move(fresh));
+        } else {
+            shard.buffer = std::move(fresh);
+        }
+    }
+
+    if (level >= LogLevel::FATAL) {
+        flush();
+    }
+}
+
+AsyncLogAppender::BufferPtr AsyncLogAppender::exchange(BufferPtr full, LogLevel::Level level) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (full) {
+        if (full->empty()) {
+            m_free.push_back(std::move(full));
+        } else {
+            m_full.push_back(std::move(full));
+            m_writerCond.notify_one();
+        }
+    }
+
+    bool wait = m_overflow == BLOCK;
+    if (m_overflow == SAMPLE) {
+        wait = level >= LogLevel::ERROR || (m_sampleCount++ % m_sampleRate) == 0;
+    }
+    while (true) {
+        if (!m_free.empty()) {
+            BufferPtr buf = std::move(m_free.back());
+            m_free.pop_back();
+            return buf;
+        }
+        if (m_allocated < m_maxBuffers) {
+            ++ m_allocated;
+            BufferPtr buf(new std::string);
+            buf->reserve(m_bufferSize);
+            return buf;
+        }
+        if (!wait || m_stopping) return nullptr;
+        m_producerCond.wait(lock);
+    }
+}
+
+void AsyncLogAppender::flush() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t request = ++ m_flushRequest;
+    m_writerCond.notify_one();
+    while (m_flushed < request && !m_stopping) {
+        m_producerCond.wait(lock);
+    }
+}
+
+void AsyncLogAppender::run() {
+    std::vector<BufferPtr> buffers;
+    std::vector<struct iovec> iov;
+    while (true) {
+        uint64_t request = 0;
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_full.empty() && !m_stopping && m_flushRequest == m_flushed) {
+                m_writerCond.wait_for(lock, std::chrono::milliseconds(m_flushInterval));
+            }
+            request = m_flushRequest;
+            stopping = m_stopping;
+            buffers.swap(m_full);
+            //写满的都比分片里正在写的早，放在后面保证同一线程的日志有序
+            for (auto &shard : m_shards) {
+                SpinLock::Lock lock2(shard.mutex);
+                if (shard.buffer && !shard.buffer->empty()) {
+                    buffers.push_back(std::move(shard.buffer));
+                }
+            }
+        }
+
+        iov.clear();
+        for (auto &buf : buffers) {
+            iov.push_back({(void *)buf->data(), buf->size()});
+        }
+        if (!iov.empty()) {
+            m_sink->writev(&iov[0], iov.size());
+        }
+        m_sink->flush();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto &buf : buffers) {
+                buf->clear();
+                //超长日志撑大的缓冲区不留着
+                if (buf->capacity() > m_bufferSize * 2) {
+                    buf.reset();
+                    -- m_allocated;
+                } else {
+                    m_free.push_back(std::move(buf));
+                }
+            }
+            buffers.clear();
+            m_flushed = request;
+        }
+        m_producerCond.notify_all();
+        if (stopping) break;
+    }
+}
+
+const char BinaryLogAppender::MAGIC[8] = {'L', 'C', 'B', 'L', 'O', 'G', 0, 1};
+
+static const size_t s_header_size = sizeof(BinaryLogAppender::RecordHeader);
+
+size_t BinaryLogAppender::ScanRecords(const char *data, size_t size) {
+    size_t offset = 0;
+    while (offset + s_header_size <= size) {
+        RecordHeader header;
+        memcpy(&header, data + offset, s_header_size);
+        if (header.kind == END || header.kind > TEXT || header.size < s_header_size
+            || header.size > size - offset) {
+            break;
+        }
+        offset += header.size;
+    }
+    return offset;
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string &filename, size_t chunk_size)
+    : m_filename(filename)
+    , m_chunkSize(chunk_size) {
+    m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        std::cerr << "BinaryLogAppender open " << filename << " fail: " << strerror(errno) << std::endl;
+        return;
+    }
+    struct stat st;
+    fstat(m_fd, &st);
+    m_mapSize = std::max((size_t)st.st_size, m_chunkSize);
+    if (posix_fallocate(m_fd, 0, m_mapSize)
+        || (m_base = (char *)mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0)) == MAP_FAILED) {
+        std::cerr << "BinaryLogAppender map " << filename << " fail: " << strerror(errno) << std::endl;
+        m_base = nullptr;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    //接在上次写到的位置后面开一段新的
+    m_offset = ScanRecords(m_base, st.st_size);
+    m_lastTime = GetCurrentUS();
+    char *p = reserve(s_header_size + sizeof MAGIC + 8);
+    if (!p) return;
+    RecordHeader header = {SESSION, 0, 0, (uint32_t)(s_header_size + sizeof MAGIC + 8)};
+    memcpy(p, &header, s_header_size);
+    memcpy(p + s_header_size, MAGIC, sizeof MAGIC);
+    memcpy(p + s_header_size + sizeof MAGIC, &m_lastTime, 8);
+}
+
+BinaryLogAppender::~BinaryLogAppender() {
+    if (m_base) {
+        munmap(m_base, m_mapSize);
+        //截掉预留没写的部分
+        int rt = ftruncate(m_fd, m_offset);
+        (void)rt;
+    }
+    if (m_fd >= 0) close(m_fd);
+}
+
+char* BinaryLogAppender::reserve(size_t len) {
+    if (m_offset + len > m_mapSize) {
+        //先分配好磁盘空间，磁盘满在这里报错而不是写映射时收到SIGBUS
+        size_t size = m_mapSize + std::max(m_chunkSize, len);
+        if (posix_fallocate(m_fd, m_mapSize, size - m_mapSize)) return nullptr;
+        void *base = mremap(m_base, m_mapSize, size, MREMAP_MAYMOVE);
+        if (base == MAP_FAILED) return nullptr;
+        m_base = (char *)base;
+        m_mapSize = size;
+    }
+    char *p = m_base + m_offset;
+    m_offset += len;
+    return p;
+}
+
+size_t BinaryLogAppender::writeDelta(char *p, uint64_t time_us) {
+    //时间可能回退，zigzag之后按varint写
+    int64_t delta = (int64_t)(time_us - m_lastTime);
+    m_lastTime = time_us;
+    uint64_t v = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+void BinaryLogAppender::defineSite(const LogSite *site) {
+    if (site->id < m_sites.size() && m_sites[site->id]) return;
+    if (site->id >= m_sites.size()) m_sites.resize(site->id + 1);
+    m_sites[site->id] = true;
+
+    uint16_t file_len = strlen(site->file);
+    uint16_t fmt_len = strlen(site->fmt);
+    uint32_t size = s_header_size + 12 + file_len + fmt_len;
+    char *p = reserve(size);
+    if (!p) return;
+    RecordHeader header = {SITE, (uint8_t)site->level, 0, size};
+    memcpy(p, &header, s_header_size);
+    p += s_header_size;
+    memcpy(p, &site->id, 4);
+    memcpy(p + 4, &site->line, 4);
+    memcpy(p + 8, &file_len, 2);
+    memcpy(p + 10, &fmt_len, 2);
+    memcpy(p + 12, site->file, file_len);
+    memcpy(p + 12 + file_len, site->fmt, fmt_len);
+}
+
+void BinaryLogAppender::log(LogLevel::Level level, const LogEvent &event) {
+    if (level < m_level || !m_base) return;
+    uint64_t time_us = event.getTime() * 1000000 + event.getUsec();
+    uint32_t ids[3] = {0, (uint32_t)event.getThreadId(), event.getFiberId()};
+    const LogSite *site = event.getSite();
+
+    SpinLock::Lock lock(m_mutex);
+    char delta[10];
+    size_t delta_len = writeDelta(delta, time_us);
+    RecordHeader header = {EVENT, (uint8_t)level, 0, 0};
+    char *p = nullptr;
+    if (site) {
+        defineSite(site);
+        ids[0] = site->id;
+        header.size = s_header_size + 12 + delta_len + event.getContentSize();
+        p = reserve(header.size);
+        if (!p) return;
+        memcpy(p, &header, s_header_size);
+        p += s_header_size;
+        memcpy(p, ids, 12);
+        p += 12;
+    } else {
+        uint16_t file_len = strlen(event.getFile());
+        ids[0] = event.getLine();
+        header.kind = TEXT;
+        header.size = s_header_size + 12 + delta_len + 2 + file_len + event.getContentSize();
+        p = reserve(header.size);
+        if (!p) return;
+        memcpy(p, &header, s_header_size);
+        p += s_header_size;
+        memcpy(p, ids + 1, 8);
+        memcpy(p + 8, ids, 4);
+        p += 12;
+        memcpy(p, delta, delta_len);
+        p += delta_len;
+        memcpy(p, &file_len, 2);
+        memcpy(p + 2, event.getFile(), file_len);
+        p += 2 + file_len;
+        memcpy(p, event.getContentData(), event.getContentSize());
+        return;
+    }
+    memcpy(p, delta, delta_len);
+    memcpy(p + delta_len, event.getContentData(), event.getContentSize());
+}
+
+void BinaryLogAppender::flush() {
+    SpinLock::Lock lock(m_mutex);
+    if (m_base) msync(m_base, m_offset, MS_ASYNC);
+}
+
+LogStream& operator<<(LogStream& os, const LogLimitPass& pass) {
+    if (pass.suppressed) {
+        os.append("[suppressed ", 12);
+        os.appendUInt(pass.suppressed);
+        os.append("] ", 2);
+    }
+    return os;
+}
+
+LogEventWarp::LogEventWarp(const Logger::ptr& logger, LogLevel::Level level, const char *file, int32_t line,
+                           uint32_t elapse, uint32_t thread_id, uint32_t fiber_id, uint64_t time_us,
+                           const char *threadname)
+    : m_event(level, file, line, elapse, thread_id, fiber_id, time_us, threadname)
+    , m_logger(logger.get()){
 }
 
 LogEventWarp::~LogEventWarp() {
-    m_logger->log(m_event->getLevel(), m_event);
+    m_logger->log(m_event.getLevel(), m_event);
 }
 
 LoggerManager::LoggerManager() {
     m_root.reset(new Logger);
     m_root->addAppender(LoggerAppender::ptr(new StdoutLogAppender));
-    m_loggers[m_root->m_name] = m_root;
+    LoggerMap* loggers = new LoggerMap;
+    (*loggers)[m_root->m_name] = m_root;
+    m_loggers = loggers;
 //    init();
 }
 
+LoggerManager::~LoggerManager() {
+    delete m_loggers.load();
+}
+
 Logger::ptr LoggerManager::getLogger(const std::string &name) {
-    auto it = m_loggers.find(name);
-    if (it != m_loggers.end())
+    {
+        GracePeriod::ReadLock lock(m_grace);
+        const LoggerMap* loggers = m_loggers.load();
+        auto it = loggers->find(name);
+        if (it != loggers->end())
+            return it->second;
+    }
+
+    Mutex::Lock lock(m_mutex);
+    //拿锁之前可能已经被别的线程创建了
+    const LoggerMap* old = m_loggers.load();
+    auto it = old->find(name);
+    if (it != old->end())
         return it->second;
 
     Logger::ptr logger(new Logger(name)) ;
     logger->m_root = m_root;
-    m_loggers[name] = logger;
+    LoggerMap* loggers = new LoggerMap(*old);
+    (*loggers)[name] = logger;
+    m_loggers = loggers;
+    m_grace.synchronize();
+    delete old;
     return logger;
 }
 
-
-
-
-}
\ No newline at end of file
+}
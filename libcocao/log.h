@@ -11,15 +11,24 @@
 #include <stdarg.h>
 #include <list>
 #include <map>
+#include <unordered_map>
+#include <atomic>
 #include <time.h>
+#include <mutex>
+#include <condition_variable>
 #include "singleton.h"
 #include "utils.h"
+#include "thread.h"
+#include "noncopyable.h"
 #include <stdio.h>
+#include <string.h>
+#include <type_traits>
+#include <sys/uio.h>
 
 #define LIBCOCAO_LOG_LEVEL(logger, level) \
     if (logger->getLevel() <= level)     \
-        libcocao::LogEventWarp(logger, libcocao::LogEvent::ptr(new libcocao::LogEvent(level, __FILE__, __LINE__, 0, libcocao::GetThreadId(), \
-                0, time(0), "system"))).getSS()
+        libcocao::LogEventWarp(logger, level, __FILE__, __LINE__, 0, libcocao::GetThreadId(), \
+                libcocao::GetFiberId(), libcocao::GetCurrentUS(), "system").getSS()
 
 #define LIBCOCAO_LOG_NAME(name) libcocao::LoggerMgr::GetInstance()->getLogger(name)
 #define LIBCOCAO_LOG_ROOT() libcocao::LoggerMgr::GetInstance()->getRoot()
@@ -30,6 +39,50 @@
 #define LIBCOCAO_LOG_ERROR(logger) LIBCOCAO_LOG_LEVEL(logger, libcocao::LogLevel::ERROR)
 #define LIBCOCAO_LOG_FATAL(logger) LIBCOCAO_LOG_LEVEL(logger, libcocao::LogLevel::FATAL)
 
+/**
+ * @brief 按调用点限流和采样的日志，状态是宏展开处的静态变量
+ * @details 放行的那一条前面会带上"[suppressed N] "，N为上次放行之后被压掉的条数。
+ *          没有后台定时器，压掉的条数跟着下一条放行的日志出来；调用点之后不再被调用的话就不会报告
+ */
+#define LIBCOCAO_LOG_IF_PASS(logger, level, limiter_type, ...) \
+    if (logger->getLevel() <= level) \
+        if (libcocao::LogLimitPass libcocao_log_pass = [&]() { \
+                static limiter_type s_log_limiter(__VA_ARGS__); \
+                return s_log_limiter.check(); }()) \
+            libcocao::LogEventWarp(logger, level, __FILE__, __LINE__, 0, libcocao::GetThreadId(), \
+                libcocao::GetFiberId(), libcocao::GetCurrentUS(), "system").getSS() << libcocao_log_pass
+
+//每interval_ms毫秒最多输出count条
+#define LIBCOCAO_LOG_LIMIT(logger, level, count, interval_ms) \
+    LIBCOCAO_LOG_IF_PASS(logger, level, libcocao::LogRateLimit, count, interval_ms)
+//每n条输出1条
+#define LIBCOCAO_LOG_EVERY_N(logger, level, n) \
+    LIBCOCAO_LOG_IF_PASS(logger, level, libcocao::LogSample, n)
+
+#define LIBCOCAO_LOG_WARN_LIMIT(logger, count, interval_ms)  LIBCOCAO_LOG_LIMIT(logger, libcocao::LogLevel::WARN, count, interval_ms)
+#define LIBCOCAO_LOG_ERROR_LIMIT(logger, count, interval_ms) LIBCOCAO_LOG_LIMIT(logger, libcocao::LogLevel::ERROR, count, interval_ms)
+#define LIBCOCAO_LOG_INFO_EVERY_N(logger, n)  LIBCOCAO_LOG_EVERY_N(logger, libcocao::LogLevel::INFO, n)
+#define LIBCOCAO_LOG_WARN_EVERY_N(logger, n)  LIBCOCAO_LOG_EVERY_N(logger, libcocao::LogLevel::WARN, n)
+#define LIBCOCAO_LOG_ERROR_EVERY_N(logger, n) LIBCOCAO_LOG_EVERY_N(logger, libcocao::LogLevel::ERROR, n)
+
+/**
+ * @brief printf风格的二进制日志，格式串在调用点登记一次，参数按原始值写入事件，不做文本格式化
+ * @details 配合BinaryLogAppender可以把格式化推迟到离线的logdecode，其他输出地照常输出文本
+ */
+#define LIBCOCAO_LOG_BIN(logger, level, fmt, ...) \
+    do { \
+        if (logger->getLevel() <= level) { \
+            static const libcocao::LogSite s_log_site(__FILE__, __LINE__, level, fmt); \
+            libcocao::LogBinary(logger, s_log_site, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LIBCOCAO_LOG_BIN_DEBUG(logger, fmt, ...) LIBCOCAO_LOG_BIN(logger, libcocao::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LIBCOCAO_LOG_BIN_INFO(logger, fmt, ...)  LIBCOCAO_LOG_BIN(logger, libcocao::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LIBCOCAO_LOG_BIN_WARN(logger, fmt, ...)  LIBCOCAO_LOG_BIN(logger, libcocao::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LIBCOCAO_LOG_BIN_ERROR(logger, fmt, ...) LIBCOCAO_LOG_BIN(logger, libcocao::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LIBCOCAO_LOG_BIN_FATAL(logger, fmt, ...) LIBCOCAO_LOG_BIN(logger, libcocao::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
 
 
 namespace libcocao {
@@ -51,26 +104,132 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
-class LogEvent {
+/**
+ * @brief 日志的字符缓冲
+ * @details 写到调用方给的定长缓冲里，写满了才换成堆上的内存，整数、浮点数自己转换不走iostream。
+ *          没有专门重载的类型退回std::ostringstream
+ */
+class LogStream: Noncopyable {
 public:
-    typedef std::shared_ptr<LogEvent> ptr;
+    LogStream(char* buf, size_t cap)
+        : m_buf(buf), m_cap(cap) {}
+    ~LogStream();
+
+    const char* data() const { return m_buf; }
+    size_t size() const { return m_len; }
+    //清空内容，已经换成的堆内存留着复用
+    void clear() { m_len = 0; }
+
+    void append(const char* str, size_t len) {
+        if (m_len + len > m_cap) grow(m_len + len);
+        memcpy(m_buf + m_len, str, len);
+        m_len += len;
+    }
+    void append(char c) {
+        if (m_len == m_cap) grow(m_len + 1);
+        m_buf[m_len++] = c;
+    }
+    //预留至少len字节，返回写入位置，写完后用commit提交
+    char* reserve(size_t len) {
+        if (m_len + len > m_cap) grow(m_len + len);
+        return m_buf + m_len;
+    }
+    void commit(size_t len) { m_len += len; }
+    size_t available() const { return m_cap - m_len; }
+
+    //写一个无符号整数，width不足时左边补0
+    void appendUInt(uint64_t v, int width = 0);
+    void appendInt(int64_t v);
+
+    LogStream& operator<<(bool v) { append(v ? "1" : "0", 1); return *this; }
+    LogStream& operator<<(char v) { append(v); return *this; }
+    LogStream& operator<<(short v) { appendInt(v); return *this; }
+    LogStream& operator<<(unsigned short v) { appendUInt(v); return *this; }
+    LogStream& operator<<(int v) { appendInt(v); return *this; }
+    LogStream& operator<<(unsigned int v) { appendUInt(v); return *this; }
+    LogStream& operator<<(long v) { appendInt(v); return *this; }
+    LogStream& operator<<(unsigned long v) { appendUInt(v); return *this; }
+    LogStream& operator<<(long long v) { appendInt(v); return *this; }
+    LogStream& operator<<(unsigned long long v) { appendUInt(v); return *this; }
+    LogStream& operator<<(float v) { return *this << (double)v; }
+    LogStream& operator<<(double v);
+    LogStream& operator<<(const void* v);
+    LogStream& operator<<(const char* v) {
+        if (v) append(v, strlen(v));
+        else append("(null)", 6);
+        return *this;
+    }
+    LogStream& operator<<(char* v) { return *this << (const char*)v; }
+    LogStream& operator<<(const std::string& v) { append(v.data(), v.size()); return *this; }
+    //std::endl之类的操纵符，只认换行
+    LogStream& operator<<(std::ostream& (*manip)(std::ostream&));
+
+    template<class T>
+    LogStream& operator<<(const T& v) {
+        std::ostringstream ss;
+        ss << v;
+        return *this << ss.str();
+    }
+
+private:
+    void grow(size_t need);
+
+private:
+    char* m_buf;
+    size_t m_cap;
+    size_t m_len = 0;
+    //超出定长缓冲后换到堆上
+    bool m_heap = false;
+};
+
+/**
+ * @brief 二进制日志的调用点，每个LIBCOCAO_LOG_BIN展开一个静态实例
+ */
+struct LogSite {
+    LogSite(const char* file, int32_t line, LogLevel::Level level, const char* fmt);
+
+    /**
+     * @brief 按格式串把编码后的参数输出成文本
+     * @param[in] args,len 参数的编码，见EncodeLogArg
+     */
+    void render(LogStream& out, const char* args, size_t len) const;
+
+    const char* file;
+    int32_t line;
+    LogLevel::Level level;
+    const char* fmt;
+    //进程内唯一的编号，从1开始
+    uint32_t id;
+};
+
+class LogEvent: Noncopyable {
+public:
+    /**
+     * @param[in] time_us 时间戳，单位us
+     */
     LogEvent(LogLevel::Level level
             , const char* file, int32_t line
             , uint32_t elapse, uint32_t thread_id
-            , uint32_t fiber_id, uint64_t time
-            , const std::string& threadname);
+            , uint32_t fiber_id, uint64_t time_us
+            , const char* threadname);
 
     const char* getFile() const { return m_file; } //文件名
     int32_t getLine() const {return m_line;	}	//行号
     uint32_t getElapse() const { return m_elapse; }	//程序启动开始到现在的毫秒数
     int32_t getThreadId() const { return m_threadId; } //线程id
     uint32_t getFiberId() const { return m_fiberId; } //协程号
-    uint64_t getTime() const { return m_time; } //时间戳
-    std::string getContent() const { return m_ss.str(); } //内容
+    uint64_t getTime() const { return m_time; } //时间戳，秒
+    uint32_t getUsec() const { return m_usec; } //时间戳秒以下的微秒
+    std::string getContent() const { return std::string(m_ss.data(), m_ss.size()); } //内容
+    const char* getContentData() const { return m_ss.data(); }
+    size_t getContentSize() const { return m_ss.size(); }
     LogLevel::Level getLevel() const { return m_level; }
     std::string getThreadName() const { return m_threadName; }
 
-    std::stringstream& getSS() {return m_ss; }
+    LogStream& getSS() {return m_ss; }
+    //二进制日志的调用点，文本日志为空，此时内容是参数的编码
+    const LogSite* getSite() const { return m_site; }
+    void setSite(const LogSite* site) { m_site = site; }
     void format(const char* fmt, va_list al);
     void format(const char* fmt, ...);
 
@@ -81,9 +240,12 @@ private:
     int32_t m_threadId = 0;			//线程id
     uint32_t m_fiberId = 0; 		//协程号
     uint64_t m_time = 0;			//时间戳
-    std::stringstream m_ss;			//内容
+    uint32_t m_usec = 0;            //秒以下的微秒
     LogLevel::Level m_level;
-    std::string m_threadName;
+    const char* m_threadName;
+    const LogSite* m_site = nullptr;
+    char m_content[1024];           //内容，放在栈上，超长才上堆
+    LogStream m_ss;
 
 };
 
@@ -91,15 +253,15 @@ private:
 class LogFormatter {
 public:
     typedef std::shared_ptr<LogFormatter> ptr;
+    /**
+     * @brief 构造函数
+     * @details 格式在构造时解析成一张操作表，写日志时按表顺序输出，没有逐字段的虚函数调用
+     *          d:时间 S:毫秒后缀 U:微秒后缀 m:耗时 t:线程id l:级别 F:协程id f:文件 r:行号 C:内容 T:制表符 其他字符原样输出
+     */
     LogFormatter(const std::string& pattern = "dTmTtTlTFTf:rTC");
-    std::string format(LogLevel::Level level, LogEvent::ptr event);
-public:
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) = 0;
-        virtual ~FormatItem(){};
-    };
+    //追加到out，不分配内存
+    void format(LogStream& out, LogLevel::Level level, const LogEvent& event);
+    std::string format(LogLevel::Level level, const LogEvent& event);
 
     void init();
     bool isError() const {return m_error;}
@@ -108,7 +270,7 @@ public:
 private:
     std::string m_pattern;
     bool m_error = false;
-    std::vector<FormatItem::ptr> m_items;
+    std::vector<char> m_items;
 };
 
 
@@ -118,7 +280,14 @@ class LoggerAppender: public std::enable_shared_from_this<LoggerAppender> {
 public:
     typedef std::shared_ptr<LoggerAppender> ptr;
     virtual ~LoggerAppender() {}
-    virtual void log(LogLevel::Level, LogEvent::ptr event) = 0;
+    virtual void log(LogLevel::Level, const LogEvent& event) = 0;
+    //写出已经格式化好的日志，给AsyncLogAppender的后台线程用
+    virtual void write(const char* data, size_t len) {}
+    //一次写出多段，默认逐段调用write()
+    virtual void writev(const struct iovec* iov, int count) {
+        for (int i = 0; i < count; ++ i) write((const char*)iov[i].iov_base, iov[i].iov_len);
+    }
+    virtual void flush() {}
 
     void setLevel (LogLevel::Level level) { m_level = level; }
     LogLevel::Level getLevel () const { return m_level; }
@@ -126,86 +295,483 @@ public:
     LogFormatter::ptr getFormatter() { return m_formatter; }
 
 protected:
-    LogLevel::Level m_level;
+    LogLevel::Level m_level = LogLevel::DEBUG;
     LogFormatter::ptr m_formatter;
 
 };
 
-//日志器
+/**
+ * @brief 日志器
+ * @details 输出地列表写时复制：增删时拷贝一份新列表换上去，等宽限期过了再释放旧的。
+ *          log()不加锁，可以和addAppender/delAppender并发
+ */
 class Logger: public std::enable_shared_from_this<Logger> {
     friend class LoggerManager;
 public:
     typedef std::shared_ptr<Logger> ptr;
+    typedef std::vector<LoggerAppender::ptr> AppenderList;
 
     Logger(const std::string& name = "root");
-    void log(LogLevel::Level level, const LogEvent::ptr& event) ;
+    ~Logger();
+    void log(LogLevel::Level level, const LogEvent& event) ;
 
-    void debug(LogEvent::ptr event);
-    void info(LogEvent::ptr event);
-    void warn(LogEvent::ptr event);
-    void error(LogEvent::ptr event);
-    void fatal(LogEvent::ptr event);
+    void debug(const LogEvent& event);
+    void info(const LogEvent& event);
+    void warn(const LogEvent& event);
+    void error(const LogEvent& event);
+    void fatal(const LogEvent& event);
 
     const std::string& getName() const { return m_name; }
     LogLevel::Level getLevel() const { return m_level; }
+    void setLevel(LogLevel::Level level) { m_level = level; }
     LogFormatter::ptr getFormatter() {return m_formatter; }
     void addAppender (LoggerAppender::ptr der);
     void delAppender (LoggerAppender::ptr appender);
     void clearAppenders ();
+private:
+    //换上新的输出地列表，等正在用旧列表的log()都返回后释放旧列表
+    void setAppenders(AppenderList* appenders);
 private:
     std::string m_name; //日志名称
     LogLevel::Level m_level; //日志级别
     LogFormatter::ptr m_formatter;
-    std::list<LoggerAppender::ptr> m_appenders;
+    std::atomic<const AppenderList*> m_appenders;
     Logger::ptr m_root;
+    Mutex m_mutex; //增删输出地之间互斥
+    GracePeriod m_grace;
 };
 
 class StdoutLogAppender:public LoggerAppender {
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
-    void log(LogLevel::Level level, LogEvent::ptr event) override;
+    void log(LogLevel::Level level, const LogEvent& event) override;
+    void write(const char* data, size_t len) override;
+    void flush() override;
 };
 
+/**
+ * @brief 文件输出地
+ * @details 直接用fd写。日志先攒在用户态的缓冲里，攒满、遇到ERROR以上或者距上次写出超过1秒时，
+ *          和当前这条一起writev出去。支持按大小和按时间切分，切出来的文件名为filename.年月日-时分秒，
+ *          只保留最近的max_files个。每隔几秒比较一次文件名和fd的inode，被外部挪走或删除后重新打开
+ */
 class FileLogAppender: public LoggerAppender {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
-    FileLogAppender(const std::string& filename);
-    void log(LogLevel::Level level, LogEvent::ptr event) override;
+
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件名
+     * @param[in] max_size 单个文件的大小上限，0表示不按大小切分
+     * @param[in] rotate_interval 按时间切分的周期(秒)，按本地时间对齐，如86400为每天零点，0表示不按时间切分
+     * @param[in] max_files 保留多少个切出来的文件，0表示全部保留
+     */
+    FileLogAppender(const std::string& filename, uint64_t max_size = 0,
+                    uint32_t rotate_interval = 0, uint32_t max_files = 0);
+    ~FileLogAppender();
+
+    void log(LogLevel::Level level, const LogEvent& event) override;
+    void write(const char* data, size_t len) override;
+    void writev(const struct iovec* iov, int count) override;
+    void flush() override;
     bool reopen();
 
 private:
+    //以下持锁调用
+    bool openFile();
+    //检查外部轮转和切分条件，len为马上要写的字节数
+    void prepare(time_t now, size_t len);
+    void rotate(time_t now);
+    void removeOldFiles();
+    void writeFile(const struct iovec* iov, int count);
+    void flushBuffer();
+
+private:
+    enum {
+        /// 用户态缓冲的大小
+        BUFFER_SIZE = 64 * 1024,
+        /// 检查inode的间隔(秒)
+        CHECK_INTERVAL = 5,
+    };
+
     std::string m_filename;
-    std::ofstream m_filestream;
-    uint64_t m_lastTime;
+    uint64_t m_maxSize;
+    uint32_t m_rotateInterval;
+    uint32_t m_maxFiles;
+    int m_fd = -1;
+    //当前文件已经写入的字节数
+    uint64_t m_size = 0;
+    time_t m_nextRotate = 0;
+    time_t m_nextCheck = 0;
+    time_t m_lastFlush = 0;
+    std::string m_buffer;
+    Mutex m_mutex;
+};
+
+/**
+ * @brief 异步日志输出地
+ * @details 调用线程只负责格式化并拷贝到自己的缓冲区，缓冲区写满后交给后台线程，
+ *          由后台线程调用目标输出地的write()写出，慢盘不会卡住业务线程。
+ *          缓冲区总数有上限，用完之后按溢出策略处理；FATAL日志会等到落盘才返回
+ */
+class AsyncLogAppender: public LoggerAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    /**
+     * @brief 缓冲区用完时的处理方式
+     */
+    enum Overflow {
+        /// 阻塞调用线程，等后台线程写完归还缓冲区
+        BLOCK = 0,
+        /// 直接丢弃
+        DROP = 1,
+        /// ERROR以上和每N条里的1条阻塞等待，其余丢弃
+        SAMPLE = 2,
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] sink 真正的输出地
+     * @param[in] overflow 溢出策略
+     * @param[in] buffer_size 单个缓冲区大小
+     * @param[in] max_buffers 缓冲区总数上限，内存上限为buffer_size * max_buffers
+     * @param[in] flush_interval_ms 没写满的缓冲区最多等多久写出
+     */
+    AsyncLogAppender(LoggerAppender::ptr sink, Overflow overflow = BLOCK,
+                     size_t buffer_size = 64 * 1024, size_t max_buffers = 64,
+                     uint32_t flush_interval_ms = 1000);
+    ~AsyncLogAppender();
+
+    void log(LogLevel::Level level, const LogEvent& event) override;
+
+    /**
+     * @brief 等待调用之前的日志全部写出
+     */
+    void flush() override;
+
+    //SAMPLE策略下每多少条保留一条
+    void setSampleRate(uint32_t rate) { m_sampleRate = rate ? rate : 1; }
+    //被溢出策略丢掉的日志条数
+    uint64_t getDropped() const { return m_dropped; }
+
+private:
+    typedef std::unique_ptr<std::string> BufferPtr;
+
+    /**
+     * @brief 按线程分片的当前缓冲区，线程第一次写日志时分到一个分片
+     */
+    struct Shard {
+        SpinLock mutex;
+        BufferPtr buffer;
+        //各分片占满一个cache line，避免伪共享
+        char pad[64 - sizeof(SpinLock) - sizeof(BufferPtr)];
+    };
+
+    /**
+     * @brief 交出写满的缓冲区，换一个空的
+     * @return 按溢出策略放弃时返回空
+     */
+    BufferPtr exchange(BufferPtr full, LogLevel::Level level);
+    void run();
+
+private:
+    enum { SHARD_COUNT = 16 };
+
+    LoggerAppender::ptr m_sink;
+    Overflow m_overflow;
+    size_t m_bufferSize;
+    size_t m_maxBuffers;
+    uint32_t m_flushInterval;
+    uint32_t m_sampleRate = 16;
+
+    Shard m_shards[SHARD_COUNT];
+
+    //以下受m_mutex保护
+    std::mutex m_mutex;
+    //后台线程等待的条件
+    std::condition_variable m_writerCond;
+    //等待缓冲区或flush完成的条件
+    std::condition_variable m_producerCond;
+    std::vector<BufferPtr> m_full;
+    std::vector<BufferPtr> m_free;
+    size_t m_allocated = 0;
+    uint64_t m_sampleCount = 0;
+    uint64_t m_flushRequest = 0;
+    uint64_t m_flushed = 0;
+    bool m_stopping = false;
+
+    std::atomic<uint64_t> m_dropped = {0};
+    Thread::ptr m_thread;
 };
 
+/**
+ * @brief 日志宏展开出来的临时对象，事件放在栈上，析构时写日志
+ * @details 日志器只在这一条语句内使用，持有裸指针，不碰shared_ptr的引用计数
+ */
 class LogEventWarp {
 public:
-    LogEventWarp(Logger::ptr logger, LogEvent::ptr event);
+    LogEventWarp(const Logger::ptr& logger, LogLevel::Level level
+                 , const char* file, int32_t line
+                 , uint32_t elapse, uint32_t thread_id
+                 , uint32_t fiber_id, uint64_t time_us
+                 , const char* threadname);
     ~LogEventWarp();
 
-    std::stringstream& getSS() { return m_event->getSS(); }
+    LogStream& getSS() { return m_event.getSS(); }
+    LogEvent& getEvent() { return m_event; }
 
 private:
-    LogEvent::ptr m_event;
-    Logger::ptr m_logger;
+    LogEvent m_event;
+    Logger* m_logger;
+};
+
+/**
+ * @brief 限流和采样的判断结果
+ */
+struct LogLimitPass {
+    explicit operator bool() const { return allow; }
+
+    bool allow;
+    //上次放行之后被压掉的条数
+    uint64_t suppressed;
+};
+
+LogStream& operator<<(LogStream& os, const LogLimitPass& pass);
+
+/**
+ * @brief 调用点的固定窗口限流，每interval_ms毫秒最多放行count条
+ * @details 没超过count时只做一次计数的fetch_add；超过了才读粗粒度时钟看窗口是否已过，
+ *          过了窗口的第一次调用负责开新窗口，自己算新窗口的第一条，并带出上个窗口压掉的条数
+ */
+class LogRateLimit: Noncopyable {
+public:
+    LogRateLimit(uint64_t count, uint64_t interval_ms)
+        : m_limit(count), m_interval(interval_ms * 1000) {}
+
+    LogLimitPass check() {
+        uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (count < m_limit) {
+            //第一条开第一个窗口
+            if (count == 0 && m_windowEnd.load(std::memory_order_relaxed) == 0) {
+                m_windowEnd.store(GetMonotonicCoarseUS() + m_interval, std::memory_order_relaxed);
+            }
+            return {true, 0};
+        }
+        uint64_t now = GetMonotonicCoarseUS();
+        uint64_t end = m_windowEnd.load(std::memory_order_relaxed);
+        if (now < end || !m_windowEnd.compare_exchange_strong(end, now + m_interval)) {
+            return {false, 0};
+        }
+        count = m_count.exchange(1, std::memory_order_relaxed) - 1;
+        return {m_limit > 0, count > m_limit ? count - m_limit : 0};
+    }
+private:
+    uint64_t m_limit;
+    uint64_t m_interval;
+    std::atomic<uint64_t> m_windowEnd{0};
+    std::atomic<uint64_t> m_count{0};
+};
+
+/**
+ * @brief 调用点的采样，每n条放行1条
+ */
+class LogSample: Noncopyable {
+public:
+    explicit LogSample(uint64_t n)
+        : m_every(n ? n : 1) {}
+
+    LogLimitPass check() {
+        uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (count % m_every) return {false, 0};
+        return {true, count ? m_every - 1 : 0};
+    }
+private:
+    uint64_t m_every;
+    std::atomic<uint64_t> m_count{0};
 };
 
+/**
+ * @brief 二进制日志文件
+ * @details 记录直接拷贝进mmap的文件，写满后用mremap扩大。文件由若干段组成，每次打开时在末尾开一段新的，
+ *          段头记录基准时间，段内先出现调用点的定义再出现引用它的事件，事件里只存时间差、线程和协程号、参数的编码。
+ *          文本日志原样存成文本记录。用logdecode还原成文本
+ */
+class BinaryLogAppender: public LoggerAppender {
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+
+    /**
+     * @brief 记录类型
+     */
+    enum Kind {
+        /// 文件末尾，还没写过的区域全是0
+        END = 0,
+        /// 段头: magic, 基准时间(us)
+        SESSION = 1,
+        /// 调用点定义: id, 行号, 文件名长度, 格式串长度, 文件名, 格式串
+        SITE = 2,
+        /// 二进制事件: 调用点id, 线程id, 协程id, 时间差(varint), 参数编码
+        EVENT = 3,
+        /// 文本事件: 线程id, 协程id, 行号, 时间差(varint), 文件名长度(u16), 文件名, 内容
+        TEXT = 4,
+    };
+
+    /**
+     * @brief 记录头，size包括记录头本身
+     */
+    struct RecordHeader {
+        uint8_t kind;
+        uint8_t level;
+        uint16_t reserved;
+        uint32_t size;
+    };
+
+    static const char MAGIC[8];
+
+    /**
+     * @param[in] filename 文件名，已存在时在末尾追加一段
+     * @param[in] chunk_size 每次扩大映射的大小
+     */
+    BinaryLogAppender(const std::string& filename, size_t chunk_size = 64 * 1024 * 1024);
+    ~BinaryLogAppender();
+
+    void log(LogLevel::Level level, const LogEvent& event) override;
+    void flush() override;
+
+    /**
+     * @brief 跳过合法的记录，返回第一条非法记录或文件末尾的偏移
+     */
+    static size_t ScanRecords(const char* data, size_t size);
+
+private:
+    //持锁调用，返回可写len字节的位置
+    char* reserve(size_t len);
+    void defineSite(const LogSite* site);
+    //写时间差，返回写入的字节数
+    size_t writeDelta(char* p, uint64_t time_us);
+
+private:
+    std::string m_filename;
+    size_t m_chunkSize;
+    int m_fd = -1;
+    char* m_base = nullptr;
+    size_t m_mapSize = 0;
+    size_t m_offset = 0;
+    uint64_t m_lastTime = 0;
+    //本段里已经写过定义的调用点
+    std::vector<bool> m_sites;
+    SpinLock m_mutex;
+};
+
+/**
+ * @brief 日志器管理
+ * @details 名字到日志器的表同样写时复制，查已有的日志器不加锁，只有第一次创建时加锁拷表
+ */
 class LoggerManager {
 public:
+    typedef std::unordered_map<std::string, Logger::ptr> LoggerMap;
     LoggerManager();
+    ~LoggerManager();
     Logger::ptr getLogger(const std::string& name);
 
 //    void init();
     Logger::ptr getRoot() const { return m_root; }
 
 private:
-    std::map<std::string, Logger::ptr> m_loggers;
+    std::atomic<const LoggerMap*> m_loggers;
     Logger::ptr m_root;
+    Mutex m_mutex; //创建日志器之间互斥
+    GracePeriod m_grace;
 };
 
 typedef libcocao::Singleton<LoggerManager> LoggerMgr;
 
+/**
+ * @brief 二进制日志的参数编码，一个字节的类型加定长的值，字符串是u32长度加内容
+ */
+inline void EncodeLogArg(LogStream& out, char tag, const void* data, size_t len) {
+    char* p = out.reserve(len + 1);
+    *p = tag;
+    memcpy(p + 1, data, len);
+    out.commit(len + 1);
+}
+
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+EncodeLogArg(LogStream& out, T v) {
+    int64_t i = v;
+    EncodeLogArg(out, 'i', &i, sizeof i);
+}
+
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+EncodeLogArg(LogStream& out, T v) {
+    uint64_t u = v;
+    EncodeLogArg(out, 'u', &u, sizeof u);
+}
+
+template<class T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+EncodeLogArg(LogStream& out, T v) {
+    int64_t i = (int64_t)v;
+    EncodeLogArg(out, 'i', &i, sizeof i);
+}
+
+template<class T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+EncodeLogArg(LogStream& out, T v) {
+    double d = v;
+    EncodeLogArg(out, 'f', &d, sizeof d);
+}
+
+inline void EncodeLogArg(LogStream& out, const char* v, size_t len) {
+    uint32_t n = len;
+    char* p = out.reserve(len + 5);
+    *p = 's';
+    memcpy(p + 1, &n, 4);
+    memcpy(p + 5, v, len);
+    out.commit(len + 5);
+}
+
+inline void EncodeLogArg(LogStream& out, const char* v) {
+    if (v) EncodeLogArg(out, v, strlen(v));
+    else EncodeLogArg(out, "(null)", 6);
+}
+
+inline void EncodeLogArg(LogStream& out, char* v) {
+    EncodeLogArg(out, (const char*)v);
+}
+
+inline void EncodeLogArg(LogStream& out, const std::string& v) {
+    EncodeLogArg(out, v.data(), v.size());
+}
+
+inline void EncodeLogArg(LogStream& out, const void* v) {
+    uint64_t u = (uintptr_t)v;
+    EncodeLogArg(out, 'p', &u, sizeof u);
+}
+
+inline void EncodeLogArgs(LogStream& out) {
+}
+
+template<class T, class... Args>
+inline void EncodeLogArgs(LogStream& out, const T& v, const Args&... args) {
+    EncodeLogArg(out, v);
+    EncodeLogArgs(out, args...);
+}
+
+/**
+ * @brief LIBCOCAO_LOG_BIN的实现，事件放在栈上，参数按原始值编码
+ */
+template<class... Args>
+void LogBinary(const Logger::ptr& logger, const LogSite& site, const Args&... args) {
+    LogEvent event(site.level, site.file, site.line, 0, GetThreadId(), GetFiberId(), GetCurrentUS(), "system");
+    event.setSite(&site);
+    EncodeLogArgs(event.getSS(), args...);
+    logger->log(site.level, event);
+}
+
 }
 
 
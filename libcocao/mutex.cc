@@ -1,4 +1,10 @@
 #include "mutex.h"
+#include <sched.h>
+#include <limits.h>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 namespace libcocao {
 
@@ -23,4 +29,124 @@ void Semaphore::notity() {
     }
 }
 
-}
\ No newline at end of file
+//拿不到锁时最多自旋的次数，单核上自旋没有意义
+static const int32_t s_max_spins = std::thread::hardware_concurrency() > 1 ? 100 : 0;
+
+static long Futex(std::atomic<uint32_t>* addr, int op, uint32_t val) {
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), op, val, nullptr, nullptr, 0);
+}
+
+void FutexMutex::lockSlow() {
+    int32_t avg = m_spins.load(std::memory_order_relaxed);
+    int32_t max_spins = std::min(s_max_spins, avg * 2 + 10);
+    if (!s_max_spins) max_spins = 0;
+    for (int32_t i = 0; i < max_spins; ++ i) {
+        CpuRelax();
+        uint32_t c = 0;
+        if (m_state.load(std::memory_order_relaxed) == 0
+                && m_state.compare_exchange_weak(c, 1, std::memory_order_acquire)) {
+            m_spins.store(avg + (i - avg) / 8, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (max_spins) {
+        m_spins.store(avg + (max_spins - avg) / 8, std::memory_order_relaxed);
+    }
+    //标成2再睡，解锁方看到2才会去唤醒
+    while (m_state.exchange(2, std::memory_order_acquire) != 0) {
+        Futex(&m_state, FUTEX_WAIT_PRIVATE, 2);
+    }
+}
+
+void FutexMutex::wake() {
+    Futex(&m_state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+FutexRWMutex::FutexRWMutex() {
+    size_t cpus = std::thread::hardware_concurrency();
+    size_t n = 1;
+    while (n < cpus && n < 64) n <<= 1;
+    m_slots.reset(new Slot[n]);
+    m_mask = n - 1;
+}
+
+bool FutexRWMutex::hasReaders() {
+    int64_t sum = 0;
+    for (size_t i = 0; i <= m_mask; ++ i) {
+        sum += m_slots[i].count.load();
+    }
+    return sum != 0;
+}
+
+void FutexRWMutex::readerLeft() {
+    //写者可能正在等计数归零
+    if (m_writer.load() & WRITER) {
+        m_writerSeq.fetch_add(1);
+        Futex(&m_writerSeq, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+void FutexRWMutex::rdlockSlow(std::atomic<int64_t>& counter) {
+    counter.fetch_sub(1);
+    readerLeft();
+    while (true) {
+        uint32_t state = m_writer.load();
+        if (state == 0) {
+            std::atomic<int64_t>& retry = m_slots[SlotIndex()].count;
+            retry.fetch_add(1);
+            if (m_writer.load() == 0) return;
+            retry.fetch_sub(1);
+            readerLeft();
+        } else if (state == (WRITER | READER_WAITING)
+                || m_writer.compare_exchange_strong(state, WRITER | READER_WAITING)) {
+            Futex(&m_writer, FUTEX_WAIT_PRIVATE, WRITER | READER_WAITING);
+        }
+    }
+}
+
+void FutexRWMutex::wrlock() {
+    m_writeMutex.lock();
+    m_writer.fetch_or(WRITER);
+    for (int32_t i = 0; i < s_max_spins && hasReaders(); ++ i) {
+        CpuRelax();
+    }
+    while (true) {
+        uint32_t seq = m_writerSeq.load();
+        if (!hasReaders()) break;
+        Futex(&m_writerSeq, FUTEX_WAIT_PRIVATE, seq);
+    }
+    m_writerHeld.store(true, std::memory_order_relaxed);
+}
+
+void FutexRWMutex::unlock() {
+    if (m_writerHeld.load(std::memory_order_relaxed)) {
+        m_writerHeld.store(false, std::memory_order_relaxed);
+        if (m_writer.exchange(0) & READER_WAITING) {
+            Futex(&m_writer, FUTEX_WAKE_PRIVATE, INT_MAX);
+        }
+        m_writeMutex.unlock();
+        return;
+    }
+    //读锁可以减在任意一个计数器上，写者只看总和
+    m_slots[SlotIndex()].count.fetch_sub(1);
+    readerLeft();
+}
+
+void GracePeriod::synchronize() {
+    //第一次等换指针之前进来的读方；读到旧epoch却晚计数的读方看到的已经是新指针，
+    //第二次把它们也等完，免得下一次synchronize只等另一组计数器时漏掉
+    for (int i = 0; i < 2; ++ i) {
+        uint32_t old = m_epoch.fetch_add(1);
+        wait(old & 1);
+    }
+}
+
+void GracePeriod::wait(uint32_t index) {
+    for (auto& slot: m_slots[index]) {
+        while (slot.count.load()) {
+            sched_yield();
+        }
+    }
+}
+
+}
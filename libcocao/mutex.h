@@ -6,6 +6,7 @@
 #include <memory>
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 #include <stdint.h>
 #include <atomic>
 #include <list>
@@ -13,6 +14,16 @@
 #include "noncopyable.h"
 
 namespace libcocao {
+
+//自旋等待时让出流水线，减少对持有者所在超线程的干扰
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 class Semaphore: public Noncopyable {
 public:
     Semaphore(uint32_t count = 0);
@@ -91,7 +102,7 @@ public:
     }
     void unlock() {
         if (m_locked) {
-            m_mutex.wrlock();
+            m_mutex.unlock();
             m_locked = false;
         }
     }
@@ -119,7 +130,7 @@ public:
     }
     void unlock() {
         if (m_locked) {
-            m_mutex.wrlock();
+            m_mutex.unlock();
             m_locked = false;
         }
     }
@@ -187,5 +198,135 @@ public:
 private:
     volatile std::atomic_flag m_mutex;
 };
+
+/**
+ * @brief 基于futex的互斥量
+ * @details 状态0未加锁、1加锁无等待者、2加锁且可能有等待者。没有竞争时加锁解锁各一次原子操作不进内核；
+ *          拿不到锁先自旋，自旋次数按最近几次实际需要的次数自适应调整(类似PTHREAD_MUTEX_ADAPTIVE_NP)，
+ *          还拿不到再futex等待。解锁时只有状态为2才调用futex唤醒
+ */
+class FutexMutex: Noncopyable {
+public:
+    typedef ScopeLockImp1<FutexMutex> Lock;
+
+    void lock() {
+        uint32_t c = 0;
+        if (!m_state.compare_exchange_strong(c, 1, std::memory_order_acquire)) {
+            lockSlow();
+        }
+    }
+    bool tryLock() {
+        uint32_t c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+    void unlock() {
+        if (m_state.exchange(0, std::memory_order_release) == 2) {
+            wake();
+        }
+    }
+private:
+    void lockSlow();
+    void wake();
+private:
+    std::atomic<uint32_t> m_state{0};
+    //最近几次拿到锁之前自旋次数的平均值
+    std::atomic<int32_t> m_spins{0};
+};
+
+/**
+ * @brief 基于futex的读写锁，读者按CPU分散计数
+ * @details 读者只在当前CPU对应的计数器上加减，不同CPU的读者不争同一个缓存行。
+ *          写者先拿FutexMutex排除其他写者，再置写标记，然后等所有计数器之和归零；
+ *          读者加计数后看到写标记就撤回计数，在写标记上futex等待。解锁读锁可以减任意一个计数器，
+ *          协程持有读锁时被挪到别的线程也没关系。写者在等时新的读者会让路，写者不会饿死
+ */
+class FutexRWMutex: Noncopyable {
+public:
+    typedef ReadScopeLockImp1<FutexRWMutex> ReadLock;
+    typedef WriteScopeLockImp1<FutexRWMutex> WriteLock;
+
+    FutexRWMutex();
+
+    void rdlock() {
+        std::atomic<int64_t>& counter = m_slots[SlotIndex()].count;
+        counter.fetch_add(1);
+        if (m_writer.load() == 0) return;
+        rdlockSlow(counter);
+    }
+    void wrlock();
+    void unlock();
+
+private:
+    //撤回counter上的计数，等写者结束后重新加读锁
+    void rdlockSlow(std::atomic<int64_t>& counter);
+    void readerLeft();
+    bool hasReaders();
+    size_t SlotIndex() {
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : (cpu & m_mask);
+    }
+
+private:
+    enum {
+        WRITER = 1,         //有写者持有或正在等读者退出
+        READER_WAITING = 2  //有读者在写标记上等待
+    };
+    struct Slot {
+        std::atomic<int64_t> count{0};
+        char pad[64 - sizeof(std::atomic<int64_t>)];
+    };
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    std::atomic<uint32_t> m_writer{0};
+    //写者已经拿到锁，此时不可能有读者，unlock据此区分读写
+    std::atomic<bool> m_writerHeld{false};
+    //写者等读者退出时的futex字，读者退出时加一
+    std::atomic<uint32_t> m_writerSeq{0};
+    FutexMutex m_writeMutex;
+};
+
+/**
+ * @brief 读多写少数据的宽限期，用法类似用户态的RCU
+ * @details 读方进出只对当前线程所在槽位的计数器做原子加减，不加锁，也不会被写方挡住。
+ *          写方把原子指针换成新副本后调用synchronize()，等换指针之前进来的读方全部退出，旧副本就可以释放了。
+ *          写方之间要自己加锁，读区间里不能调用同一个对象的synchronize()
+ */
+class GracePeriod: Noncopyable {
+public:
+    class ReadLock {
+    public:
+        ReadLock(GracePeriod& grace)
+            : m_counter(grace.enter()) {}
+        ~ReadLock() {
+            m_counter->fetch_sub(1);
+        }
+    private:
+        std::atomic<int64_t>* m_counter;
+    };
+
+    //等待调用之前开始的读区间全部结束
+    void synchronize();
+private:
+    std::atomic<int64_t>* enter() {
+        std::atomic<int64_t>* counter = &m_slots[m_epoch.load() & 1][SlotIndex()].count;
+        counter->fetch_add(1);
+        return counter;
+    }
+    void wait(uint32_t index);
+    static uint32_t SlotIndex() {
+        static std::atomic<uint32_t> s_next{0};
+        static thread_local uint32_t t_slot = s_next.fetch_add(1) % SLOTS;
+        return t_slot;
+    }
+private:
+    static const uint32_t SLOTS = 8;
+    //每个计数器独占一个缓存行，不同线程的读方不互相抖动
+    struct Slot {
+        std::atomic<int64_t> count{0};
+        char pad[64 - sizeof(std::atomic<int64_t>)];
+    };
+    std::atomic<uint32_t> m_epoch{0};
+    Slot m_slots[2][SLOTS];
+};
 }
 #endif
\ No newline at end of file
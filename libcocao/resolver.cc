@@ -0,0 +1,630 @@
+#include "resolver.h"
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <string.h>
+#include "socket.h"
+#include "log.h"
+#include "utils.h"
+
+namespace libcocao {
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_NAME("system");
+
+//记录类型和类
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_TYPE_CNAME = 5;
+static const uint16_t DNS_TYPE_SOA = 6;
+static const uint16_t DNS_TYPE_AAAA = 28;
+static const uint16_t DNS_CLASS_IN = 1;
+//头部标志位
+static const uint16_t DNS_FLAG_QR = 0x8000;
+static const uint16_t DNS_FLAG_TC = 0x0200;
+static const uint16_t DNS_FLAG_RD = 0x0100;
+static const uint16_t DNS_RCODE_NXDOMAIN = 3;
+static const size_t DNS_HEADER_SIZE = 12;
+//UDP应答的接收缓冲区，不带EDNS时应答不超过512字节，超过的会被截断
+static const size_t DNS_UDP_SIZE = 1500;
+//否定应答里没有SOA时缓存的秒数
+static const uint32_t DNS_NEGATIVE_TTL = 30;
+//CNAME链最多跟几跳
+static const int DNS_MAX_CNAME = 8;
+
+/**
+ * @brief 解析应答的结果，前三个和Resolver::Status一致
+ */
+enum ParseResult {
+    PARSE_OK = 0,
+    PARSE_NOTFOUND = 1,
+    PARSE_FAIL = 2,
+    /// 应答被截断，需要改用TCP
+    PARSE_TRUNCATED = 3,
+    /// 不是这次查询的应答，丢掉继续等
+    PARSE_MISMATCH = 4,
+};
+
+static std::string ToLower(const std::string& str) {
+    std::string rt(str);
+    std::transform(rt.begin(), rt.end(), rt.begin(), ::tolower);
+    return rt;
+}
+
+//查询id随机取，防止伪造应答
+static uint16_t NextQueryId() {
+    static thread_local std::mt19937 s_rng(std::random_device{}());
+    return s_rng() & 0xffff;
+}
+
+static IPAddress::ptr MakeAddress(int family, const void* raw, uint16_t port = 0) {
+    if (family == AF_INET) {
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        memcpy(&addr.sin_addr, raw, sizeof(addr.sin_addr));
+        addr.sin_port = htons(port);
+        return IPAddress::ptr(new IPv4Address(addr));
+    }
+    sockaddr_in6 addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    memcpy(&addr.sin6_addr, raw, sizeof(addr.sin6_addr));
+    addr.sin6_port = htons(port);
+    return IPAddress::ptr(new IPv6Address(addr));
+}
+
+//数字地址直接转换，不是数字地址返回nullptr
+static IPAddress::ptr ParseNumeric(const std::string& str, uint16_t port = 0) {
+    in6_addr buf;
+    if (inet_pton(AF_INET, str.c_str(), &buf) == 1) return MakeAddress(AF_INET, &buf, port);
+    if (inet_pton(AF_INET6, str.c_str(), &buf) == 1) return MakeAddress(AF_INET6, &buf, port);
+    return nullptr;
+}
+
+static IPAddress::ptr CopyAddress(const IPAddress::ptr& addr, uint16_t port) {
+    if (addr->getFamily() == AF_INET) {
+        return MakeAddress(AF_INET, &((const sockaddr_in*)addr->getAddr())->sin_addr, port);
+    }
+    return MakeAddress(AF_INET6, &((const sockaddr_in6*)addr->getAddr())->sin6_addr, port);
+}
+
+static bool FamilyMatch(const IPAddress::ptr& addr, int family) {
+    return family == AF_UNSPEC || addr->getFamily() == family;
+}
+
+static void PutU16(std::string& buf, uint16_t v) {
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+static bool ReadU16(const uint8_t* msg, size_t len, size_t& pos, uint16_t& v) {
+    if (pos + 2 > len) return false;
+    v = (msg[pos] << 8) | msg[pos + 1];
+    pos += 2;
+    return true;
+}
+
+static bool ReadU32(const uint8_t* msg, size_t len, size_t& pos, uint32_t& v) {
+    if (pos + 4 > len) return false;
+    v = ((uint32_t)msg[pos] << 24) | (msg[pos + 1] << 16) | (msg[pos + 2] << 8) | msg[pos + 3];
+    pos += 4;
+    return true;
+}
+
+/**
+ * @brief 构造查询报文，只带一个问题，要求递归
+ * @return 域名不合法返回false
+ */
+static bool BuildQuery(const std::string& name, uint16_t qtype, std::string& buf) {
+    if (name.empty() || name.size() > 253) return false;
+    buf.clear();
+    PutU16(buf, 0);
+    PutU16(buf, DNS_FLAG_RD);
+    PutU16(buf, 1);
+    PutU16(buf, 0);
+    PutU16(buf, 0);
+    PutU16(buf, 0);
+    size_t begin = 0;
+    while (begin <= name.size()) {
+        size_t end = name.find('.', begin);
+        if (end == std::string::npos) end = name.size();
+        size_t n = end - begin;
+        if (n == 0 || n > 63) return false;
+        buf.push_back((char)n);
+        buf.append(name, begin, n);
+        begin = end + 1;
+    }
+    buf.push_back(0);
+    PutU16(buf, qtype);
+    PutU16(buf, DNS_CLASS_IN);
+    return true;
+}
+
+/**
+ * @brief 读一个可能带压缩指针的域名，转成小写，pos移到原位置的域名之后
+ */
+static bool ReadName(const uint8_t* msg, size_t len, size_t& pos, std::string& name) {
+    name.clear();
+    size_t cur = pos;
+    bool jumped = false;
+    //压缩指针最多跟这么多次，防止构造出的环
+    for (int jumps = 0; jumps < 64;) {
+        if (cur >= len) return false;
+        uint8_t n = msg[cur];
+        if (n == 0) {
+            if (!jumped) pos = cur + 1;
+            return true;
+        }
+        if ((n & 0xc0) == 0xc0) {
+            if (cur + 2 > len) return false;
+            if (!jumped) pos = cur + 2;
+            jumped = true;
+            cur = ((n & 0x3f) << 8) | msg[cur + 1];
+            ++ jumps;
+            continue;
+        }
+        if ((n & 0xc0) || cur + 1 + n > len) return false;
+        if (!name.empty()) name.push_back('.');
+        for (size_t i = 0; i < n; ++ i) {
+            name.push_back(tolower(msg[cur + 1 + i]));
+        }
+        if (name.size() > 255) return false;
+        cur += 1 + n;
+    }
+    return false;
+}
+
+/**
+ * @brief 解析应答
+ * @details 跟着CNAME链找qtype的记录，ttl取链上所有记录的最小值；
+ *          否定应答的ttl取权威段里SOA的ttl和MINIMUM中较小的一个
+ */
+static int ParseResponse(const uint8_t* msg, size_t len, uint16_t id, const std::string& name,
+                         uint16_t qtype, std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+    size_t pos = 0;
+    uint16_t rid, flags, qdcount, ancount, nscount, arcount;
+    if (!ReadU16(msg, len, pos, rid) || !ReadU16(msg, len, pos, flags)
+            || !ReadU16(msg, len, pos, qdcount) || !ReadU16(msg, len, pos, ancount)
+            || !ReadU16(msg, len, pos, nscount) || !ReadU16(msg, len, pos, arcount)) {
+        return PARSE_MISMATCH;
+    }
+    if (rid != id || !(flags & DNS_FLAG_QR) || qdcount != 1) return PARSE_MISMATCH;
+
+    std::string qname;
+    uint16_t type, cls;
+    if (!ReadName(msg, len, pos, qname) || !ReadU16(msg, len, pos, type)
+            || !ReadU16(msg, len, pos, cls) || qname != name || type != qtype) {
+        return PARSE_MISMATCH;
+    }
+    if (flags & DNS_FLAG_TC) return PARSE_TRUNCATED;
+    uint16_t rcode = flags & 0xf;
+    if (rcode != 0 && rcode != DNS_RCODE_NXDOMAIN) return PARSE_FAIL;
+
+    struct Record {
+        std::string owner;
+        uint16_t type;
+        uint32_t ttl;
+        //A/AAAA记录的地址
+        IPAddress::ptr addr;
+        //CNAME记录的目标
+        std::string target;
+    };
+    std::vector<Record> answers;
+    uint32_t negative_ttl = DNS_NEGATIVE_TTL;
+    for (int i = 0; i < ancount + nscount; ++ i) {
+        Record rr;
+        uint16_t rdlen;
+        if (!ReadName(msg, len, pos, rr.owner) || !ReadU16(msg, len, pos, rr.type)
+                || !ReadU16(msg, len, pos, cls) || !ReadU32(msg, len, pos, rr.ttl)
+                || !ReadU16(msg, len, pos, rdlen) || pos + rdlen > len) {
+            return PARSE_FAIL;
+        }
+        size_t rdata = pos;
+        pos += rdlen;
+        if (cls != DNS_CLASS_IN) continue;
+        if (i >= ancount) {
+            //权威段只关心SOA，MINIMUM是RDATA的最后4字节
+            size_t p = rdata + rdlen - 4;
+            uint32_t minimum;
+            if (rr.type == DNS_TYPE_SOA && rdlen >= 4 && ReadU32(msg, len, p, minimum)) {
+                negative_ttl = std::min(rr.ttl, minimum);
+            }
+            continue;
+        }
+        if (rr.type == DNS_TYPE_A && rdlen == 4) {
+            rr.addr = MakeAddress(AF_INET, msg + rdata);
+        } else if (rr.type == DNS_TYPE_AAAA && rdlen == 16) {
+            rr.addr = MakeAddress(AF_INET6, msg + rdata);
+        } else if (rr.type == DNS_TYPE_CNAME) {
+            size_t p = rdata;
+            if (!ReadName(msg, len, p, rr.target)) return PARSE_FAIL;
+        } else {
+            continue;
+        }
+        answers.push_back(std::move(rr));
+    }
+
+    std::string target = name;
+    uint32_t min_ttl = UINT32_MAX;
+    for (int hop = 0; hop <= DNS_MAX_CNAME && addrs.empty(); ++ hop) {
+        const Record* cname = nullptr;
+        for (auto& i : answers) {
+            if (i.owner != target) continue;
+            if (i.type == qtype && i.addr) {
+                addrs.push_back(i.addr);
+                min_ttl = std::min(min_ttl, i.ttl);
+            } else if (i.type == DNS_TYPE_CNAME) {
+                cname = &i;
+            }
+        }
+        if (!addrs.empty() || !cname) break;
+        min_ttl = std::min(min_ttl, cname->ttl);
+        target = cname->target;
+    }
+    if (addrs.empty()) {
+        ttl = negative_ttl;
+        return PARSE_NOTFOUND;
+    }
+    ttl = min_ttl;
+    return PARSE_OK;
+}
+
+static uint64_t Remain(uint64_t deadline) {
+    uint64_t now = GetMonotonicMS();
+    return deadline > now ? deadline - now : 0;
+}
+
+/**
+ * @brief 通过UDP查询一次，收到不匹配的报文时继续等到超时
+ */
+static int UdpExchange(Address::ptr server, std::string& req, const std::string& name, uint16_t qtype,
+                       uint64_t timeout, std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+    Socket::ptr sock = Socket::CreateUDP(server);
+    //connect之后内核只收这个nameserver发来的报文
+    if (!sock->isValid() || !sock->connect(server)) return PARSE_FAIL;
+    uint16_t id = NextQueryId();
+    req[0] = (char)(id >> 8);
+    req[1] = (char)(id & 0xff);
+    if (sock->send(req.data(), req.size()) != (int)req.size()) return PARSE_FAIL;
+
+    uint64_t deadline = GetMonotonicMS() + timeout;
+    uint8_t buf[DNS_UDP_SIZE];
+    while (true) {
+        uint64_t remain = Remain(deadline);
+        if (!remain) return PARSE_FAIL;
+        sock->setRecvTimeout(remain);
+        int n = sock->recv(buf, sizeof(buf));
+        if (n <= 0) return PARSE_FAIL;
+        addrs.clear();
+        int rt = ParseResponse(buf, n, id, name, qtype, addrs, ttl);
+        if (rt != PARSE_MISMATCH) return rt;
+    }
+}
+
+static bool RecvAll(Socket::ptr sock, void* buf, size_t len, uint64_t deadline) {
+    size_t offset = 0;
+    while (offset < len) {
+        uint64_t remain = Remain(deadline);
+        if (!remain) return false;
+        sock->setRecvTimeout(remain);
+        int n = sock->recv((char*)buf + offset, len - offset);
+        if (n <= 0) return false;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * @brief 通过TCP查询一次，报文前面带两字节长度
+ */
+static int TcpExchange(Address::ptr server, std::string& req, const std::string& name, uint16_t qtype,
+                       uint64_t timeout, std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+    uint64_t deadline = GetMonotonicMS() + timeout;
+    Socket::ptr sock = Socket::CreateTCP(server);
+    if (!sock->connect(server, timeout)) return PARSE_FAIL;
+    uint16_t id = NextQueryId();
+    req[0] = (char)(id >> 8);
+    req[1] = (char)(id & 0xff);
+    std::string msg;
+    PutU16(msg, req.size());
+    msg += req;
+    sock->setSendTimeout(Remain(deadline));
+    size_t offset = 0;
+    while (offset < msg.size()) {
+        int n = sock->send(msg.data() + offset, msg.size() - offset);
+        if (n <= 0) return PARSE_FAIL;
+        offset += n;
+    }
+
+    uint8_t head[2];
+    if (!RecvAll(sock, head, sizeof(head), deadline)) return PARSE_FAIL;
+    std::vector<uint8_t> buf((head[0] << 8) | head[1]);
+    if (!RecvAll(sock, buf.data(), buf.size(), deadline)) return PARSE_FAIL;
+    addrs.clear();
+    int rt = ParseResponse(buf.data(), buf.size(), id, name, qtype, addrs, ttl);
+    return rt == PARSE_MISMATCH || rt == PARSE_TRUNCATED ? PARSE_FAIL : rt;
+}
+
+Resolver::Resolver() {
+    m_nameservers.push_back(IPv4Address::Create("127.0.0.1", 53));
+    loadHosts();
+    loadResolvConf();
+}
+
+bool Resolver::loadHosts(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        LIBCOCAO_LOG_DEBUG(g_logger) << "Resolver::loadHosts open " << path << " failed";
+        return false;
+    }
+    std::unordered_map<std::string, std::vector<IPAddress::ptr>> hosts;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line.substr(0, line.find('#')));
+        std::string ip, host;
+        if (!(iss >> ip)) continue;
+        IPAddress::ptr addr = ParseNumeric(ip);
+        if (!addr) continue;
+        while (iss >> host) {
+            hosts[ToLower(host)].push_back(addr);
+        }
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    m_hosts.swap(hosts);
+    return true;
+}
+
+bool Resolver::loadResolvConf(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs) {
+        LIBCOCAO_LOG_DEBUG(g_logger) << "Resolver::loadResolvConf open " << path << " failed";
+        return false;
+    }
+    std::vector<Address::ptr> servers;
+    std::vector<std::string> search;
+    uint64_t timeout = 0;
+    int attempts = 0;
+    int ndots = -1;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        std::istringstream iss(line.substr(0, line.find_first_of("#;")));
+        std::string key, value;
+        if (!(iss >> key)) continue;
+        if (key == "nameserver") {
+            IPAddress::ptr addr;
+            if ((iss >> value) && (addr = ParseNumeric(value, 53))) {
+                servers.push_back(addr);
+            }
+        } else if (key == "domain" || key == "search") {
+            search.clear();
+            while (iss >> value) {
+                search.push_back(ToLower(value));
+            }
+        } else if (key == "options") {
+            while (iss >> value) {
+                if (value.compare(0, 8, "timeout:") == 0) {
+                    timeout = atoi(value.c_str() + 8) * 1000;
+                } else if (value.compare(0, 9, "attempts:") == 0) {
+                    attempts = atoi(value.c_str() + 9);
+                } else if (value.compare(0, 6, "ndots:") == 0) {
+                    ndots = atoi(value.c_str() + 6);
+                }
+            }
+        }
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if (!servers.empty()) m_nameservers.swap(servers);
+    m_search.swap(search);
+    if (timeout) m_timeout = timeout;
+    if (attempts > 0) m_attempts = attempts;
+    if (ndots >= 0) m_ndots = ndots;
+    return true;
+}
+
+void Resolver::setNameservers(const std::vector<Address::ptr>& v) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_nameservers = v;
+}
+
+void Resolver::setSearch(const std::vector<std::string>& v) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_search.clear();
+    for (auto& i : v) {
+        m_search.push_back(ToLower(i));
+    }
+}
+
+void Resolver::setTimeout(uint64_t v) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_timeout = v;
+}
+
+void Resolver::setAttempts(int v) {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_attempts = v > 0 ? v : 1;
+}
+
+void Resolver::clearCache() {
+    RWMutexType::WriteLock lock(m_mutex);
+    m_cache.clear();
+}
+
+bool Resolver::lookup(const std::string& name, int family, std::vector<IPAddress::ptr>& result, uint16_t port) {
+    IPAddress::ptr numeric = ParseNumeric(name, port);
+    if (numeric) {
+        if (!FamilyMatch(numeric, family)) return false;
+        result.push_back(numeric);
+        return true;
+    }
+    std::string key = ToLower(name);
+    if (!key.empty() && key.back() == '.') key.pop_back();
+    if (key.empty()) return false;
+
+    size_t old_size = result.size();
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_hosts.find(key);
+        if (it != m_hosts.end()) {
+            for (auto& i : it->second) {
+                if (FamilyMatch(i, family)) result.push_back(CopyAddress(i, port));
+            }
+        }
+    }
+    if (result.size() > old_size) return true;
+
+    std::vector<IPAddress::ptr> addrs;
+    if (family == AF_INET || family == AF_UNSPEC) {
+        if (resolve(name, DNS_TYPE_A, addrs) == OK) {
+            for (auto& i : addrs) result.push_back(CopyAddress(i, port));
+        }
+    }
+    if (family == AF_INET6 || family == AF_UNSPEC) {
+        addrs.clear();
+        if (resolve(name, DNS_TYPE_AAAA, addrs) == OK) {
+            for (auto& i : addrs) result.push_back(CopyAddress(i, port));
+        }
+    }
+    if (result.size() == old_size) {
+        LIBCOCAO_LOG_DEBUG(g_logger) << "Resolver::lookup(" << name << ", " << family << ") not found";
+        return false;
+    }
+    return true;
+}
+
+Resolver::Status Resolver::resolve(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs) {
+    std::string fqdn = ToLower(name);
+    //以点结尾的是完整域名，不拼search后缀
+    if (fqdn.back() == '.') {
+        fqdn.pop_back();
+        return query(fqdn, qtype, addrs);
+    }
+    std::vector<std::string> names;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        bool as_is_first = std::count(fqdn.begin(), fqdn.end(), '.') >= m_ndots;
+        if (as_is_first) names.push_back(fqdn);
+        for (auto& i : m_search) {
+            names.push_back(fqdn + "." + i);
+        }
+        if (!as_is_first) names.push_back(fqdn);
+    }
+    Status rt = NOTFOUND;
+    for (auto& i : names) {
+        Status status = query(i, qtype, addrs);
+        if (status == OK) return OK;
+        if (status == FAIL) rt = FAIL;
+    }
+    return rt;
+}
+
+Resolver::Status Resolver::query(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs) {
+    std::string key = name + "#" + std::to_string(qtype);
+    Pending::ptr pending;
+    bool leader = false;
+    {
+        uint64_t now = GetMonotonicMS();
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end() && it->second.expire > now) {
+            addrs = it->second.addrs;
+            return it->second.status;
+        }
+    }
+    {
+        uint64_t now = GetMonotonicMS();
+        RWMutexType::WriteLock lock(m_mutex);
+        //拿写锁之前可能刚有一次查询完成
+        auto it = m_cache.find(key);
+        if (it != m_cache.end() && it->second.expire > now) {
+            addrs = it->second.addrs;
+            return it->second.status;
+        }
+        auto pit = m_pending.find(key);
+        if (pit != m_pending.end()) {
+            pending = pit->second;
+        } else {
+            pending.reset(new Pending);
+            m_pending[key] = pending;
+            leader = true;
+        }
+    }
+
+    if (!leader) {
+        FiberMutex::Lock lock(pending->mutex);
+        pending->cond.wait(pending->mutex, [&pending]() { return pending->done; });
+        addrs = pending->addrs;
+        return pending->status;
+    }
+
+    uint32_t ttl = 0;
+    Status status = exchange(name, qtype, addrs, ttl);
+    {
+        RWMutexType::WriteLock lock(m_mutex);
+        //ttl为0表示不能缓存，临时错误也不缓存
+        if (status != FAIL && ttl) {
+            addCache(key, status, addrs, ttl);
+        }
+        m_pending.erase(key);
+    }
+    {
+        FiberMutex::Lock lock(pending->mutex);
+        pending->done = true;
+        pending->status = status;
+        pending->addrs = addrs;
+    }
+    pending->cond.notifyAll();
+    return status;
+}
+
+Resolver::Status Resolver::exchange(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs, uint32_t& ttl) {
+    std::vector<Address::ptr> servers;
+    uint64_t timeout;
+    int attempts;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        servers = m_nameservers;
+        timeout = m_timeout;
+        attempts = m_attempts;
+    }
+    std::string req;
+    if (!BuildQuery(name, qtype, req)) {
+        LIBCOCAO_LOG_DEBUG(g_logger) << "Resolver invalid name " << name;
+        return NOTFOUND;
+    }
+    for (int i = 0; i < attempts; ++ i) {
+        for (auto& server : servers) {
+            int rt = UdpExchange(server, req, name, qtype, timeout, addrs, ttl);
+            if (rt == PARSE_TRUNCATED) {
+                rt = TcpExchange(server, req, name, qtype, timeout, addrs, ttl);
+            }
+            if (rt == PARSE_OK || rt == PARSE_NOTFOUND) {
+                if (rt == PARSE_NOTFOUND) addrs.clear();
+                return (Status)rt;
+            }
+            LIBCOCAO_LOG_DEBUG(g_logger) << "Resolver query " << name << " type=" << qtype
+                                         << " server=" << server->toString() << " failed";
+        }
+    }
+    addrs.clear();
+    return FAIL;
+}
+
+void Resolver::addCache(const std::string& key, Status status, const std::vector<IPAddress::ptr>& addrs, uint32_t ttl) {
+    uint64_t now = GetMonotonicMS();
+    if (m_cache.size() >= m_maxCache) {
+        for (auto it = m_cache.begin(); it != m_cache.end();) {
+            if (it->second.expire <= now) {
+                it = m_cache.erase(it);
+            } else {
+                ++ it;
+            }
+        }
+        if (m_cache.size() >= m_maxCache) m_cache.clear();
+    }
+    CacheEntry& entry = m_cache[key];
+    entry.status = status;
+    entry.addrs = addrs;
+    entry.expire = now + ttl * 1000ull;
+}
+
+}
@@ -0,0 +1,158 @@
+#ifndef __LIBCOCAO_RESOLVER_H__
+#define __LIBCOCAO_RESOLVER_H__
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "address.h"
+#include "mutex.h"
+#include "fiber_mutex.h"
+#include "singleton.h"
+
+namespace libcocao {
+
+/**
+ * @brief 协程友好的域名解析
+ * @details getaddrinfo会阻塞整个线程且hook不到，这里自己读/etc/hosts和/etc/resolv.conf，
+ *          用hook过的UDP Socket向nameserver发DNS查询，等待期间只挂起协程。
+ *          应答按TTL缓存，NXDOMAIN等否定应答也缓存；同一个名字同时只发一次查询，其余的请求者等它的结果。
+ *          应答被截断(TC)时改用TCP重查。不在调度器里的线程调用时阻塞线程，超时由SO_RCVTIMEO保证
+ */
+class Resolver: Noncopyable {
+public:
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 构造函数，读取/etc/hosts和/etc/resolv.conf
+     */
+    Resolver();
+
+    /**
+     * @brief 重新读取hosts文件，替换原来的记录
+     * @return 文件打不开返回false
+     */
+    bool loadHosts(const std::string& path = "/etc/hosts");
+
+    /**
+     * @brief 重新读取resolv.conf，支持nameserver、search、domain和options里的timeout/attempts/ndots
+     * @details 没有配置nameserver时和glibc一样使用127.0.0.1
+     * @return 文件打不开返回false
+     */
+    bool loadResolvConf(const std::string& path = "/etc/resolv.conf");
+
+    /**
+     * @brief 直接指定nameserver，可以带非53的端口
+     */
+    void setNameservers(const std::vector<Address::ptr>& v);
+
+    /**
+     * @brief 设置search列表
+     */
+    void setSearch(const std::vector<std::string>& v);
+
+    /**
+     * @brief 设置单次查询的超时时间(ms)
+     */
+    void setTimeout(uint64_t v);
+
+    /**
+     * @brief 设置每个nameserver的尝试轮数
+     */
+    void setAttempts(int v);
+
+    /**
+     * @brief 清空解析缓存，hosts记录不受影响
+     */
+    void clearCache();
+
+    /**
+     * @brief 解析域名
+     * @details 依次尝试数字地址、hosts记录、DNS查询。AF_UNSPEC时先查A记录再查AAAA记录
+     * @param[in] name 域名或数字地址
+     * @param[in] family 协议族(AF_INET, AF_INET6, AF_UNSPEC)
+     * @param[out] result 解析到的地址，每个都是新复制的，可以随意修改
+     * @param[in] port 结果地址的端口
+     * @return 至少解析到一个地址返回true
+     */
+    bool lookup(const std::string& name, int family, std::vector<IPAddress::ptr>& result, uint16_t port = 0);
+
+private:
+    /**
+     * @brief 一次查询的结果
+     */
+    enum Status {
+        /// 解析到了地址
+        OK = 0,
+        /// 域名或记录不存在，可以缓存
+        NOTFOUND = 1,
+        /// 超时、SERVFAIL等临时错误，不缓存
+        FAIL = 2,
+    };
+
+    /**
+     * @brief 缓存项
+     */
+    struct CacheEntry {
+        Status status;
+        std::vector<IPAddress::ptr> addrs;
+        /// 过期时间(单调时钟ms)
+        uint64_t expire;
+    };
+
+    /**
+     * @brief 进行中的查询，后到的请求者在上面等待
+     */
+    struct Pending {
+        typedef std::shared_ptr<Pending> ptr;
+        FiberMutex mutex;
+        FiberCondVar cond;
+        bool done = false;
+        Status status = FAIL;
+        std::vector<IPAddress::ptr> addrs;
+    };
+
+    /**
+     * @brief 按search列表展开域名后查询一种记录
+     */
+    Status resolve(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs);
+
+    /**
+     * @brief 查询一个完整域名的一种记录，先查缓存，同名的查询合并成一次
+     */
+    Status query(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs);
+
+    /**
+     * @brief 向nameserver发查询，轮流尝试每个nameserver
+     * @param[out] ttl 结果可以缓存的秒数
+     */
+    Status exchange(const std::string& name, uint16_t qtype, std::vector<IPAddress::ptr>& addrs, uint32_t& ttl);
+
+    /**
+     * @brief 缓存查询结果，缓存满时先清理过期项，调用时持有写锁
+     */
+    void addCache(const std::string& key, Status status, const std::vector<IPAddress::ptr>& addrs, uint32_t ttl);
+
+private:
+    /// 保护下面所有成员
+    RWMutexType m_mutex;
+    /// 单次查询的超时时间(ms)
+    uint64_t m_timeout = 5000;
+    /// 每个nameserver的尝试轮数
+    int m_attempts = 2;
+    /// 域名里的点数不少于ndots时先按原样查询，否则先拼search后缀
+    int m_ndots = 1;
+    /// 缓存项上限
+    size_t m_maxCache = 4096;
+    std::vector<Address::ptr> m_nameservers;
+    std::vector<std::string> m_search;
+    /// hosts记录，域名已转成小写
+    std::unordered_map<std::string, std::vector<IPAddress::ptr>> m_hosts;
+    /// 键是"域名#记录类型"
+    std::unordered_map<std::string, CacheEntry> m_cache;
+    std::unordered_map<std::string, Pending::ptr> m_pending;
+};
+
+typedef Singleton<Resolver> ResolverMgr;
+
+}
+
+#endif
@@ -8,6 +8,8 @@ static Logger::ptr g_logger = LIBCOCAO_LOG_NAME("system");
 static thread_local Scheduler *t_scheduler = nullptr;
 //当前线程的调度协程，每个线程都独有一份
 static thread_local Fiber *t_scheduler_fiber = nullptr;
+//当前线程在调度器中的本地队列下标，非工作线程为-1
+static thread_local int t_queue_index = -1;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
     m_useCaller = use_caller;
@@ -26,6 +28,23 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name) {
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    size_t queues = m_useCaller ? threads + 1 : threads;
+    if (queues == 0) queues = 1;
+    for (size_t i = 0; i < queues; ++ i) {
+        m_queues.push_back(new LocalQueue);
+        m_queues.back()->index = i;
+    }
+}
+
+Scheduler::~Scheduler() {
+    for (auto &i : m_queues) {
+        delete i;
+    }
+    m_queues.clear();
+    if (GetThis() == this) {
+        t_scheduler = nullptr;
+    }
 }
 
 Scheduler *Scheduler::GetThis() {
@@ -40,6 +59,10 @@ Fiber *Scheduler::GetMainFiber() {
     return t_scheduler_fiber;
 }
 
+int Scheduler::getQueueIndex() const {
+    return t_scheduler == this ? t_queue_index : -1;
+}
+
 void Scheduler::start() {
     LIBCOCAO_LOG_DEBUG(g_logger) << "start";
     MutexType::Lock lock(m_mutex);
@@ -55,8 +78,7 @@ void Scheduler::start() {
 }
 
 bool Scheduler::stopping() {
-    MutexType::Lock lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activateThreadCount == 0;
+    return m_stopping && m_taskCount == 0 && m_activateThreadCount == 0;
 }
 
 void Scheduler::tickle() {
@@ -76,39 +98,23 @@ void Scheduler::run() {
         t_scheduler_fiber = libcocao::Fiber::GetThis().get();
     }
 
-    Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+    Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this), 0, true));
     Fiber::ptr cb_fiber;
 
+    t_queue_index = m_queueIndex++;
+    assert(t_queue_index < (int)m_queues.size());
+    LocalQueue *local = m_queues[t_queue_index];
+    registerQueue(local);
+
     ScheduleTask task;
 
     while (true) {
         task.reset();
-        bool tickle_me = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            while (it != m_tasks.end()) {
-                if (it->thread != -1 && it->thread != libcocao::GetThreadId()) {
-                    ++ it;
-                    tickle_me = true;
-                    continue;
-                }
-//                if (it->fiber) {
-//                }
-
-                if(it->fiber && it->fiber->getState() == Fiber::RUNNING) {
-                    ++it;
-                    continue;
-                }
-
-                task = *it;
-                m_tasks.erase(it ++);
-                ++ m_activateThreadCount;
-                break;
-            }
-            tickle_me |= (it != m_tasks.end());
+        if (!popPinnedTask(local, task) && !popTask(local, task)) {
+            stealTask(local, task);
         }
-        if (tickle_me) {
+        //只有能被窃取的任务才值得叫醒别的线程
+        if (hasStealableTask()) {
             tickle();
         }
 
@@ -120,7 +126,7 @@ void Scheduler::run() {
             if (cb_fiber) {
                 cb_fiber->reset(task.cb);
             } else {
-                cb_fiber.reset(new Fiber(task.cb));
+                cb_fiber.reset(new Fiber(task.cb, 0, true));
             }
             task.reset();
             cb_fiber->resume();
@@ -139,6 +145,149 @@ void Scheduler::run() {
     LIBCOCAO_LOG_DEBUG(g_logger) << "Scheduler::run() exit";
 }
 
+Scheduler::LocalQueue *Scheduler::pickQueue() {
+    if (t_scheduler == this && t_queue_index >= 0) {
+        return m_queues[t_queue_index];
+    }
+    return m_queues[m_nextQueue++ % m_queues.size()];
+}
+
+bool Scheduler::pushTaskNoLock(LocalQueue *queue, ScheduleTask &task) {
+    //先计数再入队，保证m_taskCount不小于实际任务数，stopping()不会漏掉任务
+    bool need_tickle = (m_taskCount++ == 0);
+    queue->tasks.push_back(std::move(task));
+    ++ queue->size;
+    return need_tickle;
+}
+
+Scheduler::LocalQueue *Scheduler::findQueue(int thread) {
+    if (t_scheduler == this && t_queue_index >= 0
+            && m_queues[t_queue_index]->threadId == thread) {
+        return m_queues[t_queue_index];
+    }
+    for (auto &i : m_queues) {
+        if (i->threadId == thread) return i;
+    }
+    return nullptr;
+}
+
+void Scheduler::registerQueue(LocalQueue *local) {
+    MutexType::Lock lock(m_mutex);
+    local->threadId = libcocao::GetThreadId();
+    QueueMutexType::Lock lock2(local->mutex);
+    for (auto it = m_orphanTasks.begin(); it != m_orphanTasks.end();) {
+        if (it->thread == local->threadId) {
+            local->pinned.push_back(std::move(*it));
+            ++ local->pinnedSize;
+            it = m_orphanTasks.erase(it);
+        } else {
+            ++ it;
+        }
+    }
+}
+
+bool Scheduler::scheduleTask(ScheduleTask &task) {
+    if (task.thread != -1) {
+        LocalQueue *queue = findQueue(task.thread);
+        if (!queue) {
+            //线程还没进入run()，先暂存，登记时会取走
+            MutexType::Lock lock(m_mutex);
+            queue = findQueue(task.thread);
+            if (!queue) {
+                bool need_tickle = (m_taskCount++ == 0);
+                ++ m_pinnedTaskCount;
+                m_orphanTasks.push_back(std::move(task));
+                return need_tickle;
+            }
+        }
+        QueueMutexType::Lock lock(queue->mutex);
+        ++ m_taskCount;
+        ++ m_pinnedTaskCount;
+        queue->pinned.push_back(std::move(task));
+        ++ queue->pinnedSize;
+        lock.unlock();
+        //只有那个线程能执行，直接通知它；是当前线程的话回到run()就会取到
+        if (queue->index != getQueueIndex()) {
+            tickleThread(queue->index);
+        }
+        return false;
+    }
+    LocalQueue *queue = pickQueue();
+    QueueMutexType::Lock lock(queue->mutex);
+    return pushTaskNoLock(queue, task);
+}
+
+bool Scheduler::popTask(LocalQueue *queue, ScheduleTask &task) {
+    if (queue->size == 0) return false;
+    QueueMutexType::Lock lock(queue->mutex);
+    for (auto it = queue->tasks.begin(); it != queue->tasks.end(); ++ it) {
+        if (it->fiber && it->fiber->getState() == Fiber::RUNNING) continue;
+
+        task = std::move(*it);
+        queue->tasks.erase(it);
+        -- queue->size;
+        ++ m_activateThreadCount;
+        -- m_taskCount;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::stealTask(LocalQueue *local, ScheduleTask &task) {
+    size_t n = m_queues.size();
+    for (size_t i = 1; i < n; ++ i) {
+        LocalQueue *victim = m_queues[(t_queue_index + i) % n];
+        if (victim->size == 0) continue;
+
+        //从尾部窃取一半，第一个拿来执行，其余放进本线程队列
+        std::vector<ScheduleTask> stolen;
+        {
+            QueueMutexType::Lock lock(victim->mutex);
+            size_t want = (victim->tasks.size() + 1) / 2;
+            auto it = victim->tasks.end();
+            while (it != victim->tasks.begin() && stolen.size() < want) {
+                -- it;
+                if (it->fiber && it->fiber->getState() == Fiber::RUNNING) continue;
+                stolen.push_back(std::move(*it));
+                it = victim->tasks.erase(it);
+            }
+            if (stolen.empty()) continue;
+            victim->size -= stolen.size();
+            ++ m_activateThreadCount;
+            -- m_taskCount;
+        }
+
+        task = std::move(stolen.back());
+        stolen.pop_back();
+        if (!stolen.empty()) {
+            QueueMutexType::Lock lock(local->mutex);
+            for (auto it = stolen.rbegin(); it != stolen.rend(); ++ it) {
+                local->tasks.push_back(std::move(*it));
+            }
+            local->size += stolen.size();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::popPinnedTask(LocalQueue *local, ScheduleTask &task) {
+    if (local->pinnedSize == 0) return false;
+    QueueMutexType::Lock lock(local->mutex);
+    for (auto it = local->pinned.begin(); it != local->pinned.end(); ++ it) {
+        if (it->fiber && it->fiber->getState() == Fiber::RUNNING) continue;
+
+        task = std::move(*it);
+        local->pinned.erase(it);
+        -- local->pinnedSize;
+        ++ m_activateThreadCount;
+        -- m_pinnedTaskCount;
+        -- m_taskCount;
+        return true;
+    }
+    return false;
+}
+
 void Scheduler::stop() {
     if (stopping())
         return;
@@ -2,6 +2,7 @@
 #define __LIBCOCAO_SCHEDULE_H__
 
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <vector>
@@ -14,8 +15,10 @@ class Scheduler {
 public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
+    typedef SpinLock QueueMutexType;
 
     Scheduler (size_t threads, bool use_caller, const std::string &name);
+    virtual ~Scheduler();
     void start();
 
     virtual bool stopping();
@@ -31,12 +34,9 @@ public:
 
     template<class FiberOrCb>
     void schedule (FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock (m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
-        }
-        if (need_tickle) {
+        ScheduleTask task(fc, thread);
+        if (!task.fiber && !task.cb) return;
+        if (scheduleTask(task)) {
             tickle();
         }
     }
@@ -44,21 +44,49 @@ public:
     template<class InputItertor>
     void schedule (InputItertor begin, InputItertor end) {
         bool need_tickle = false;
+        std::vector<ScheduleTask> pinned;   //绑定了线程的共享栈协程，放锁后再投递
         {
-            MutexType::Lock lock(m_mutex);
+            LocalQueue *queue = pickQueue();
+            QueueMutexType::Lock lock(queue->mutex);
             while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin++, -1) || need_tickle;
-            }
-            if (need_tickle) {
-                tickle();
+                ScheduleTask task(&*begin++, -1);
+                if (task.thread != -1) {
+                    pinned.push_back(std::move(task));
+                } else if (task.fiber || task.cb) {
+                    need_tickle = pushTaskNoLock(queue, task) || need_tickle;
+                }
             }
         }
+        for (auto &i : pinned) {
+            need_tickle = scheduleTask(i) || need_tickle;
+        }
+        if (need_tickle) {
+            tickle();
+        }
     }
 
 
     static Scheduler* GetThis();
     static Fiber* GetMainFiber();
 
+    //所有线程的id，use_caller时第一个是调用线程
+    const std::vector<int> &getThreadIds() const { return m_threadIds; }
+
+protected:
+    /**
+     * @brief 通知指定线程有绑定给它的任务
+     * @details 默认和tickle()一样随便唤醒一个线程，每个线程各自等待IO事件的调度器要唤醒指定的那个
+     * @param[in] index 线程在调度器中的序号，即本地队列下标
+     */
+    virtual void tickleThread(int index) { tickle(); }
+    //本地队列个数，每个运行run()的线程一个
+    size_t getQueueCount() const { return m_queues.size(); }
+    //当前线程的本地队列下标，不是本调度器的线程返回-1
+    int getQueueIndex() const;
+    //是否有没指定线程、谁都能取走的任务；idle在睡眠前标记空闲后再查一次，
+    //取任务失败和标记空闲之间投递的任务，tickle可能没看到这个线程空闲
+    bool hasStealableTask() const { return m_taskCount > m_pinnedTaskCount; }
+
 private:
     struct ScheduleTask {
         Fiber::ptr fiber;
@@ -67,11 +95,11 @@ private:
 
         ScheduleTask(Fiber::ptr f, int thr) {
             fiber  = f;
-            thread = thr;
+            thread = (thr == -1 && fiber) ? fiber->getPinnedThread() : thr;
         }
         ScheduleTask(Fiber::ptr *f, int thr) {
             fiber.swap(*f);
-            thread = thr;
+            thread = (thr == -1 && fiber) ? fiber->getPinnedThread() : thr;
         }
         ScheduleTask(std::function<void()> f, int thr) {
             cb     = f;
@@ -90,22 +118,37 @@ private:
         }
     };
 
+    //工作线程的本地任务队列，本线程从头部取任务，其他线程空闲时从尾部窃取
+    struct LocalQueue {
+        QueueMutexType mutex;
+        std::deque<ScheduleTask> tasks;
+        std::deque<ScheduleTask> pinned;    //指定在该线程执行的任务，不会被窃取
+        std::atomic<size_t> size{0};        //tasks长度，窃取时无锁判断是否为空
+        std::atomic<size_t> pinnedSize{0};  //pinned长度
+        std::atomic<int> threadId{-1};      //所属线程id，线程进入run()后设置
+        int index = 0;                      //在m_queues中的下标
+    };
+
 private:
-    template<class FiberOrCb>
-    bool scheduleNoLock (FiberOrCb fc, int thread) {
-        bool need_tickle = m_tasks.empty();
-        ScheduleTask task(fc, thread);
-        if (task.fiber || task.cb) {
-            m_tasks.push_back(task);
-        }
-        return need_tickle;
-    }
+    bool scheduleTask(ScheduleTask &task);                      //放入任务，返回是否需要tickle
+    LocalQueue *pickQueue();                                    //工作线程放入自己的队列，其他线程轮询放入
+    bool pushTaskNoLock(LocalQueue *queue, ScheduleTask &task); //持有队列锁时放入任务
+    bool popTask(LocalQueue *queue, ScheduleTask &task);        //取出可执行的任务，跳过正在运行的协程
+    bool stealTask(LocalQueue *local, ScheduleTask &task);      //从其他线程的队列尾部窃取任务
+    bool popPinnedTask(LocalQueue *local, ScheduleTask &task);  //取出指定在当前线程执行的任务
+    LocalQueue *findQueue(int thread);                          //查找线程对应的本地队列
+    void registerQueue(LocalQueue *local);                      //登记本地队列所属线程，取回先到的指定任务
 
 private:
     std::string m_name;
     MutexType m_mutex;
     std::vector<Thread::ptr> m_threads;  //线程池
-    std::list<ScheduleTask> m_tasks; //任务队列
+    std::vector<LocalQueue *> m_queues;  //每个工作线程的本地任务队列
+    std::atomic<size_t> m_queueIndex{0}; //下一个进入run()的线程使用的队列下标
+    std::atomic<size_t> m_nextQueue{0};  //非工作线程放入任务时轮询的队列下标
+    std::list<ScheduleTask> m_orphanTasks;  //指定线程尚未进入run()时暂存的任务
+    std::atomic<size_t> m_taskCount{0};     //所有队列中的任务总数
+    std::atomic<size_t> m_pinnedTaskCount{0};   //其中指定了线程、不能被窃取的任务数
     std::vector<int> m_threadIds;   //线程id数组
     Fiber::ptr m_rootFiber;
     size_t m_threadCount = 0;       //线程总数,不包含user_caller主线程
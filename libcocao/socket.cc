@@ -1,4 +1,5 @@
 #include "socket.h"
+#include <netinet/tcp.h>
 #include "iomanager.h"
 #include "log.h"
 #include "fd_manager.h"
@@ -108,7 +109,8 @@ Socket::~Socket(){
 * @return
 */
 int Socket::getSendTimeout (){
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadLock lock(FdMgr::GetInstance());
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) return ctx->getTimeout(SO_SNDTIMEO);
     return -1;
 }
@@ -129,7 +131,8 @@ void Socket::setSendTimeout (int64_t v){
  * @return
  */
 int64_t Socket::getRecvTimeout (){
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_sock);
+    FdManager::ReadLock lock(FdMgr::GetInstance());
+    FdCtx* ctx = FdMgr::GetInstance()->get(m_sock);
     if (ctx) return ctx->getTimeout(SO_RCVTIMEO);
     return -1;
 }
@@ -197,9 +200,10 @@ Socket::ptr Socket::accept (){
 /**
  * 绑定地址
  * @param addr 地址
+ * @param reuse_port 是否设置SO_REUSEPORT
  * @return
  */
-bool Socket::bind (const Address::ptr addr){
+bool Socket::bind (const Address::ptr addr, bool reuse_port){
     m_localAddress = addr;
     if (!isValid()) {
         newSock();
@@ -208,6 +212,12 @@ bool Socket::bind (const Address::ptr addr){
         }
     }
 
+    if (reuse_port && !setOption(SOL_SOCKET, SO_REUSEPORT, 1)) {
+        LIBCOCAO_LOG_ERROR(g_logger) << "setsockopt SO_REUSEPORT error errno=" << errno
+                                        << " errstr=" << strerror(errno);
+        return false;
+    }
+
     if (addr->getFamily() != m_family) {
         LIBCOCAO_LOG_ERROR(g_logger) << "bind sock.family("
                                         << m_family << ") addr.family" << addr->getFamily()
@@ -412,7 +422,7 @@ Address::ptr Socket::getRemoteAddress() {
     }
     if (m_family == AF_UNIX) {
         UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
-        addr->setAddrLen(addrlen);
+        addr->setAddrlen(addrlen);
     }
     m_remoteAddress = result;
     return m_remoteAddress;
@@ -446,7 +456,7 @@ Address::ptr Socket::getLocalAddress() {
     }
     if (m_family == AF_UNIX) {
         UnixAddress::ptr addr = std::dynamic_pointer_cast<UnixAddress>(result);
-        addr->setAddrLen(addrlen);
+        addr->setAddrlen(addrlen);
     }
     m_localAddress = result;
     return m_localAddress;
@@ -526,14 +536,71 @@ std::ostream &operator<<(std::ostream &os, const Socket &sock) {
     return sock.dump(os);
 }
 
+/**
+ * 非阻塞地连续accept，直到没有待接受的连接或者够了max个
+ * @param clients
+ * @param max
+ * @param recv_timeout
+ * @return
+ */
+int Socket::acceptBatch (std::vector<Socket::ptr>& clients, size_t max, uint64_t recv_timeout){
+    FdManager *mgr = FdMgr::GetInstance();
+    int count = 0;
+    while ((size_t)count < max) {
+        sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        //用原始的accept4，没有连接时直接返回EAGAIN而不是挂起协程
+        int newsock = accept4_f(m_sock, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (newsock == -1) {
+            //连接在accept之前就被对端重置了，接着取下一个
+            if (errno == ECONNABORTED || errno == EINTR) continue;
+            if (count > 0) break;
+            if (errno != EAGAIN) {
+                LIBCOCAO_LOG_DEBUG(g_logger) << "accept4(" << m_sock << ") errno="
+                                             << errno << " errstr=" << strerror (errno);
+            }
+            return errno == EAGAIN ? 0 : -1;
+        }
+        //号码可能被复用过，先丢掉残留的FdCtx
+        if (mgr->get(newsock)) mgr->del(newsock);
+        mgr->get(newsock, true);
+        {
+            FdManager::ReadLock lock(mgr);
+            FdCtx *ctx = mgr->get(newsock);
+            if (ctx) {
+                //SOCK_NONBLOCK是这里为了省掉fcntl加的，不是使用者要的非阻塞
+                ctx->setUserNonblock(false);
+                if (recv_timeout != (uint64_t)-1) ctx->setTimeoout(SO_RCVTIMEO, recv_timeout);
+            }
+        }
+        Socket::ptr sock (new Socket (m_family, m_type, m_protocol));
+        //unix socket的对端地址还是交给getpeername，保证得到UnixAddress
+        if (m_family == AF_INET || m_family == AF_INET6) {
+            sock->m_remoteAddress = Address::Create((sockaddr*)&addr, addrlen);
+        }
+        if (!sock->init(newsock)) {
+            ::close(newsock);
+            continue;
+        }
+        clients.push_back(sock);
+        ++ count;
+    }
+    return count;
+}
+
 /**
  * 初始化sock
  * @param sock
  * @return
  */
 bool Socket::init (int sock){
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
-    if (ctx && ctx->isSocket() && !ctx->isClose()) {
+    bool ok;
+    {
+        FdManager::ReadLock lock(FdMgr::GetInstance());
+        FdCtx* ctx = FdMgr::GetInstance()->get(sock);
+        ok = ctx && ctx->isSocket() && !ctx->isClose();
+    }
+    if (ok) {
         m_sock = sock;
         m_isConnected = true;
         initSock();
@@ -149,12 +149,26 @@ public:
      */
     virtual Socket::ptr accept ();
 
+    /**
+     * 非阻塞地接受连接，直到没有待接受的连接或者已经取满max个
+     * 用accept4一次带上SOCK_NONBLOCK|SOCK_CLOEXEC，对端地址也由accept4带回，
+     * 读超时直接记在FdCtx上，新连接不再单独fcntl和setsockopt。返回的Socket对hook来说仍是阻塞的
+     * @param clients 接受到的连接追加在后面
+     * @param max 最多接受的个数
+     * @param recv_timeout 新连接的读超时（毫秒），-1表示不设置
+     * @return 返回接受的个数，没有待接受的连接时返回0且errno为EAGAIN；
+     *         一个都没接受到就出错时返回-1，已经接受到一些时出错留到下次调用再报告
+     * Socket必须bind， listen成功，只在hook接管的线程里不会阻塞
+     */
+    int acceptBatch (std::vector<Socket::ptr>& clients, size_t max, uint64_t recv_timeout = -1);
+
     /**
      * 绑定地址
      * @param addr 地址
+     * @param reuse_port 是否设置SO_REUSEPORT，允许多个socket绑定同一个地址，由内核按连接分配
      * @return
      */
-    virtual bool bind (const Address::ptr addr);
+    virtual bool bind (const Address::ptr addr, bool reuse_port = false);
 
     /**
      * 连接地址
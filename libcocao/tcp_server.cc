@@ -1,5 +1,8 @@
 #include "tcp_server.h"
+#include <fcntl.h>
+#include <algorithm>
 #include "log.h"
+#include "hook.h"
 
 namespace libcocao {
 
@@ -19,8 +22,13 @@ TcpServer::TcpServer (libcocao::IOManager* io_worker
     , m_recvTimeout (5000)
     , m_name ("libcocao/1.0.1")
     , m_type ("tcp")
-    , m_isStop (true) {
-
+    , m_isStop (true)
+    , m_reusePort (false)
+    , m_maxConnections (0)
+    , m_acceptBatch (64)
+    , m_connections (0)
+    , m_dropped (0) {
+    m_reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 }
 
 /**
@@ -30,6 +38,7 @@ TcpServer::~TcpServer() {
     for (auto &i :m_socks)
         i->close();
     m_socks.clear();
+    if (m_reserveFd != -1) close_f(m_reserveFd);
 }
 
 /**
@@ -52,25 +61,35 @@ bool TcpServer::bind (libcocao::Address::ptr addr){
  */
 bool TcpServer::bind (const std::vector<Address::ptr>& addrs
         , std::vector<Address::ptr>& fails){
+    //每个线程一个监听socket时，为io_worker的每个线程绑定一次
+    std::vector<int> threads;
+    if (m_reusePort) threads = m_ioworker->getThreadIds();
+    if (threads.empty()) threads.push_back(-1);
+
     for (auto &addr : addrs) {
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        if (!sock->bind(addr)) {
-            LIBCOCAO_LOG_ERROR(g_logger) << "bind fail errno="
-                                         << errno << " errstr=" << strerror(errno)
-                                         << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if (!sock->listen()) {
-            LIBCOCAO_LOG_ERROR(g_logger) << "listen fail errno="
-                                         << errno << " errstr=" << strerror(errno)
-                                         << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        for (auto &thread : threads) {
+            Socket::ptr sock = Socket::CreateTCP(addr);
+            if (!sock->bind(addr, m_reusePort)) {
+                LIBCOCAO_LOG_ERROR(g_logger) << "bind fail errno="
+                                             << errno << " errstr=" << strerror(errno)
+                                             << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if (!sock->listen()) {
+                LIBCOCAO_LOG_ERROR(g_logger) << "listen fail errno="
+                                             << errno << " errstr=" << strerror(errno)
+                                             << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            m_socks.push_back(sock);
+            m_sockThreads.push_back(thread);
         }
     }
     if (!fails.empty()) {
         m_socks.clear();
+        m_sockThreads.clear();
         return false;
     }
 
@@ -90,8 +109,13 @@ bool TcpServer::start (){
     if (!m_isStop)
         return true;
     m_isStop = false;
-    for (auto & sock: m_socks) {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
+    for (size_t i = 0; i < m_socks.size(); ++ i) {
+        if (m_sockThreads[i] != -1) {
+            m_ioworker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]),
+                                 m_sockThreads[i]);
+        } else {
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_socks[i]));
+        }
     }
     return true;
 }
@@ -102,13 +126,27 @@ bool TcpServer::start (){
 void TcpServer::stop(){
     m_isStop = true;
     auto self = shared_from_this();
-    m_acceptWorker->schedule([this, self]() {
+    //监听socket的事件注册在accept所在的调度器上，要在那里取消
+    IOManager *worker = m_reusePort ? m_ioworker : m_acceptWorker;
+    worker->schedule([this, self]() {
         for (auto& sock : m_socks) {
             sock->cancelAll();
             sock->close();
         }
         m_socks.clear();
+        m_sockThreads.clear();
     });
+    Mutex::Lock lock(m_mutex);
+    m_paused.clear();
+}
+
+/**
+ * 设置最大并发连接数
+ */
+void TcpServer::setMaxConnections (uint64_t v){
+    m_maxConnections = v;
+    //上限调高或取消后，暂停的accept循环不必等到有连接结束
+    resumeAccept();
 }
 
 /**
@@ -140,21 +178,130 @@ void TcpServer::handleClient (Socket::ptr client){
 
 /**
  * 开始接受连接
+ * @details 监听socket可读后一直accept4到EAGAIN或者取满一轮，再一起交给io_worker，然后等下一次可读
  * @param sock
  */
 void TcpServer::startAccept (Socket::ptr sock){
+    IOManager *iom = IOManager::GetThis();
+    //每个线程各自accept时，新连接留在本线程处理，不跨线程交接
+    int thread = m_reusePort ? libcocao::GetThreadId() : -1;
+    std::vector<Socket::ptr> clients;
     while (!m_isStop) {
-        Socket::ptr client = sock->accept();
-        if (client) {
-            client->setRecvTimeout(m_recvTimeout);
-            m_ioworker->schedule(std::bind(&TcpServer::handleClient,
-                                           shared_from_this(), client));
+        size_t batch = m_acceptBatch;
+        uint64_t max = m_maxConnections;
+        if (max) {
+            uint64_t n = m_connections;
+            if (n >= max) {
+                if (pauseAccept(sock, thread)) return;
+                continue;
+            }
+            batch = std::min<uint64_t>(batch, max - n);
+        }
+
+        clients.clear();
+        int rt = sock->acceptBatch(clients, batch, m_recvTimeout);
+        for (auto &client : clients) {
+            ++ m_connections;
+            m_ioworker->schedule(std::bind(&TcpServer::runClient,
+                                           shared_from_this(), client), thread);
+        }
+        //取满一轮说明backlog里可能还有，不等可读直接接着取
+        if (rt > 0 && (size_t)rt == batch) continue;
+        if (rt == -1) {
+            if (m_isStop) break;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (shedConnection(sock)) continue;
+            } else {
+                LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "accept errno=" << errno
+                    << " errstr=" << strerror(errno);
+            }
+        }
+        //stop()里的cancelAll也会让这里返回
+        if (iom->waitEvent(sock->getSocket(), IOManager::READ, -1)) {
+            if (!m_isStop) {
+                LIBCOCAO_LOG_ERROR(g_logger) << "wait accept errno=" << errno
+                    << " errstr=" << strerror(errno) << " sock=" << *sock;
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * 处理一个连接并在结束后归还连接数
+ */
+void TcpServer::runClient (Socket::ptr client){
+    handleClient(client);
+    -- m_connections;
+    if (m_maxConnections) resumeAccept();
+}
+
+/**
+ * 登记暂停的accept循环
+ */
+bool TcpServer::pauseAccept (Socket::ptr sock, int thread){
+    Mutex::Lock lock(m_mutex);
+    //runClient先减连接数再加锁取m_paused，这里加锁后再看一次就不会错过恢复
+    if (m_connections < m_maxConnections || m_isStop) return false;
+    m_paused.push_back(std::make_pair(sock, thread));
+    LIBCOCAO_LOG_WARN_LIMIT(g_logger, 10, 1000) << "accept paused, connections="
+        << m_connections << " max_connections=" << m_maxConnections << " sock=" << *sock;
+    return true;
+}
+
+/**
+ * 重新调度所有暂停的accept循环，回到它们原来所在的线程或accept_worker
+ */
+void TcpServer::resumeAccept (){
+    std::vector<std::pair<Socket::ptr, int>> paused;
+    {
+        Mutex::Lock lock(m_mutex);
+        if (m_paused.empty() || m_isStop) return;
+        paused.swap(m_paused);
+    }
+    for (auto &i : paused) {
+        if (i.second != -1) {
+            m_ioworker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), i.first),
+                                 i.second);
         } else {
-            LIBCOCAO_LOG_ERROR(g_logger) << "accept errno=" << errno
-                << " errstr=" << strerror(errno);
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), i.first));
         }
     }
 }
 
+/**
+ * fd耗尽时接受并关闭一个连接
+ */
+bool TcpServer::shedConnection (Socket::ptr sock){
+    Mutex::Lock lock(m_mutex);
+    if (m_reserveFd == -1) {
+        //预留的fd上次没能重新打开，只能等其他连接释放fd
+        m_reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (m_reserveFd == -1) {
+            LIBCOCAO_LOG_ERROR_LIMIT(g_logger, 10, 1000) << "accept errno=" << errno
+                << " errstr=" << strerror(errno) << ", no reserve fd";
+            lock.unlock();
+            //listen socket一直可读，不能等可读事件，睡一会儿再试
+            usleep(10 * 1000);
+            return true;
+        }
+    }
+    close_f(m_reserveFd);
+    int fd = accept4_f(sock->getSocket(), nullptr, nullptr, SOCK_CLOEXEC);
+    int err = errno;
+    if (fd != -1) {
+        close_f(fd);
+        ++ m_dropped;
+    }
+    m_reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        //accept4先分配fd再看backlog，backlog空了也报EMFILE，不能接着转
+        return err != EAGAIN && err != EWOULDBLOCK;
+    }
+    LIBCOCAO_LOG_WARN_LIMIT(g_logger, 10, 1000) << "too many open files, connection dropped, dropped="
+        << m_dropped << " connections=" << m_connections;
+    return true;
+}
+
 
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
 #include "iomanager.h"
 #include "socket.h"
 #include "noncopyable.h"
@@ -79,6 +80,53 @@ public:
       */
      virtual void setName (const std::string &v) { m_name = v;}
 
+     /**
+      * 设置是否每个线程一个监听socket，需要在bind之前设置
+      * 打开后bind为io_worker的每个线程各建一个SO_REUSEPORT的监听socket，由内核把连接分给它们，
+      * 每个线程在自己的socket上accept，新连接也留在这个线程处理，不再经过accept_worker。
+      * io_worker使用PER_THREAD_EPOLL时连接的读写也一直在这个线程上
+      * @param v
+      */
+     void setReusePort (bool v) { m_reusePort = v; }
+
+     /**
+      * 是否每个线程一个监听socket
+      */
+     bool isReusePort () const { return m_reusePort; }
+
+     /**
+      * 设置最大并发连接数，0表示不限制
+      * 连接数达到上限时accept循环暂停，新连接留在内核的backlog里，有连接处理完(handleClient返回)后再恢复
+      * @param v
+      */
+     void setMaxConnections (uint64_t v);
+
+     /**
+      * 返回最大并发连接数
+      */
+     uint64_t getMaxConnections () const { return m_maxConnections; }
+
+     /**
+      * 返回当前正在处理的连接数
+      */
+     uint64_t getConnections () const { return m_connections; }
+
+     /**
+      * 设置accept循环每轮最多接受的连接数，每轮结束后才把连接交给io_worker
+      * @param v
+      */
+     void setAcceptBatch (size_t v) { m_acceptBatch = v ? v : 1; }
+
+     /**
+      * 返回accept循环每轮最多接受的连接数
+      */
+     size_t getAcceptBatch () const { return m_acceptBatch; }
+
+     /**
+      * 返回因为fd耗尽(EMFILE/ENFILE)被直接关闭的连接数
+      */
+     uint64_t getDropped () const { return m_dropped; }
+
      /**
       * 以字符串形式dump server信息
       * @param prefix
@@ -99,9 +147,38 @@ protected:
      */
     virtual void startAccept (Socket::ptr sock);
 
+private:
+    /**
+     * 处理一个连接并在结束后归还连接数
+     */
+    void runClient (Socket::ptr client);
+
+    /**
+     * 连接数达到上限时登记暂停的accept循环
+     * @param sock 监听Socket
+     * @param thread accept循环所在的线程，-1表示在accept_worker上
+     * @return 登记成功返回true，accept循环应当退出；加锁后发现已有空位返回false
+     */
+    bool pauseAccept (Socket::ptr sock, int thread);
+
+    /**
+     * 重新调度所有暂停的accept循环
+     */
+    void resumeAccept ();
+
+    /**
+     * fd耗尽时用预留的fd接受一个连接并立即关闭，让对端马上得到结果，
+     * 而不是一直留在backlog里让listen socket保持可读、accept循环空转
+     * @param sock 监听Socket
+     * @return backlog已经空了返回false，这时accept4仍会报EMFILE，要等可读再来
+     */
+    bool shedConnection (Socket::ptr sock);
+
 protected:
     /// 监听Socket数组
     std::vector<Socket::ptr> m_socks;
+    /// 和m_socks一一对应，监听Socket绑定在io_worker的哪个线程上，-1表示在accept_worker上accept
+    std::vector<int> m_sockThreads;
     /// 新连接的Socket工作的调度器
     IOManager *m_ioworker;
     /// 服务器Socket接收连接的调度器
@@ -114,6 +191,22 @@ protected:
     std::string m_type;
     /// 服务是否停止
     bool m_isStop;
+    /// 是否每个线程一个监听socket
+    bool m_reusePort;
+    /// 最大并发连接数，0表示不限制
+    std::atomic<uint64_t> m_maxConnections;
+    /// accept循环每轮最多接受的连接数
+    size_t m_acceptBatch;
+    /// 当前正在处理的连接数
+    std::atomic<uint64_t> m_connections;
+    /// 因为fd耗尽被直接关闭的连接数
+    std::atomic<uint64_t> m_dropped;
+    /// 预留的fd，打开的是/dev/null，fd耗尽时让出来接受并关闭一个连接
+    int m_reserveFd;
+    /// 保护m_paused和m_reserveFd
+    Mutex m_mutex;
+    /// 因为连接数达到上限而暂停的accept循环，和所在的线程
+    std::vector<std::pair<Socket::ptr, int>> m_paused;
 
 };
 
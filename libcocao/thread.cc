@@ -40,7 +40,10 @@ const std::string& Thread::getName() const {
 }
 
 void Thread::join() {
-    if (m_thread) pthread_join(m_thread, nullptr);
+    if (m_thread) {
+        pthread_join(m_thread, nullptr);
+        m_thread = 0;
+    }
 }
 
 void* Thread::run(void *arg) {
@@ -1,38 +1,31 @@
 #include "timer.h"
 #include "log.h"
+#include <string.h>
+#include <algorithm>
 
 namespace libcocao{
 
-bool Timer::Comparator::operator() (const Timer::ptr& lhs, const Timer::ptr& rhs) const {
-    if (!lhs && !rhs) return false;
-    if (!lhs) return true;
-    if (!rhs) return false;
-
-    if (lhs->m_next < rhs->m_next) return true;
-    if (lhs->m_next > rhs->m_next) return false;
-
-    return lhs.get() < rhs.get();
-}
-
-
-Timer::Timer(uint64_t) {
+//us向上取整到时间轮的1ms刻度，保证不会提前触发
+static inline uint64_t ToTick(uint64_t us) {
+    return (us + 999) / 1000;
 }
 
+//定时器的到期时间从现取的时钟算：线程上一个任务可能跑了很久，idle里缓存的时间已经过时，
+//拿它算会让定时器提前触发。只有idle刚刷新过缓存之后的listExpiredCb和getNextTimer用缓存
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
+Timer::Timer(uint64_t us, std::function<void()> cb, bool recurring, TimerManager* manager)
     : m_recurring(recurring)
-    , m_ms(ms)
+    , m_us(us)
     , m_cb(cb)
     , m_manager(manager){
-        m_next = libcocao::GetCurrentMS() + ms;
+        m_next = libcocao::GetMonotonicUS() + us;
 }
 
 bool Timer::cancel() {
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if(m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        m_manager->eraseTimer(shared_from_this());
         return true;
     }
     return false;
@@ -41,77 +34,112 @@ bool Timer::cancel() {
 bool Timer::refresh() {
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if (!m_cb) return false;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) return false;
-    m_manager->m_timers.erase(it);
-    m_next = libcocao::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    if (!m_manager->eraseTimer(shared_from_this())) return false;
+    m_next = libcocao::GetMonotonicUS() + m_us;
+    m_manager->insertTimer(shared_from_this());
     return true;
 }
 
 bool Timer::reset(uint64_t ms, bool from_now) {
-    if (ms == m_ms && !from_now) return true;
+    uint64_t us = ms * 1000;
+    if (us == m_us && !from_now) return true;
     TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
     if (!m_cb) return false;
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) return false;
-    m_manager->m_timers.erase(it);
+    if (!m_manager->eraseTimer(shared_from_this())) return false;
     uint64_t start = 0;
-    if (from_now) start = libcocao::GetCurrentMS();
-    else start = m_next - m_ms;
-    m_ms = ms;
-    m_next = start + m_ms;
+    if (from_now) start = libcocao::GetMonotonicUS();
+    else start = m_next - m_us;
+    m_us = us;
+    m_next = start + m_us;
     m_manager->addTimer(shared_from_this(), lock);
     return true;
 }
 
-TimerManager::TimerManager() {
-    m_pteviouseTime = libcocao::GetCurrentMS();
+void Timer::restart(uint64_t us, std::function<void()> cb) {
+    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    if (m_cb) m_manager->eraseTimer(shared_from_this());
+    //换下来的旧回调随参数在放锁后析构
+    m_cb.swap(cb);
+    m_us = us;
+    m_next = libcocao::GetMonotonicUS() + us;
+    m_manager->addTimer(shared_from_this(), lock);
+}
+
+TimerManager::TimerManager(Type type)
+    : m_type(type) {
+    memset(m_wheelRoot, 0, sizeof m_wheelRoot);
+    memset(m_wheelLevels, 0, sizeof m_wheelLevels);
+    m_wheelTime = libcocao::GetMonotonicMS();
 }
 
 TimerManager::~TimerManager() {
+    //时间轮和堆里的定时器持有自己，这里打断引用
+    std::vector<Timer::ptr> timers;
+    wheelExpired(0, true, timers);
+    for (auto& i : m_heap) {
+        i->m_heapIndex = -1;
+        timers.push_back(std::move(i->m_self));
+    }
+    m_heap.clear();
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()>cb, bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    return addTimerUS(ms * 1000, cb, recurring);
+}
+
+Timer::ptr TimerManager::addTimerUS(uint64_t us, std::function<void()>cb, bool recurring) {
+    Timer::ptr timer(new Timer(us, cb, recurring, this));
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     return timer;
 }
 
+Timer::ptr TimerManager::createTimer() {
+    return Timer::ptr(new Timer(0, nullptr, false, this));
+}
+
 uint64_t TimerManager::getNextTimer() {
+    if (m_type == WHEEL) {
+        RWMutexType::WriteLock lock(m_mutex);
+        m_tickled = false;
+        return wheelNextTimer(libcocao::GetCachedMonotonicUS());
+    }
+
     RWMutexType::ReadLock lock(m_mutex);
     m_tickled = false;
-    if (m_timers.empty()) return ~0ull;
+    if (m_heap.empty()) return ~0ull;
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = libcocao::GetCurrentMS();
-    if (now_ms > next->m_next) return 0;
-    else return next->m_next - now_ms;
+    const Timer* next = m_heap.front();
+    uint64_t now_us = libcocao::GetCachedMonotonicUS();
+    if (now_us >= next->m_next) return 0;
+    else return ToTick(next->m_next - now_us);
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
-    uint64_t now_ms = libcocao::GetCurrentMS();
+    uint64_t now_us = libcocao::GetCachedMonotonicUS();
     std::vector<Timer::ptr> expired;
     {
         RWMutexType::ReadLock lock(m_mutex);
-        if (m_timers.empty()) return;
+        if (m_type == WHEEL ? m_wheelCount == 0 : m_heap.empty()) return;
     }
     RWMutexType::WriteLock lock(m_mutex);
-    bool rollover = detectClockRollover(now_ms);
-    if (!rollover && ((*m_timers.begin())->m_next == now_ms)) return;
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) ++it;
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
+    if (m_type == WHEEL) {
+        wheelExpired(now_us, false, expired);
+    } else {
+        if (m_heap.empty() || m_heap.front()->m_next > now_us) return;
+        while (!m_heap.empty() && m_heap.front()->m_next <= now_us) {
+            Timer* timer = m_heap.front();
+            expired.push_back(timer->m_self);
+            heapRemove(timer);
+        }
+    }
     cbs.reserve(expired.size());
 
     for (auto& timer:expired) {
         cbs.push_back(timer->m_cb);
         if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            timer->m_next = now_us + timer->m_us;
+            insertTimer(timer);
         } else {
             timer->m_cb = nullptr;
         }
@@ -119,18 +147,197 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
 }
 
 void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock &lock) {
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin() && !m_tickled);
+    bool at_front = insertTimer(val) && !m_tickled;
     if (at_front) m_tickled = true;
     lock.unlock();
     if (at_front) onTimerInsertAtFront();
 }
 
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if (now_ms < m_pteviouseTime && now_ms < (m_pteviouseTime - 60 * 60 * 1000)) rollover = true;
-    m_pteviouseTime = now_ms;
-    return rollover;
+bool TimerManager::insertTimer(Timer::ptr val) {
+    val->m_self = val;
+    if (m_type == WHEEL) {
+        wheelAdd(val.get());
+        return ToTick(val->m_next) < m_wheelNext;
+    }
+    heapAdd(val.get());
+    return val->m_heapIndex == 0;
+}
+
+bool TimerManager::eraseTimer(Timer::ptr val) {
+    if (m_type == WHEEL) {
+        if (!val->m_slot) return false;
+        wheelRemove(val.get());
+        return true;
+    }
+    if (val->m_heapIndex == (size_t)-1) return false;
+    heapRemove(val.get());
+    return true;
+}
+
+void TimerManager::heapAdd(Timer* timer) {
+    timer->m_heapIndex = m_heap.size();
+    m_heap.push_back(timer);
+    heapUp(timer->m_heapIndex);
+}
+
+void TimerManager::heapRemove(Timer* timer) {
+    size_t index = timer->m_heapIndex;
+    Timer* last = m_heap.back();
+    m_heap.pop_back();
+    if (last != timer) {
+        //用最后一个补位，它可能比父节点早也可能比子节点晚
+        m_heap[index] = last;
+        last->m_heapIndex = index;
+        heapUp(index);
+        heapDown(last->m_heapIndex);
+    }
+    timer->m_heapIndex = -1;
+    //可能是最后一个引用，放在最后
+    timer->m_self.reset();
+}
+
+void TimerManager::heapUp(size_t index) {
+    Timer* timer = m_heap[index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (m_heap[parent]->m_next <= timer->m_next) break;
+        m_heap[index] = m_heap[parent];
+        m_heap[index]->m_heapIndex = index;
+        index = parent;
+    }
+    m_heap[index] = timer;
+    timer->m_heapIndex = index;
+}
+
+void TimerManager::heapDown(size_t index) {
+    Timer* timer = m_heap[index];
+    size_t size = m_heap.size();
+    while (true) {
+        size_t child = index * 2 + 1;
+        if (child >= size) break;
+        if (child + 1 < size && m_heap[child + 1]->m_next < m_heap[child]->m_next) ++ child;
+        if (timer->m_next <= m_heap[child]->m_next) break;
+        m_heap[index] = m_heap[child];
+        m_heap[index]->m_heapIndex = index;
+        index = child;
+    }
+    m_heap[index] = timer;
+    timer->m_heapIndex = index;
+}
+
+void TimerManager::wheelAdd(Timer* timer) {
+    //轮子空着时把基准拉到当前时间，避免之后空转追赶
+    if (m_wheelCount == 0) {
+        m_wheelTime = std::max(m_wheelTime, (timer->m_next - timer->m_us) / 1000);
+    }
+    uint64_t expires = std::max(ToTick(timer->m_next), m_wheelTime);
+    uint64_t delta = expires - m_wheelTime;
+    Timer** slot = nullptr;
+    if (delta < WHEEL_ROOT_SLOTS) {
+        slot = &m_wheelRoot[expires & (WHEEL_ROOT_SLOTS - 1)];
+    } else {
+        static const uint64_t s_max_delta = 1ull << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS);
+        if (delta >= s_max_delta) {
+            //超出范围的放到最远的槽，转到时再重新分配
+            expires = m_wheelTime + s_max_delta - 1;
+            delta = s_max_delta - 1;
+        }
+        int level = 0;
+        while (delta >= (1ull << (WHEEL_ROOT_BITS + (level + 1) * WHEEL_LEVEL_BITS))) ++ level;
+        int shift = WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS;
+        slot = &m_wheelLevels[level][(expires >> shift) & (WHEEL_LEVEL_SLOTS - 1)];
+    }
+
+    timer->m_prevNode = nullptr;
+    timer->m_nextNode = *slot;
+    if (*slot) (*slot)->m_prevNode = timer;
+    *slot = timer;
+    timer->m_slot = slot;
+    ++ m_wheelCount;
+}
+
+void TimerManager::wheelRemove(Timer* timer) {
+    if (timer->m_prevNode) {
+        timer->m_prevNode->m_nextNode = timer->m_nextNode;
+    } else {
+        *timer->m_slot = timer->m_nextNode;
+    }
+    if (timer->m_nextNode) timer->m_nextNode->m_prevNode = timer->m_prevNode;
+    timer->m_prevNode = timer->m_nextNode = nullptr;
+    timer->m_slot = nullptr;
+    -- m_wheelCount;
+    //可能是最后一个引用，放在最后
+    timer->m_self.reset();
+}
+
+void TimerManager::wheelCascade(int level, int index) {
+    Timer* timer = m_wheelLevels[level][index];
+    m_wheelLevels[level][index] = nullptr;
+    while (timer) {
+        Timer* next = timer->m_nextNode;
+        -- m_wheelCount;
+        wheelAdd(timer);
+        timer = next;
+    }
+}
+
+void TimerManager::wheelExpired(uint64_t now_us, bool all, std::vector<Timer::ptr>& expired) {
+    uint64_t now_ms = now_us / 1000;
+    auto take = [this, &expired](Timer** slot) {
+        Timer* timer = *slot;
+        *slot = nullptr;
+        while (timer) {
+            Timer* next = timer->m_nextNode;
+            timer->m_prevNode = timer->m_nextNode = nullptr;
+            timer->m_slot = nullptr;
+            -- m_wheelCount;
+            expired.push_back(std::move(timer->m_self));
+            timer = next;
+        }
+    };
+
+    if (all) {
+        for (auto& i : m_wheelRoot) take(&i);
+        for (auto& level : m_wheelLevels) {
+            for (auto& i : level) take(&i);
+        }
+        m_wheelTime = std::max(m_wheelTime, now_ms + 1);
+        return;
+    }
+
+    while (m_wheelCount && m_wheelTime <= now_ms) {
+        int index = m_wheelTime & (WHEEL_ROOT_SLOTS - 1);
+        if (index == 0) {
+            //第0层转完一圈，把上层对应的槽拆下来重新分配
+            for (int level = 0; level < WHEEL_LEVELS; ++ level) {
+                int i = (m_wheelTime >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & (WHEEL_LEVEL_SLOTS - 1);
+                wheelCascade(level, i);
+                if (i) break;
+            }
+        }
+        take(&m_wheelRoot[index]);
+        ++ m_wheelTime;
+    }
+    if (!m_wheelCount) {
+        m_wheelTime = std::max(m_wheelTime, now_ms + 1);
+    }
+}
+
+uint64_t TimerManager::wheelNextTimer(uint64_t now_us) {
+    if (!m_wheelCount) {
+        m_wheelNext = ~0ull;
+        return ~0ull;
+    }
+    //上层的定时器最早在第0层转完这一圈时才会落下来
+    uint64_t next = (m_wheelTime | (WHEEL_ROOT_SLOTS - 1)) + 1;
+    for (uint64_t t = m_wheelTime; t < next; ++ t) {
+        if (m_wheelRoot[t & (WHEEL_ROOT_SLOTS - 1)]) {
+            next = t;
+            break;
+        }
+    }
+    m_wheelNext = next;
+    return now_us >= next * 1000 ? 0 : ToTick(next * 1000 - now_us);
 }
 
 void TimerManager::onTimerInsertAtFront() {
@@ -1 +1 @@
-#ifndef __LIBCOCAO_TIMER_H__#define __LIBCOCAO_TIMER_H__#include <iostream>#include <functional>#include <memory>#include <set>#include "thread.h"namespace libcocao {class TimerManager;class Timer: public std::enable_shared_from_this<Timer> {friend class TimerManager;public:    typedef std::shared_ptr<Timer> ptr;    bool cancel();    bool refresh();    bool reset(uint64_t ms, bool from_now);private:    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);    Timer(uint64_t);private:    bool m_recurring = false;    uint64_t m_ms = 0;    uint64_t m_next = 0;    std::function<void()> m_cb;    TimerManager* m_manager = nullptr;private:    struct Comparator {        bool operator() (const Timer::ptr& lhs, const Timer::ptr& rhs) const;    };};class TimerManager {friend class Timer;public:    typedef RWMutex RWMutexType;    TimerManager();    virtual ~TimerManager();    Timer::ptr addTimer(uint64_t ms, std::function<void()>cb, bool recurring = false);    uint64_t getNextTimer();    void listExpiredCb(std::vector<std::function<void()>>& cbs);    Timer::ptr addConditionTimer (uint64_t ms, std::function<void()> cb,                                  std::weak_ptr<void> weak_cond, bool recurring = false);protected:    virtual void onTimerInsertAtFront() = 0;    void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);private:    bool detectClockRollover(uint64_t now_ms);private:    RWMutexType m_mutex;    std::set<Timer::ptr, Timer::Comparator> m_timers;    bool m_tickled = false;    uint64_t m_pteviouseTime = 0;};}#endif
\ No newline at end of file
+#ifndef __LIBCOCAO_TIMER_H__#define __LIBCOCAO_TIMER_H__#include <iostream>#include <functional>#include <memory>#include <vector>#include "thread.h"namespace libcocao {class TimerManager;class Timer: public std::enable_shared_from_this<Timer> {friend class TimerManager;public:    typedef std::shared_ptr<Timer> ptr;    bool cancel();    bool refresh();    bool reset(uint64_t ms, bool from_now);    /**     * @brief 重新启用定时器，已触发或已取消的也可以，换上新的回调     * @details 反复使用同一个定时器节点，重新计时不分配内存(cb能放进std::function的内部缓冲时)     * @param[in] us 从现在起多少微秒后触发     */    void restart(uint64_t us, std::function<void()> cb);private:    Timer(uint64_t us, std::function<void()> cb, bool recurring, TimerManager* manager);private:    bool m_recurring = false;    //周期，单位us    uint64_t m_us = 0;    //超时时刻，单调时钟，单位us    uint64_t m_next = 0;    std::function<void()> m_cb;    TimerManager* m_manager = nullptr;    //时间轮槽内的双向链表    Timer* m_prevNode = nullptr;    Timer* m_nextNode = nullptr;    //所在槽的链表头，不在时间轮里为nullptr    Timer** m_slot = nullptr;    //在最小堆里的下标，不在堆里为-1    size_t m_heapIndex = -1;    //在时间轮或最小堆里时持有自己    Timer::ptr m_self;};class TimerManager {friend class Timer;public:    typedef RWMutex RWMutexType;    /**     * @brief 定时器的组织方式     */    enum Type {        /// 按超时时间排序的最小堆，O(log n)，下标记在Timer里，插入删除不分配内存        HEAP = 0,        /// 旧名，当初是红黑树，留着兼容老代码，新代码用HEAP        SET = HEAP,        /// 分层时间轮，添加和取消O(1)，精度1ms        WHEEL = 1,    };    TimerManager(Type type = HEAP);    virtual ~TimerManager();    /**     * @brief 添加定时器     * @details 起点现取单调时钟，任务跑了多久都不影响超时时长     */    Timer::ptr addTimer(uint64_t ms, std::function<void()>cb, bool recurring = false);    //微秒精度的定时器，WHEEL会向上取整到1ms    Timer::ptr addTimerUS(uint64_t us, std::function<void()>cb, bool recurring = false);    //创建一个未启用的定时器，之后用Timer::restart()启用    Timer::ptr createTimer();    //距离最近一个定时器的毫秒数，向上取整，没有定时器返回~0ull    uint64_t getNextTimer();    void listExpiredCb(std::vector<std::function<void()>>& cbs);    Timer::ptr addConditionTimer (uint64_t ms, std::function<void()> cb,                                  std::weak_ptr<void> weak_cond, bool recurring = false);protected:    virtual void onTimerInsertAtFront() = 0;    void addTimer(Timer::ptr val, RWMutexType::WriteLock &lock);private:    bool insertTimer(Timer::ptr val);   //放入容器，返回是否是最早的，持有写锁时调用    bool eraseTimer(Timer::ptr val);    //从容器里移除，持有写锁时调用    void heapAdd(Timer* timer);    void heapRemove(Timer* timer);    void heapUp(size_t index);    void heapDown(size_t index);    void wheelAdd(Timer* timer);    void wheelRemove(Timer* timer);    void wheelCascade(int level, int index);    void wheelExpired(uint64_t now_us, bool all, std::vector<Timer::ptr>& expired);    uint64_t wheelNextTimer(uint64_t now_us);private:    enum {        WHEEL_ROOT_BITS = 8,        WHEEL_LEVEL_BITS = 6,        WHEEL_ROOT_SLOTS = 1 << WHEEL_ROOT_BITS,        WHEEL_LEVEL_SLOTS = 1 << WHEEL_LEVEL_BITS,        WHEEL_LEVELS = 4,    };    RWMutexType m_mutex;    Type m_type;    //m_next最小的在堆顶    std::vector<Timer*> m_heap;    bool m_tickled = false;    //时间轮：第0层256个1ms的槽，上面4层各64个槽，每个槽覆盖下一层一整圈    Timer* m_wheelRoot[WHEEL_ROOT_SLOTS];    Timer* m_wheelLevels[WHEEL_LEVELS][WHEEL_LEVEL_SLOTS];    //下一个要处理的毫秒    uint64_t m_wheelTime = 0;    size_t m_wheelCount = 0;    //最近一次getNextTimer给出的超时时刻(ms)，新定时器早于它才需要唤醒    uint64_t m_wheelNext = ~0ull;};}#endif
\ No newline at end of file
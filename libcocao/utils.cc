@@ -3,11 +3,15 @@
 #include <execinfo.h>
 #include "fiber.h"
 #include <sys/time.h>
+#include <time.h>
 
 namespace libcocao {
 
 pid_t GetThreadId() {
-    return syscall(SYS_gettid);
+    //每条日志都要取，缓存起来省掉系统调用
+    static thread_local pid_t t_tid = 0;
+    if (!t_tid) t_tid = syscall(SYS_gettid);
+    return t_tid;
 }
 
 uint32_t GetFiberId() {
@@ -26,5 +30,61 @@ uint64_t GetCurrentUS() {
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+uint64_t GetMonotonicMS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+uint64_t GetMonotonicUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+uint64_t GetMonotonicCoarseUS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+static thread_local uint64_t t_cached_us = 0;
+
+uint64_t GetCachedMonotonicUS() {
+    return t_cached_us ? t_cached_us : GetMonotonicUS();
+}
+
+uint64_t UpdateCachedMonotonicUS() {
+    t_cached_us = GetMonotonicUS();
+    return t_cached_us;
+}
+
+void ClearCachedMonotonic() {
+    t_cached_us = 0;
+}
+
+TimeFormatCache::TimeFormatCache(const std::string &format, bool utc)
+    : m_format(format)
+    , m_utc(utc) {
+}
+
+const char* TimeFormatCache::format(time_t sec, size_t &len) {
+    if (sec != m_sec) {
+        struct tm tm;
+        if (m_utc) gmtime_r(&sec, &tm);
+        else localtime_r(&sec, &tm);
+        m_len = strftime(m_buf, sizeof m_buf, m_format.c_str(), &tm);
+        m_sec = sec;
+    }
+    len = m_len;
+    return m_buf;
+}
+
+const char* GetHttpDate() {
+    static thread_local TimeFormatCache s_cache("%a, %d %b %Y %H:%M:%S GMT", true);
+    size_t len = 0;
+    return s_cache.format(time(0), len);
+}
+
 
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 #include <vector>
 #include <string>
 
@@ -18,6 +19,51 @@ uint32_t GetFiberId();
 uint64_t GetCurrentMS();
 uint64_t GetCurrentUS();
 
+//单调时钟，不受系统时间调整影响，定时器使用
+uint64_t GetMonotonicMS();
+uint64_t GetMonotonicUS();
+//粗粒度的单调时钟(us)，和上面同一个基准，精度是一个tick(1~4ms)，比精确的便宜
+uint64_t GetMonotonicCoarseUS();
+
+//线程缓存的单调时间(us)，事件循环每轮刷新，没有缓存时现取
+//线程执行任务期间不会刷新，只能用在刚刷新之后，不能拿来算到期时间或者计时
+uint64_t GetCachedMonotonicUS();
+//刷新当前线程的缓存并返回
+uint64_t UpdateCachedMonotonicUS();
+//清掉当前线程的缓存，之后的调用重新现取
+void ClearCachedMonotonic();
+
+/**
+ * @brief 按秒缓存的时间格式化
+ * @details 同一秒内重复格式化直接返回上次的结果，秒变了才调用localtime_r/gmtime_r和strftime，
+ *          省掉逐条的时区锁和strftime。不加锁，每个线程持有自己的一份
+ */
+class TimeFormatCache {
+public:
+    /**
+     * @param[in] format strftime格式
+     * @param[in] utc 是否按UTC格式化
+     */
+    TimeFormatCache(const std::string& format, bool utc = false);
+
+    /**
+     * @brief 格式化秒级时间
+     * @param[out] len 结果的长度
+     * @return 内部缓冲，下次调用前有效
+     */
+    const char* format(time_t sec, size_t& len);
+
+private:
+    std::string m_format;
+    bool m_utc;
+    time_t m_sec = -1;
+    char m_buf[64];
+    size_t m_len = 0;
+};
+
+//当前时间的HTTP Date头(RFC 7231)，每个线程每秒只格式化一次
+const char* GetHttpDate();
+
 
 }
 
@@ -0,0 +1,77 @@
+/**
+ * @file test_async_log.cc
+ * @brief 异步日志测试，多线程写文件后核对行数，并对比同步写的耗时
+ */
+#include "libcocao/libcocao.h"
+#include <fstream>
+#include <assert.h>
+
+static const char *s_file = "/tmp/test_async_log.txt";
+
+/**
+ * @brief 统计文件行数
+ */
+static size_t count_lines(const char *file) {
+    std::ifstream ifs(file);
+    std::string line;
+    size_t n = 0;
+    while (std::getline(ifs, line)) ++ n;
+    return n;
+}
+
+static uint64_t write_logs(libcocao::Logger::ptr logger, int threads, int count) {
+    uint64_t begin = libcocao::GetCurrentUS();
+    std::vector<libcocao::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([logger, count]() {
+            for (int j = 0; j < count; ++ j) {
+                LIBCOCAO_LOG_INFO(logger) << "async log line " << j;
+            }
+        }, "writer_" + std::to_string(i))));
+    }
+    for (auto &i : thrs) i->join();
+    return libcocao::GetCurrentUS() - begin;
+}
+
+void test_sync(int count) {
+    unlink(s_file);
+    uint64_t used;
+    {
+        libcocao::Logger::ptr logger(new libcocao::Logger("sync"));
+        logger->addAppender(libcocao::LoggerAppender::ptr(new libcocao::FileLogAppender(s_file)));
+        used = write_logs(logger, 1, count);
+    }
+    std::cout << "sync: " << used * 1000.0 / count << " ns/line" << std::endl;
+    //日志器析构时文件才刷完
+    assert(count_lines(s_file) == (size_t)count);
+}
+
+void test_async(libcocao::AsyncLogAppender::Overflow overflow, const char *name, int threads, int count) {
+    unlink(s_file);
+    libcocao::Logger::ptr logger(new libcocao::Logger("async"));
+    libcocao::AsyncLogAppender::ptr appender(new libcocao::AsyncLogAppender(
+            libcocao::LoggerAppender::ptr(new libcocao::FileLogAppender(s_file)), overflow, 64 * 1024, 8));
+    logger->addAppender(appender);
+    uint64_t used = write_logs(logger, threads, count);
+
+    //FATAL返回时之前的日志都应该已经落盘
+    LIBCOCAO_LOG_FATAL(logger) << "fatal";
+    size_t lines = count_lines(s_file);
+    bool total_ok = lines + appender->getDropped() == (size_t)threads * count + 1;
+    std::cout << name << ": threads=" << threads << " " << used * 1000.0 / (threads * count) << " ns/line"
+              << " written=" << lines << " dropped=" << appender->getDropped()
+              << " total_ok=" << total_ok << std::endl;
+    //每条要么落盘要么计入丢弃，BLOCK模式一条都不丢
+    assert(total_ok);
+    assert(overflow != libcocao::AsyncLogAppender::BLOCK || appender->getDropped() == 0);
+}
+
+int main() {
+    test_sync(200000);
+    test_async(libcocao::AsyncLogAppender::BLOCK, "block", 1, 200000);
+    test_async(libcocao::AsyncLogAppender::BLOCK, "block", 4, 200000);
+    test_async(libcocao::AsyncLogAppender::DROP, "drop", 4, 200000);
+    test_async(libcocao::AsyncLogAppender::SAMPLE, "sample", 4, 200000);
+    unlink(s_file);
+    return 0;
+}
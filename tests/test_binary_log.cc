@@ -0,0 +1,67 @@
+/**
+ * @file test_binary_log.cc
+ * @brief 二进制日志测试，检查参数还原成文本的结果，并对比二进制和文本两条路径的耗时
+ */
+#include "libcocao/libcocao.h"
+#include <assert.h>
+
+static const char *s_file = "/tmp/test_binary_log.bin";
+
+/**
+ * @brief 只保留最后一条格式化结果的输出地
+ */
+class CaptureLogAppender : public libcocao::LoggerAppender {
+public:
+    void log(libcocao::LogLevel::Level level, const libcocao::LogEvent &event) override {
+        m_last = m_formatter->format(level, event);
+    }
+    std::string m_last;
+};
+
+void test_render() {
+    libcocao::Logger::ptr logger(new libcocao::Logger("render"));
+    std::shared_ptr<CaptureLogAppender> capture(new CaptureLogAppender);
+    capture->setFormatter(libcocao::LogFormatter::ptr(new libcocao::LogFormatter("C")));
+    logger->addAppender(capture);
+
+    std::string name = "index.html";
+    LIBCOCAO_LOG_BIN_INFO(logger, "fd=%d size=%5lu ratio=%.2f path=%s %c %x 100%%", -3, 4096ul, 0.125, name, 'k', 255u);
+    char expect[256];
+    snprintf(expect, sizeof expect, "fd=%d size=%5lu ratio=%.2f path=%s %c %x 100%%\n",
+             -3, 4096ul, 0.125, name.c_str(), 'k', 255u);
+    std::cout << "render: " << (capture->m_last == expect ? "ok" : "mismatch") << " " << capture->m_last;
+    assert(capture->m_last == expect);
+
+    LIBCOCAO_LOG_BIN_INFO(logger, "missing %d %s", 1);
+    std::cout << "render missing arg: " << capture->m_last;
+    //缺的参数原样输出占位符
+    assert(capture->m_last == "missing 1 %s\n");
+}
+
+void bench(int count) {
+    unlink(s_file);
+    libcocao::Logger::ptr logger(new libcocao::Logger("binary"));
+    libcocao::BinaryLogAppender::ptr appender(new libcocao::BinaryLogAppender(s_file));
+    logger->addAppender(appender);
+
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < count; ++ i) {
+        LIBCOCAO_LOG_BIN_INFO(logger, "request done, fd=%d bytes=%lu cost=%.3fms", i, 4096ul, 1.5);
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    std::cout << "binary: " << used * 1000.0 / count << " ns/record" << std::endl;
+
+    begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < count; ++ i) {
+        LIBCOCAO_LOG_INFO(logger) << "request done, fd=" << i << " bytes=" << 4096ul << " cost=" << 1.5 << "ms";
+    }
+    used = libcocao::GetCurrentUS() - begin;
+    std::cout << "text into binary file: " << used * 1000.0 / count << " ns/record" << std::endl;
+    std::cout << "decode with: logdecode " << s_file << std::endl;
+}
+
+int main() {
+    test_render();
+    bench(1000000);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file test_channel.cc
+ * @brief 通道测试：单生产者单消费者吞吐、多生产者多消费者核对总和、关闭语义、select
+ */
+#include "libcocao/libcocao.h"
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+void test_spsc(size_t capacity, int count) {
+    libcocao::Channel<int> ch(capacity);
+    uint64_t sum = 0;
+    uint64_t begin = libcocao::GetCurrentUS();
+    {
+        libcocao::IOManager iom(2, false, "spsc");
+        iom.schedule([&]() {
+            for (int i = 1; i <= count; ++ i) ch.send(i);
+            ch.close();
+        });
+        iom.schedule([&]() {
+            int v;
+            while (ch.recv(v)) sum += v;
+        });
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    std::cout << "spsc: capacity=" << capacity << " sum_ok=" << (sum == (uint64_t)count * (count + 1) / 2)
+              << " " << used * 1000.0 / count << " ns/item" << std::endl;
+    assert(sum == (uint64_t)count * (count + 1) / 2);
+}
+
+void test_mpmc(int producers, int consumers, int count) {
+    libcocao::Channel<int> ch(64);
+    libcocao::Channel<int> done(producers);
+    std::atomic<uint64_t> sum{0};
+    {
+        libcocao::IOManager iom(4, false, "mpmc");
+        for (int i = 0; i < consumers; ++ i) {
+            iom.schedule([&]() {
+                int v;
+                while (ch.recv(v)) sum += v;
+            });
+        }
+        for (int i = 0; i < producers; ++ i) {
+            iom.schedule([&]() {
+                for (int j = 1; j <= count; ++ j) ch.send(j);
+                done.send(1);
+            });
+        }
+        //主线程不在调度器里，阻塞等所有生产者结束后关闭
+        int v;
+        for (int i = 0; i < producers; ++ i) done.recv(v);
+        ch.close();
+    }
+    std::cout << "mpmc: sum=" << sum << " expect=" << (uint64_t)producers * count * (count + 1) / 2 << std::endl;
+    assert(sum == (uint64_t)producers * count * (count + 1) / 2);
+}
+
+void test_close() {
+    libcocao::Channel<std::string> ch(2);
+    ch.send("a");
+    ch.send("b");
+    bool full = !ch.trySend("c");
+    ch.close();
+    bool send_closed = !ch.send("d");
+    std::string a, b, c;
+    bool drained = ch.recv(a) && ch.recv(b) && a == "a" && b == "b";
+    bool recv_closed = !ch.recv(c);
+    std::cout << "close: full=" << full << " send_closed=" << send_closed << " drained=" << drained
+              << " recv_closed=" << recv_closed << std::endl;
+    assert(full && send_closed && drained && recv_closed);
+}
+
+void test_select() {
+    libcocao::Channel<int> ints(1);
+    libcocao::Channel<std::string> strs(1);
+    libcocao::Channel<int> out(1);
+    int got_int = 0;
+    int got_str = 0;
+    int sent = 0;
+    {
+        libcocao::IOManager iom(2, false, "select");
+        iom.schedule([&]() {
+            for (int i = 0; i < 100; ++ i) {
+                ints.send(i);
+                usleep(100);
+            }
+            ints.close();
+        });
+        iom.schedule([&]() {
+            for (int i = 0; i < 100; ++ i) strs.send(std::to_string(i));
+            strs.close();
+        });
+        iom.schedule([&]() {
+            int v;
+            while (out.recv(v)) ;
+        });
+        iom.schedule([&]() {
+            libcocao::ChannelSelect sel;
+            sel.recv(ints, [&](int) { ++ got_int; })
+               .recv(strs, [&](const std::string &) { ++ got_str; })
+               .send(out, 1, [&]() { ++ sent; });
+            //两个输入都关闭后只剩out，再关掉它结束循环
+            while (got_int + got_str < 200 && sel.wait() >= 0);
+            out.close();
+        });
+    }
+    std::cout << "select: ints=" << got_int << " strs=" << got_str << " (expect 100 100) sent=" << sent << std::endl;
+    assert(got_int == 100 && got_str == 100);
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    test_spsc(1, 100000);
+    test_spsc(1024, 1000000);
+    test_mpmc(4, 4, 100000);
+    test_close();
+    test_select();
+    return 0;
+}
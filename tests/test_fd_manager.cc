@@ -0,0 +1,110 @@
+/**
+ * @file test_fd_manager.cc
+ * @brief FdManager测试：边界fd、查找与新建删除并发时不访问已释放的FdCtx、查找耗时
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <assert.h>
+
+/**
+ * @brief fd 0、超出范围的fd、删除后重建
+ */
+void test_basic() {
+    libcocao::FdManager mgr;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    bool ok;
+    {
+        libcocao::FdManager::ReadLock lock(&mgr);
+        ok = mgr.get(-1, true) == nullptr
+            && mgr.get(0, true) != nullptr
+            && mgr.get(1 << 30, true) == nullptr
+            && mgr.get(fds[0]) == nullptr
+            && mgr.get(fds[0], true) == mgr.get(fds[0])
+            && mgr.get(fds[0])->isSocket();
+    }
+    //del可能要等宽限期，不能在读区间里调用
+    mgr.del(fds[0]);
+    {
+        libcocao::FdManager::ReadLock lock(&mgr);
+        ok = ok && mgr.get(fds[0]) == nullptr && mgr.get(fds[0], true) != nullptr;
+    }
+    std::cout << "basic: ok=" << ok << std::endl;
+    assert(ok);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * @brief 读线程不停地查找并读取FdCtx，写线程反复删除再新建，核对读到的FdCtx始终有效
+ */
+void test_churn(int readers, int rounds) {
+    libcocao::FdManager mgr;
+    std::vector<int> fds;
+    for (int i = 0; i < 64; ++ i) {
+        int sv[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+        fds.push_back(sv[0]);
+        fds.push_back(sv[1]);
+        mgr.get(sv[0], true);
+        mgr.get(sv[1], true);
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> broken{0};
+    std::vector<libcocao::Thread::ptr> thrs;
+    for (int i = 0; i < readers; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([&]() {
+            uint64_t n = 0;
+            while (!stop) {
+                for (auto fd : fds) {
+                    libcocao::FdManager::ReadLock lock(&mgr);
+                    libcocao::FdCtx *ctx = mgr.get(fd);
+                    if (ctx && (!ctx->isSocket() || ctx->getTimeout(SO_RCVTIMEO) != (uint64_t)-1)) ++ broken;
+                    ++ n;
+                }
+            }
+            lookups += n;
+        }, "reader_" + std::to_string(i))));
+    }
+    for (int i = 0; i < rounds; ++ i) {
+        for (auto fd : fds) {
+            mgr.del(fd);
+            mgr.get(fd, true);
+        }
+    }
+    stop = true;
+    for (auto &i : thrs) i->join();
+    std::cout << "churn: rounds=" << rounds << " lookups=" << lookups << " broken=" << broken << std::endl;
+    assert(broken == 0 && lookups > 0);
+    for (auto fd : fds) close(fd);
+}
+
+/**
+ * @brief 单线程查找的平均耗时
+ */
+void bench_lookup(int count) {
+    libcocao::FdManager mgr;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    mgr.get(fds[0], true);
+    uint64_t hit = 0;
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < count; ++ i) {
+        libcocao::FdManager::ReadLock lock(&mgr);
+        libcocao::FdCtx *ctx = mgr.get(fds[0]);
+        if (ctx && ctx->isSocket()) ++ hit;
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    std::cout << "lookup: hit=" << hit << " " << used * 1000.0 / count << " ns/op" << std::endl;
+    assert(hit == (uint64_t)count);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main() {
+    test_basic();
+    test_churn(4, 2000);
+    bench_lookup(10000000);
+    return 0;
+}
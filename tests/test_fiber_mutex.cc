@@ -0,0 +1,169 @@
+/**
+ * @file test_fiber_mutex.cc
+ * @brief 协程同步原语测试：持锁的协程挂起时线程不被占住，跨线程唤醒，普通线程和协程混用
+ */
+#include "libcocao/libcocao.h"
+#include <deque>
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+/**
+ * @brief 单线程调度器里持锁睡眠，其他协程排队等锁，期间无关的协程仍然能跑
+ */
+void test_no_stall() {
+    libcocao::FiberMutex mutex;
+    std::atomic<int> ticks{0};
+    std::atomic<int> acquired{0};
+    //第一个等到锁时ticks的值，持锁睡眠没占住线程的话计时协程早已跑完
+    int ticks_at_acquire = -1;
+    uint64_t begin = libcocao::GetMonotonicMS();
+    {
+        libcocao::IOManager iom(1, false, "no_stall");
+        iom.schedule([&]() {
+            libcocao::FiberMutex::Lock lock(mutex);
+            usleep(100 * 1000);
+        });
+        for (int i = 0; i < 10; ++ i) {
+            iom.schedule([&]() {
+                libcocao::FiberMutex::Lock lock(mutex);
+                if (acquired ++ == 0) ticks_at_acquire = ticks;
+            });
+        }
+        iom.schedule([&]() {
+            for (int i = 0; i < 10; ++ i) {
+                ++ ticks;
+                usleep(5 * 1000);
+            }
+        });
+    }
+    std::cout << "no_stall: acquired=" << acquired << " (expect 10) ticks=" << ticks
+              << " (expect 10) ticks_at_acquire=" << ticks_at_acquire
+              << " (expect 10) used=" << libcocao::GetMonotonicMS() - begin << "ms" << std::endl;
+    assert(acquired == 10 && ticks == 10);
+    assert(ticks_at_acquire == 10);
+}
+
+/**
+ * @brief 多线程调度器里大量协程抢同一把锁，持锁时偶尔让出，再加一个普通线程一起抢
+ */
+void test_mutex(int fibers, int count) {
+    libcocao::FiberMutex mutex;
+    uint64_t value = 0;
+    uint64_t begin = libcocao::GetCurrentUS();
+    {
+        libcocao::IOManager iom(4, false, "mutex");
+        for (int i = 0; i < fibers; ++ i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < count; ++ j) {
+                    libcocao::FiberMutex::Lock lock(mutex);
+                    ++ value;
+                    if (j % 100 == 0) usleep(10);
+                }
+            });
+        }
+        for (int j = 0; j < count; ++ j) {
+            libcocao::FiberMutex::Lock lock(mutex);
+            ++ value;
+        }
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    std::cout << "mutex: value=" << value << " expect=" << (uint64_t)(fibers + 1) * count
+              << " " << used * 1000.0 / ((fibers + 1) * count) << " ns/lock" << std::endl;
+    assert(value == (uint64_t)(fibers + 1) * count);
+}
+
+/**
+ * @brief 条件变量和信号量做生产者消费者，核对总和
+ */
+void test_queue(int producers, int consumers, int count) {
+    libcocao::FiberMutex mutex;
+    libcocao::FiberCondVar cond;
+    libcocao::FiberSemaphore done;
+    std::deque<int> queue;
+    std::atomic<uint64_t> sum{0};
+    {
+        libcocao::IOManager iom(4, false, "queue");
+        for (int i = 0; i < consumers; ++ i) {
+            iom.schedule([&]() {
+                while (true) {
+                    libcocao::FiberMutex::Lock lock(mutex);
+                    cond.wait(mutex, [&queue]() { return !queue.empty(); });
+                    int v = queue.front();
+                    queue.pop_front();
+                    lock.unlock();
+                    if (v < 0) break;
+                    sum += v;
+                }
+                done.notify();
+            });
+        }
+        for (int i = 0; i < producers; ++ i) {
+            iom.schedule([&]() {
+                for (int j = 1; j <= count; ++ j) {
+                    libcocao::FiberMutex::Lock lock(mutex);
+                    queue.push_back(j);
+                    lock.unlock();
+                    cond.notifyOne();
+                }
+                done.notify();
+            });
+        }
+        //主线程不在调度器里，阻塞在信号量上
+        for (int i = 0; i < producers; ++ i) done.wait();
+        {
+            libcocao::FiberMutex::Lock lock(mutex);
+            for (int i = 0; i < consumers; ++ i) queue.push_back(-1);
+        }
+        cond.notifyAll();
+        for (int i = 0; i < consumers; ++ i) done.wait();
+    }
+    std::cout << "queue: sum=" << sum << " expect=" << (uint64_t)producers * count * (count + 1) / 2 << std::endl;
+    assert(sum == (uint64_t)producers * count * (count + 1) / 2);
+}
+
+/**
+ * @brief 写者持锁时睡眠让出，读者检查两个值始终相等
+ */
+void test_rwmutex(int readers, int writers, int count) {
+    libcocao::FiberRWMutex rwmutex;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    std::atomic<int> broken{0};
+    std::atomic<uint64_t> reads{0};
+    {
+        libcocao::IOManager iom(4, false, "rwmutex");
+        for (int i = 0; i < writers; ++ i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < count; ++ j) {
+                    libcocao::FiberRWMutex::WriteLock lock(rwmutex);
+                    ++ a;
+                    if (j % 10 == 0) usleep(10);
+                    ++ b;
+                }
+            });
+        }
+        for (int i = 0; i < readers; ++ i) {
+            iom.schedule([&]() {
+                for (int j = 0; j < count * 10; ++ j) {
+                    libcocao::FiberRWMutex::ReadLock lock(rwmutex);
+                    if (a != b) ++ broken;
+                    ++ reads;
+                }
+            });
+        }
+    }
+    std::cout << "rwmutex: a=" << a << " b=" << b << " expect=" << (uint64_t)writers * count
+              << " reads=" << reads << " broken=" << broken << std::endl;
+    assert(a == (uint64_t)writers * count && b == a);
+    assert(reads == (uint64_t)readers * count * 10 && broken == 0);
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    test_no_stall();
+    test_mutex(100, 10000);
+    test_queue(4, 4, 100000);
+    test_rwmutex(8, 4, 1000);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file test_fiber_switch.cc
+ * @brief 协程切换开销测试，对比当前编译选择的切换后端和ucontext
+ */
+#include "libcocao/libcocao.h"
+#include <ucontext.h>
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+static const int s_rounds = 1000000;
+
+static int s_yields = 0;
+
+void fiber_loop() {
+    for (int i = 0; i < s_rounds; ++ i) {
+        ++ s_yields;
+        libcocao::Fiber::GetThis()->yield();
+    }
+}
+
+/**
+ * @brief Fiber::resume()/yield()往返，每轮两次切换
+ */
+void bench_fiber() {
+    libcocao::Fiber::GetThis();
+    libcocao::Fiber::ptr fiber(new libcocao::Fiber(&fiber_loop));
+
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < s_rounds; ++ i) {
+        fiber->resume();
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    fiber->resume();
+
+    LIBCOCAO_LOG_INFO(g_logger) << "fiber(" << libcocao::ContextBackend() << "): "
+                                << used * 1000.0 / s_rounds / 2 << " ns/switch";
+    //每次resume都切进去跑了一轮，最后一次resume让协程正常结束
+    assert(s_yields == s_rounds);
+    assert(fiber->getState() == libcocao::Fiber::TERM);
+}
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_loop_ctx;
+
+void ucontext_loop() {
+    while (true) {
+        swapcontext(&s_loop_ctx, &s_main_ctx);
+    }
+}
+
+/**
+ * @brief 直接用swapcontext往返，作为对照
+ */
+void bench_ucontext() {
+    std::vector<char> stack(128 * 1024);
+    getcontext(&s_loop_ctx);
+    s_loop_ctx.uc_link = nullptr;
+    s_loop_ctx.uc_stack.ss_sp = &stack[0];
+    s_loop_ctx.uc_stack.ss_size = stack.size();
+    makecontext(&s_loop_ctx, &ucontext_loop, 0);
+
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < s_rounds; ++ i) {
+        swapcontext(&s_main_ctx, &s_loop_ctx);
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+
+    LIBCOCAO_LOG_INFO(g_logger) << "ucontext: " << used * 1000.0 / s_rounds / 2 << " ns/switch";
+}
+
+int main() {
+    bench_fiber();
+    bench_ucontext();
+    return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file test_file_log.cc
+ * @brief 文件日志测试：按大小切分和保留个数、外部挪走文件后重新打开、写入耗时
+ */
+#include "libcocao/libcocao.h"
+#include <dirent.h>
+#include <fstream>
+#include <algorithm>
+#include <assert.h>
+
+static const char *s_dir = "/tmp/test_file_log";
+
+static std::vector<std::string> list_files() {
+    std::vector<std::string> files;
+    DIR *d = opendir(s_dir);
+    if (!d) return files;
+    while (struct dirent *entry = readdir(d)) {
+        if (entry->d_name[0] != '.') files.push_back(entry->d_name);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static size_t count_lines(const std::string &file) {
+    std::ifstream ifs(file);
+    std::string line;
+    size_t n = 0;
+    while (std::getline(ifs, line)) ++ n;
+    return n;
+}
+
+static void clean() {
+    for (auto &i : list_files()) unlink((std::string(s_dir) + "/" + i).c_str());
+    mkdir(s_dir, 0755);
+}
+
+void test_rotate_size() {
+    clean();
+    std::string file = std::string(s_dir) + "/app.log";
+    libcocao::Logger::ptr logger(new libcocao::Logger("rotate"));
+    logger->addAppender(libcocao::LoggerAppender::ptr(new libcocao::FileLogAppender(file, 1024 * 1024, 0, 3)));
+
+    uint64_t begin = libcocao::GetCurrentUS();
+    const int count = 200000;
+    for (int i = 0; i < count; ++ i) {
+        LIBCOCAO_LOG_INFO(logger) << "rotate by size line " << i;
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    logger->clearAppenders();
+
+    auto files = list_files();
+    size_t max_size = 0;
+    for (auto &i : files) {
+        struct stat st;
+        stat((std::string(s_dir) + "/" + i).c_str(), &st);
+        max_size = std::max(max_size, (size_t)st.st_size);
+    }
+    std::cout << "rotate size: files=" << files.size() << " (expect 4) max_size=" << max_size
+              << " " << used * 1000.0 / count << " ns/line" << std::endl;
+    //当前文件加保留的3个切出来的文件，切分前不会超过上限
+    assert(files.size() == 4);
+    assert(max_size <= 1024 * 1024);
+}
+
+void test_external_rotate() {
+    clean();
+    std::string file = std::string(s_dir) + "/app.log";
+    libcocao::Logger::ptr logger(new libcocao::Logger("external"));
+    libcocao::FileLogAppender::ptr appender(new libcocao::FileLogAppender(file));
+    logger->addAppender(appender);
+
+    LIBCOCAO_LOG_INFO(logger) << "before move";
+    appender->flush();
+    rename(file.c_str(), (file + ".moved").c_str());
+    LIBCOCAO_LOG_INFO(logger) << "still into moved file";
+    //inode每几秒检查一次
+    sleep(6);
+    LIBCOCAO_LOG_INFO(logger) << "after reopen";
+    appender->flush();
+    std::cout << "external rotate: moved=" << count_lines(file + ".moved")
+              << " (expect 2) new=" << count_lines(file) << " (expect 1)" << std::endl;
+    assert(count_lines(file + ".moved") == 2);
+    assert(count_lines(file) == 1);
+}
+
+int main() {
+    test_rotate_size();
+    test_external_rotate();
+    clean();
+    rmdir(s_dir);
+    return 0;
+}
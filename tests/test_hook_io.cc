@@ -0,0 +1,213 @@
+/**
+ * @file test_hook_io.cc
+ * @brief poll/select/epoll_wait/eventfd/pipe/dup/accept4的hook测试
+ * @details 都在单线程的IOManager里跑，等待期间另一个协程的计数要能继续增长，说明线程没被阻塞
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+/**
+ * @brief 在单线程调度器里运行fn，同时跑一个每10ms计数一次的协程，返回fn期间的计数
+ * @details 等待100ms期间线程没被阻塞的话计数在10左右，被阻塞的话只有1
+ */
+static int run_with_ticker(const std::function<void()> &fn) {
+    std::atomic<int> ticks{0};
+    std::atomic<bool> done{false};
+    {
+        libcocao::IOManager iom(1, false, "hook_io");
+        iom.schedule([&]() {
+            fn();
+            done = true;
+        });
+        iom.schedule([&]() {
+            while (!done) {
+                usleep(10 * 1000);
+                ++ ticks;
+            }
+        });
+    }
+    return ticks;
+}
+
+void test_poll() {
+    int rt = -1;
+    short revents = 0;
+    int ticks = run_with_ticker([&]() {
+        int fds[2];
+        pipe(fds);
+        libcocao::IOManager::GetThis()->schedule([fds]() {
+            usleep(100 * 1000);
+            write(fds[1], "x", 1);
+        });
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        rt = poll(&pfd, 1, 1000);
+        revents = pfd.revents;
+        close(fds[0]);
+        close(fds[1]);
+    });
+    std::cout << "poll: rt=" << rt << " pollin=" << !!(revents & POLLIN)
+              << " ticks=" << ticks << " (expect ~10)" << std::endl;
+    assert(rt == 1 && (revents & POLLIN));
+    assert(ticks >= 5);
+}
+
+void test_select_timeout() {
+    int rt = -1;
+    uint64_t used = 0;
+    int ticks = run_with_ticker([&]() {
+        int fds[2];
+        pipe(fds);
+        fd_set rset;
+        FD_ZERO(&rset);
+        FD_SET(fds[0], &rset);
+        struct timeval tv = {0, 100 * 1000};
+        uint64_t begin = libcocao::GetMonotonicMS();
+        rt = select(fds[0] + 1, &rset, nullptr, nullptr, &tv);
+        used = libcocao::GetMonotonicMS() - begin;
+        close(fds[0]);
+        close(fds[1]);
+    });
+    std::cout << "select: rt=" << rt << " used=" << used << "ms (expect ~100) ticks=" << ticks << std::endl;
+    assert(rt == 0 && used >= 100);
+    assert(ticks >= 5);
+}
+
+void test_epoll_wait() {
+    int rt = -1;
+    int ticks = run_with_ticker([&]() {
+        int efd = eventfd(0, 0);
+        int epfd = epoll_create1(0);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = efd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev);
+        libcocao::IOManager::GetThis()->schedule([efd]() {
+            usleep(100 * 1000);
+            uint64_t v = 1;
+            write(efd, &v, sizeof(v));
+        });
+        struct epoll_event out[4];
+        rt = epoll_wait(epfd, out, 4, 1000);
+        close(epfd);
+        close(efd);
+    });
+    std::cout << "epoll_wait: rt=" << rt << " ticks=" << ticks << " (expect ~10)" << std::endl;
+    assert(rt == 1);
+    assert(ticks >= 5);
+}
+
+void test_eventfd_dup() {
+    uint64_t value = 0;
+    ssize_t n = 0;
+    int err = 0;
+    int ticks = run_with_ticker([&]() {
+        int efd = eventfd(0, 0);
+        int dfd = dup(efd);
+        libcocao::IOManager::GetThis()->schedule([efd]() {
+            usleep(100 * 1000);
+            uint64_t v = 42;
+            write(efd, &v, sizeof(v));
+        });
+        //从dup出来的fd上读，读完后在带超时的dup2副本上读应该超时
+        read(dfd, &value, sizeof(value));
+        int sfd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct timeval tv = {0, 50 * 1000};
+        setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        dup2(sfd, dfd);
+        char c;
+        n = recv(dfd, &c, 1, 0);
+        err = errno;
+        close(sfd);
+        close(dfd);
+        close(efd);
+    });
+    std::cout << "eventfd+dup: value=" << value << " (expect 42) dup2 recv=" << n
+              << " etimedout=" << (err == ETIMEDOUT) << " ticks=" << ticks << std::endl;
+    assert(value == 42);
+    assert(n == -1 && err == ETIMEDOUT);
+    assert(ticks >= 5);
+}
+
+void test_accept4() {
+    int rt = 0;
+    int err = 0;
+    run_with_ticker([&]() {
+        int lfd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(lfd, (sockaddr*)&addr, sizeof(addr));
+        listen(lfd, 16);
+        //监听socket是用户设置的非阻塞，accept4不挂起直接EAGAIN
+        int flags = fcntl(lfd, F_GETFL);
+        fcntl(lfd, F_SETFL, flags | O_NONBLOCK);
+        rt = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK);
+        err = errno;
+        close(lfd);
+    });
+    std::cout << "accept4: rt=" << rt << " eagain=" << (err == EAGAIN) << std::endl;
+    assert(rt == -1 && err == EAGAIN);
+}
+
+/**
+ * @brief pipe和eventfd上的阻塞读写，io_uring后端只对socket提交，这些fd要退回epoll
+ */
+void test_pipe_eventfd(libcocao::IOManager::Backend backend, const char *name) {
+    ssize_t wn = 0, rn = 0, en = 0;
+    int err = 0;
+    char buf[8] = {0};
+    uint64_t value = 0;
+    bool uring = false;
+    {
+        libcocao::IOManager iom(1, false, name, backend);
+        uring = iom.isUring();
+        iom.schedule([&]() {
+            int fds[2];
+            pipe(fds);
+            wn = write(fds[1], "hi", 2);
+            rn = read(fds[0], buf, sizeof(buf));
+            if (wn < 0 || rn < 0) err = errno;
+            close(fds[0]);
+            close(fds[1]);
+
+            //先挂起在读上，另一个协程写入后唤醒
+            int efd = eventfd(0, 0);
+            libcocao::IOManager::GetThis()->schedule([efd]() {
+                usleep(10 * 1000);
+                uint64_t v = 7;
+                write(efd, &v, sizeof(v));
+            });
+            en = read(efd, &value, sizeof(value));
+            close(efd);
+        });
+    }
+    if (backend == libcocao::IOManager::IO_URING && !uring) {
+        std::cout << name << ": io_uring unavailable, skipped" << std::endl;
+        return;
+    }
+    std::cout << name << " pipe: write=" << wn << " read=" << rn << " data=" << buf
+              << " eventfd read=" << en << " value=" << value << " errno=" << err
+              << " (expect 2 2 hi 8 7 0)" << std::endl;
+    assert(wn == 2 && rn == 2 && std::string(buf) == "hi");
+    assert(en == sizeof(value) && value == 7);
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::INFO);
+    test_poll();
+    test_select_timeout();
+    test_epoll_wait();
+    test_eventfd_dup();
+    test_accept4();
+    test_pipe_eventfd(libcocao::IOManager::EPOLL, "epoll");
+    test_pipe_eventfd(libcocao::IOManager::IO_URING, "io_uring");
+    return 0;
+}
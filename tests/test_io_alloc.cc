@@ -0,0 +1,126 @@
+/**
+ * @file test_io_alloc.cc
+ * @brief 统计hook的recv遇到EAGAIN挂起再恢复时每次的堆分配次数
+ * @details 一对socket上两个协程做乒乓，每轮两次阻塞的recv；替换全局operator new计数，
+ *          预热之后的轮次里分配次数应接近0
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <signal.h>
+#include <new>
+#include <stdlib.h>
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+static std::atomic<uint64_t> s_allocs{0};
+
+void *operator new(size_t size) {
+    ++ s_allocs;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+static const int s_warmup = 1000;
+static const int s_rounds = 100000;
+
+void pong(int fd) {
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (send(fd, &c, 1, 0) != 1) break;
+    }
+    close(fd);
+}
+
+void ping(int fd, const char *name) {
+    char c = 'p';
+    uint64_t allocs = 0;
+    uint64_t begin = 0;
+    int i = 0;
+    for (; i < s_warmup + s_rounds; ++ i) {
+        if (i == s_warmup) {
+            allocs = s_allocs;
+            begin = libcocao::GetCurrentUS();
+        }
+        if (send(fd, &c, 1, 0) != 1 || recv(fd, &c, 1, 0) != 1) {
+            LIBCOCAO_LOG_ERROR(g_logger) << name << " ping error errno=" << errno;
+            break;
+        }
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    allocs = s_allocs - allocs;
+    std::cout << name << ": " << (double)allocs / s_rounds << " allocs/round "
+              << used * 1000.0 / s_rounds << " ns/round" << std::endl;
+    assert(i == s_warmup + s_rounds);
+    //预热后挂起恢复不分配，留一点余量给日志之类的偶发分配
+    assert(allocs * 100 < s_rounds);
+    close(fd);
+}
+
+/**
+ * @param[in] timeout_ms 两端设置的SO_RCVTIMEO，0表示不设置
+ */
+void bench(const char *name, libcocao::TimerManager::Type timer_type, int timeout_ms) {
+    libcocao::IOManager iom(1, false, name, libcocao::IOManager::EPOLL, timer_type);
+    iom.schedule([name, timeout_ms]() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            LIBCOCAO_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+            return;
+        }
+        for (int i = 0; i < 2; ++ i) {
+            libcocao::FdMgr::GetInstance()->get(fds[i], true);
+            if (timeout_ms) {
+                struct timeval tv{timeout_ms / 1000, timeout_ms % 1000 * 1000};
+                setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            }
+        }
+        libcocao::IOManager::GetThis()->schedule(std::bind(&pong, fds[1]));
+        ping(fds[0], name);
+    });
+}
+
+/**
+ * @brief 对端不回包，recv应在超时后返回ETIMEDOUT
+ */
+void test_timeout() {
+    libcocao::IOManager iom(1, false, "timeout");
+    iom.schedule([]() {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        libcocao::FdMgr::GetInstance()->get(fds[0], true);
+        struct timeval tv{0, 50 * 1000};
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char c;
+        uint64_t begin = libcocao::GetMonotonicMS();
+        ssize_t n = recv(fds[0], &c, 1, 0);
+        int err = errno;
+        uint64_t used = libcocao::GetMonotonicMS() - begin;
+        std::cout << "timeout: n=" << n << " etimedout=" << (err == ETIMEDOUT)
+                  << " used=" << used << "ms (expect ~50)" << std::endl;
+        assert(n == -1 && err == ETIMEDOUT);
+        assert(used >= 50);
+        close(fds[0]);
+        close(fds[1]);
+    });
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::INFO);
+    bench("no_timeout", libcocao::TimerManager::HEAP, 0);
+    bench("timeout_heap", libcocao::TimerManager::HEAP, 1000);
+    bench("timeout_wheel", libcocao::TimerManager::WHEEL, 1000);
+    test_timeout();
+    return 0;
+}
@@ -0,0 +1,149 @@
+/**
+ * @file test_io_backend.cc
+ * @brief IOManager的epoll和io_uring后端对比测试
+ * @details 一对socket上两个协程做乒乓，每轮各一次阻塞的recv和send；
+ *          另外检查共享栈协程用栈上缓冲区读数据时不会被别的协程的数据覆盖，
+ *          以及没有超时的读在fd被关闭时会被取消，协程不会一直挂着
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <signal.h>
+#include <assert.h>
+#include <string.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+static const int s_rounds = 100000;
+
+static int s_done = 0;
+
+void ping(int fd, const char *name) {
+    char c = 'p';
+    int i = 0;
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (; i < s_rounds; ++ i) {
+        if (send(fd, &c, 1, 0) != 1 || recv(fd, &c, 1, 0) != 1) {
+            LIBCOCAO_LOG_ERROR(g_logger) << name << " ping error errno=" << errno;
+            break;
+        }
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    LIBCOCAO_LOG_INFO(g_logger) << name << ": " << used * 1000.0 / s_rounds << " ns/round";
+    s_done = i;
+    close(fd);
+}
+
+void pong(int fd) {
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (send(fd, &c, 1, 0) != 1) break;
+    }
+    close(fd);
+}
+
+void bench(libcocao::IOManager::Backend backend, const char *name) {
+    libcocao::IOManager iom(1, false, name, backend);
+    if (backend == libcocao::IOManager::IO_URING && !iom.isUring()) {
+        LIBCOCAO_LOG_INFO(g_logger) << name << ": io_uring unavailable, skipped";
+        return;
+    }
+    iom.schedule([name]() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            LIBCOCAO_LOG_ERROR(g_logger) << "socketpair errno=" << errno;
+            return;
+        }
+        libcocao::FdMgr::GetInstance()->get(fds[0], true);
+        libcocao::FdMgr::GetInstance()->get(fds[1], true);
+        libcocao::IOManager::GetThis()->schedule(std::bind(&pong, fds[1]));
+        ping(fds[0], name);
+    });
+}
+
+/**
+ * @brief 两个共享栈协程先后阻塞在recv上，缓冲区都在栈上的同一位置
+ * @details 读操作如果交给io_uring异步完成，内核会把数据写进此时占用共享栈的另一个协程的栈帧
+ */
+void test_shared_stack() {
+    std::string got[2];
+    {
+        libcocao::IOManager iom(1, false, "shared_stack", libcocao::IOManager::IO_URING);
+        if (!iom.isUring()) {
+            LIBCOCAO_LOG_INFO(g_logger) << "shared_stack: io_uring unavailable, skipped";
+            return;
+        }
+        iom.schedule([&got]() {
+            int fds[2][2];
+            for (auto &sv : fds) {
+                socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+                libcocao::FdMgr::GetInstance()->get(sv[0], true);
+                libcocao::FdMgr::GetInstance()->get(sv[1], true);
+            }
+            libcocao::IOManager *iom = libcocao::IOManager::GetThis();
+            for (int i = 0; i < 2; ++ i) {
+                int fd = fds[i][0];
+                std::string *out = &got[i];
+                iom->schedule(libcocao::Fiber::ptr(new libcocao::Fiber([fd, out]() {
+                    char buf[16];
+                    memset(buf, 0, sizeof(buf));
+                    int n = recv(fd, buf, sizeof(buf) - 1, 0);
+                    if (n > 0) out->assign(buf, n);
+                    close(fd);
+                }, 0, true, true)));
+            }
+            //等两个读协程都挂起后再写
+            usleep(10 * 1000);
+            send(fds[0][1], "first", 5, 0);
+            send(fds[1][1], "second", 6, 0);
+            usleep(10 * 1000);
+            close(fds[0][1]);
+            close(fds[1][1]);
+        });
+    }
+    std::cout << "shared_stack: got=" << got[0] << "," << got[1] << " (expect first,second)" << std::endl;
+    assert(got[0] == "first" && got[1] == "second");
+}
+
+/**
+ * @brief 一个协程阻塞在没有超时的recv上，另一个协程关闭这个fd
+ */
+void test_cancel(libcocao::IOManager::Backend backend, const char *name) {
+    int rt = 0, err = 0;
+    uint64_t used = 0;
+    {
+        libcocao::IOManager iom(1, false, name, backend);
+        iom.schedule([&]() {
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            libcocao::FdMgr::GetInstance()->get(fds[0], true);
+            libcocao::FdMgr::GetInstance()->get(fds[1], true);
+            int fd = fds[0];
+            libcocao::IOManager::GetThis()->schedule([fd]() {
+                usleep(20 * 1000);
+                close(fd);
+            });
+            uint64_t begin = libcocao::GetMonotonicMS();
+            char c;
+            rt = recv(fd, &c, 1, 0);
+            err = errno;
+            used = libcocao::GetMonotonicMS() - begin;
+            close(fds[1]);
+        });
+    }
+    std::cout << name << " cancel: rt=" << rt << " errno=" << err << " used=" << used
+              << "ms (expect -1, EBADF, ~20)" << std::endl;
+    assert(rt == -1 && err == EBADF && used < 1000);
+}
+
+int main() {
+    signal(SIGPIPE, SIG_IGN);
+    bench(libcocao::IOManager::EPOLL, "epoll");
+    assert(s_done == s_rounds);
+    s_done = s_rounds;
+    bench(libcocao::IOManager::IO_URING, "io_uring");
+    assert(s_done == s_rounds);
+    test_shared_stack();
+    test_cancel(libcocao::IOManager::EPOLL, "epoll");
+    test_cancel(libcocao::IOManager::IO_URING, "io_uring");
+    return 0;
+}
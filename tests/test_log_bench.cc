@@ -0,0 +1,183 @@
+/**
+ * @file test_log_bench.cc
+ * @brief 日志热路径压测，统计每个线程每秒能写多少条，以及每条日志的堆分配次数；
+ *        另外检查写日志的同时增删输出地、创建日志器是否安全，以及按调用点限流和采样
+ */
+#include "libcocao/libcocao.h"
+#include <atomic>
+#include <assert.h>
+#include <new>
+
+static std::atomic<uint64_t> s_allocs = {0};
+
+void *operator new(size_t size) {
+    ++ s_allocs;
+    void *p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/**
+ * @brief 只格式化不输出的输出地，测的是采集加格式化的开销
+ */
+class NullLogAppender : public libcocao::LoggerAppender {
+public:
+    void log(libcocao::LogLevel::Level level, const libcocao::LogEvent &event) override {
+        m_buf.clear();
+        m_formatter->format(m_buf, level, event);
+        m_bytes += m_buf.size();
+    }
+private:
+    char m_data[1024];
+    libcocao::LogStream m_buf{m_data, sizeof m_data};
+    uint64_t m_bytes = 0;
+};
+
+void bench(int threads, int count) {
+    std::vector<libcocao::Thread::ptr> thrs;
+    std::vector<double> rates(threads);
+    for (int i = 0; i < threads; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([i, count, &rates]() {
+            //每个线程一个日志器和输出地，不互相争用
+            libcocao::Logger::ptr logger(new libcocao::Logger("bench"));
+            logger->addAppender(libcocao::LoggerAppender::ptr(new NullLogAppender));
+            uint64_t allocs = s_allocs;
+            uint64_t begin = libcocao::GetCurrentUS();
+            for (int j = 0; j < count; ++ j) {
+                LIBCOCAO_LOG_INFO(logger) << "request done, fd=" << j << " bytes=" << 4096ul
+                                          << " cost=" << 1.5 << "ms path=/index.html";
+            }
+            uint64_t used = libcocao::GetCurrentUS() - begin;
+            rates[i] = count * 1000000.0 / used;
+            if (i == 0) {
+                double per_record = (double)(s_allocs - allocs) / count;
+                std::cout << "allocs/record: " << per_record << std::endl;
+                //计数是全局的，别的线程启动时的分配也算在里面，热路径本身不分配
+                assert(per_record < 0.001);
+            }
+        }, "bench_" + std::to_string(i))));
+    }
+    for (auto &i : thrs) i->join();
+    double sum = 0;
+    for (auto i : rates) sum += i;
+    std::cout << "threads=" << threads << " records/sec/thread=" << (uint64_t)(sum / threads) << std::endl;
+}
+
+/**
+ * @brief 只计数的输出地
+ */
+class CountLogAppender : public libcocao::LoggerAppender {
+public:
+    void log(libcocao::LogLevel::Level level, const libcocao::LogEvent &event) override {
+        ++ m_count;
+    }
+    std::atomic<uint64_t> m_count = {0};
+};
+
+void test_concurrent(int threads, int count) {
+    libcocao::Logger::ptr logger = LIBCOCAO_LOG_NAME("concurrent");
+    std::shared_ptr<CountLogAppender> fixed(new CountLogAppender);
+    logger->addAppender(fixed);
+    std::atomic<bool> running = {true};
+    std::vector<libcocao::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([&running, count]() {
+            for (int j = 0; j < count; ++ j) {
+                //每次都按名字查，同时压到LoggerManager的查找
+                LIBCOCAO_LOG_INFO(LIBCOCAO_LOG_NAME("concurrent")) << "concurrent " << j;
+                if (j % 1000 == 0) LIBCOCAO_LOG_NAME("concurrent_" + std::to_string(j / 1000));
+            }
+        }, "concurrent_" + std::to_string(i))));
+    }
+    int changes = 0;
+    std::thread changer([&]() {
+        while (running) {
+            std::shared_ptr<CountLogAppender> temp(new CountLogAppender);
+            logger->addAppender(temp);
+            logger->delAppender(temp);
+            ++ changes;
+        }
+    });
+    for (auto &i : thrs) i->join();
+    running = false;
+    changer.join();
+    std::cout << "concurrent: appender changes=" << changes << " logged=" << fixed->m_count
+              << " ok=" << (fixed->m_count == (uint64_t)threads * count) << std::endl;
+    assert(fixed->m_count == (uint64_t)threads * count);
+}
+
+/**
+ * @brief 计数并记下最后一条内容的输出地
+ */
+class LastLogAppender : public CountLogAppender {
+public:
+    void log(libcocao::LogLevel::Level level, const libcocao::LogEvent &event) override {
+        CountLogAppender::log(level, event);
+        m_last.assign(event.getContentData(), event.getContentSize());
+    }
+    std::string m_last;
+};
+
+/**
+ * @brief 在350ms里不停地打限流日志，每100ms放行5条，按实际耗时核对放行条数
+ * @details 每个窗口一开就放满5条，窗口之间至少隔100ms；下一个窗口最晚在过期后的第一次调用时打开，
+ *          所以窗口间隔不超过100ms加上粗粒度时钟的一个tick(留4ms)再加两次调用之间最长的停顿
+ */
+static void limit_loop(libcocao::Logger::ptr logger, std::shared_ptr<LastLogAppender> appender) {
+    uint64_t calls = 0;
+    uint64_t begin = libcocao::GetMonotonicUS();
+    uint64_t end = begin + 350 * 1000;
+    uint64_t last = begin;
+    uint64_t max_gap = 0;
+    uint64_t now;
+    while ((now = libcocao::GetMonotonicUS()) < end) {
+        max_gap = std::max(max_gap, now - last);
+        last = now;
+        for (int i = 0; i < 1000; ++ i, ++ calls) {
+            LIBCOCAO_LOG_ERROR_LIMIT(logger, 5, 100) << "limited " << calls;
+        }
+    }
+    uint64_t used = libcocao::GetMonotonicUS() - begin;
+    uint64_t min_count = 5 * (used / (104 * 1000 + max_gap));
+    uint64_t max_count = 5 * (used / (96 * 1000) + 1);
+    std::cout << "limit: logged=" << appender->m_count << " (expect " << min_count << "~" << max_count
+              << ") last=" << appender->m_last << " max_gap=" << max_gap << "us "
+              << used * 1000.0 / calls << " ns/call" << std::endl;
+    assert(appender->m_count >= min_count && appender->m_count <= max_count);
+}
+
+void test_limit() {
+    libcocao::Logger::ptr logger(new libcocao::Logger("limit"));
+    std::shared_ptr<LastLogAppender> appender(new LastLogAppender);
+    logger->addAppender(appender);
+
+    for (int i = 0; i < 100000; ++ i) {
+        LIBCOCAO_LOG_ERROR_EVERY_N(logger, 100) << "sampled " << i;
+    }
+    std::cout << "every_n: logged=" << appender->m_count << " (expect 1000) last=" << appender->m_last << std::endl;
+    assert(appender->m_count == 1000);
+
+    appender->m_count = 0;
+    limit_loop(logger, appender);
+
+    //调度线程里任务执行期间时间缓存不刷新，限流窗口也得照样滚动
+    appender->m_count = 0;
+    {
+        libcocao::IOManager iom(1, false, "limit");
+        //同一个调用点，隔开一个窗口以上再来，同时让线程先进idle缓存上时间
+        usleep(150 * 1000);
+        iom.schedule([&]() { limit_loop(logger, appender); });
+    }
+}
+
+int main() {
+    bench(1, 2000000);
+    bench(4, 2000000);
+    test_concurrent(4, 200000);
+    test_limit();
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_mutex_bench.cc
+ * @brief 锁的争用压测，对比pthread的Mutex/RWMutex和基于futex的FutexMutex/FutexRWMutex
+ */
+#include "libcocao/libcocao.h"
+#include <assert.h>
+
+/**
+ * @brief 作用域锁提前unlock()后锁要真的放开，之后还能再加锁，析构时不重复解锁
+ * @details unlock()曾经错调成wrlock()，那时这里会死锁
+ */
+template<class RWMutexType>
+void check_scope_unlock() {
+    RWMutexType mutex;
+    {
+        typename RWMutexType::ReadLock rd(mutex);
+        rd.unlock();
+        typename RWMutexType::WriteLock wr(mutex);
+        wr.unlock();
+        wr.lock();
+    }
+    typename RWMutexType::WriteLock wr(mutex);
+}
+
+/**
+ * @brief 每个线程count次加锁、改共享计数、解锁，返回每次加解锁的平均耗时(ns)
+ */
+template<class MutexType>
+double bench_mutex(int threads, int count, bool &ok) {
+    MutexType mutex;
+    uint64_t value = 0;
+    uint64_t begin = libcocao::GetCurrentUS();
+    std::vector<libcocao::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([&mutex, &value, count]() {
+            for (int j = 0; j < count; ++ j) {
+                typename MutexType::Lock lock(mutex);
+                ++ value;
+            }
+        }, "mutex_" + std::to_string(i))));
+    }
+    for (auto &i : thrs) i->join();
+    ok = value == (uint64_t)threads * count;
+    return (libcocao::GetCurrentUS() - begin) * 1000.0 / ((uint64_t)threads * count);
+}
+
+/**
+ * @brief 每write_every次里有一次写，写者改两个值，读者检查两个值相等
+ */
+template<class RWMutexType>
+double bench_rwmutex(int threads, int count, int write_every, bool &ok) {
+    RWMutexType mutex;
+    uint64_t a = 0;
+    uint64_t b = 0;
+    std::atomic<uint64_t> broken{0};
+    uint64_t begin = libcocao::GetCurrentUS();
+    std::vector<libcocao::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++ i) {
+        thrs.push_back(libcocao::Thread::ptr(new libcocao::Thread([&, count, write_every]() {
+            for (int j = 0; j < count; ++ j) {
+                if (write_every && j % write_every == 0) {
+                    typename RWMutexType::WriteLock lock(mutex);
+                    ++ a;
+                    ++ b;
+                } else {
+                    typename RWMutexType::ReadLock lock(mutex);
+                    if (a != b) ++ broken;
+                }
+            }
+        }, "rwmutex_" + std::to_string(i))));
+    }
+    for (auto &i : thrs) i->join();
+    uint64_t writes = write_every ? (uint64_t)threads * ((count + write_every - 1) / write_every) : 0;
+    ok = broken == 0 && a == writes && b == writes;
+    return (libcocao::GetCurrentUS() - begin) * 1000.0 / ((uint64_t)threads * count);
+}
+
+int main() {
+    check_scope_unlock<libcocao::RWMutex>();
+    check_scope_unlock<libcocao::FutexRWMutex>();
+    std::cout << "scope unlock: ok" << std::endl;
+
+    const int count = 1000000;
+    for (int threads : {1, 2, 4, 8}) {
+        bool ok1, ok2;
+        double pthread_ns = bench_mutex<libcocao::Mutex>(threads, count, ok1);
+        double futex_ns = bench_mutex<libcocao::FutexMutex>(threads, count, ok2);
+        std::cout << "mutex threads=" << threads << " pthread=" << pthread_ns << "ns futex=" << futex_ns
+                  << "ns ok=" << (ok1 && ok2) << std::endl;
+        assert(ok1 && ok2);
+    }
+    for (int write_every : {0, 100}) {
+        for (int threads : {1, 2, 4, 8}) {
+            bool ok1, ok2;
+            double pthread_ns = bench_rwmutex<libcocao::RWMutex>(threads, count, write_every, ok1);
+            double futex_ns = bench_rwmutex<libcocao::FutexRWMutex>(threads, count, write_every, ok2);
+            std::cout << "rwmutex write_every=" << write_every << " threads=" << threads
+                      << " pthread=" << pthread_ns << "ns futex=" << futex_ns
+                      << "ns ok=" << (ok1 && ok2) << std::endl;
+            assert(ok1 && ok2);
+        }
+    }
+    return 0;
+}
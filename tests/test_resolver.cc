@@ -0,0 +1,397 @@
+/**
+ * @file test_resolver.cc
+ * @brief Resolver测试：hosts、TTL缓存、否定缓存、并发合并、CNAME、截断后改TCP、超时、search列表
+ * @details 本地起一个假的DNS服务(普通线程，UDP和TCP同一端口)，按域名决定怎么应答，并统计收到的查询数
+ */
+#include "libcocao/libcocao.h"
+#include "libcocao/resolver.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cstring>
+#include <assert.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+/**
+ * @brief 假的DNS服务
+ */
+class FakeDns {
+public:
+    FakeDns() {
+        m_udp = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(m_udp, (sockaddr*)&addr, sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(m_udp, (sockaddr*)&addr, &len);
+        m_port = ntohs(addr.sin_port);
+        m_tcp = socket(AF_INET, SOCK_STREAM, 0);
+        int val = 1;
+        setsockopt(m_tcp, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+        bind(m_tcp, (sockaddr*)&addr, sizeof(addr));
+        listen(m_tcp, 16);
+        pipe(m_stop);
+        m_thread = std::thread([this]() { run(); });
+    }
+    ~FakeDns() {
+        write(m_stop[1], "x", 1);
+        m_thread.join();
+        close(m_udp);
+        close(m_tcp);
+        close(m_stop[0]);
+        close(m_stop[1]);
+    }
+
+    uint16_t getPort() const { return m_port; }
+    int count(const std::string& name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_count[name];
+    }
+    int tcpCount() const { return m_tcpCount; }
+
+private:
+    void run() {
+        while (true) {
+            pollfd fds[3] = {{m_udp, POLLIN, 0}, {m_tcp, POLLIN, 0}, {m_stop[0], POLLIN, 0}};
+            poll(fds, 3, -1);
+            if (fds[2].revents) return;
+            if (fds[0].revents) {
+                char buf[512];
+                sockaddr_in from;
+                socklen_t len = sizeof(from);
+                int n = recvfrom(m_udp, buf, sizeof(buf), 0, (sockaddr*)&from, &len);
+                std::vector<std::string> replies;
+                if (n > 0) answer(std::string(buf, n), false, replies);
+                for (auto& i : replies) {
+                    sendto(m_udp, i.data(), i.size(), 0, (sockaddr*)&from, len);
+                }
+            }
+            if (fds[1].revents) {
+                int conn = accept(m_tcp, nullptr, nullptr);
+                uint8_t head[2];
+                char buf[512];
+                if (recv(conn, head, 2, MSG_WAITALL) == 2) {
+                    int n = recv(conn, buf, (head[0] << 8) | head[1], MSG_WAITALL);
+                    std::vector<std::string> replies;
+                    if (n > 0) answer(std::string(buf, n), true, replies);
+                    ++ m_tcpCount;
+                    for (auto& i : replies) {
+                        std::string msg;
+                        msg.push_back(i.size() >> 8);
+                        msg.push_back(i.size() & 0xff);
+                        msg += i;
+                        send(conn, msg.data(), msg.size(), 0);
+                    }
+                }
+                close(conn);
+            }
+        }
+    }
+
+    static void u16(std::string& s, uint16_t v) {
+        s.push_back(v >> 8);
+        s.push_back(v & 0xff);
+    }
+    static void u32(std::string& s, uint32_t v) {
+        u16(s, v >> 16);
+        u16(s, v & 0xffff);
+    }
+    //owner是压缩指针
+    static void record(std::string& s, uint16_t owner, uint16_t type, uint32_t ttl, const std::string& rdata) {
+        u16(s, 0xc000 | owner);
+        u16(s, type);
+        u16(s, 1);
+        u32(s, ttl);
+        u16(s, rdata.size());
+        s += rdata;
+    }
+    static std::string ipv4(const char* ip) {
+        in_addr addr;
+        inet_pton(AF_INET, ip, &addr);
+        return std::string((char*)&addr, 4);
+    }
+
+    void answer(const std::string& req, bool tcp, std::vector<std::string>& replies) {
+        //只认一个不带压缩的问题
+        std::string name;
+        size_t pos = 12;
+        while (pos < req.size() && req[pos]) {
+            if (!name.empty()) name.push_back('.');
+            name.append(req, pos + 1, req[pos]);
+            pos += req[pos] + 1;
+        }
+        uint16_t qtype = ((uint8_t)req[pos + 1] << 8) | (uint8_t)req[pos + 2];
+        std::string question = req.substr(12, pos + 5 - 12);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++ m_count[name];
+        }
+
+        uint16_t flags = 0x8180;
+        uint16_t ancount = 0;
+        uint16_t nscount = 0;
+        std::string body;
+        if (name == "drop.test") {
+            return;
+        } else if (name == "a.test" && qtype == 1) {
+            record(body, 12, 1, 1, ipv4("10.0.0.1"));
+            record(body, 12, 1, 1, ipv4("10.0.0.2"));
+            ancount = 2;
+        } else if (name == "slow.test" && qtype == 1) {
+            usleep(200 * 1000);
+            record(body, 12, 1, 60, ipv4("10.0.0.3"));
+            ancount = 1;
+        } else if (name == "alias.test" && qtype == 1) {
+            //CNAME的目标放在body开头的rdata里，A记录的owner指向它
+            size_t target = 12 + question.size() + 12;
+            record(body, 12, 5, 60, std::string("\x01" "a\x04test\x00", 8));
+            record(body, target, 1, 60, ipv4("10.0.0.1"));
+            ancount = 2;
+        } else if (name == "big.test" && qtype == 1) {
+            if (tcp) {
+                record(body, 12, 1, 60, ipv4("10.0.0.4"));
+                ancount = 1;
+            } else {
+                flags |= 0x0200;
+            }
+        } else if (name == "v6.test") {
+            if (qtype == 28) {
+                in6_addr addr;
+                inet_pton(AF_INET6, "::1", &addr);
+                record(body, 12, 28, 60, std::string((char*)&addr, 16));
+                ancount = 1;
+            }
+        } else if (name == "host.search.test" && qtype == 1) {
+            record(body, 12, 1, 60, ipv4("10.0.0.5"));
+            ancount = 1;
+        } else if (name == "spoof.test" && qtype == 1) {
+            //先发一个id不对的应答
+            std::string fake = req.substr(0, 2);
+            fake[1] ^= 1;
+            u16(fake, flags);
+            u16(fake, 1);
+            u16(fake, 1);
+            u32(fake, 0);
+            fake += question;
+            record(fake, 12, 1, 60, ipv4("6.6.6.6"));
+            replies.push_back(fake);
+            record(body, 12, 1, 60, ipv4("10.0.0.6"));
+            ancount = 1;
+        } else {
+            //NXDOMAIN，权威段带SOA，MINIMUM为1秒
+            flags |= 3;
+            std::string soa("\x00\x00", 2);
+            u32(soa, 1);
+            u32(soa, 60);
+            u32(soa, 60);
+            u32(soa, 60);
+            u32(soa, 1);
+            record(body, 12, 6, 60, soa);
+            nscount = 1;
+        }
+        std::string reply = req.substr(0, 2);
+        u16(reply, flags);
+        u16(reply, 1);
+        u16(reply, ancount);
+        u16(reply, nscount);
+        u16(reply, 0);
+        reply += question;
+        reply += body;
+        replies.push_back(reply);
+    }
+
+private:
+    int m_udp;
+    int m_tcp;
+    int m_stop[2];
+    uint16_t m_port;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::map<std::string, int> m_count;
+    std::atomic<int> m_tcpCount{0};
+};
+
+static std::string to_string(const std::vector<libcocao::IPAddress::ptr>& addrs) {
+    std::string rt;
+    for (auto& i : addrs) {
+        if (!rt.empty()) rt += ",";
+        rt += i->toString();
+    }
+    return rt;
+}
+
+/**
+ * @brief 在单线程调度器里运行fn，同时跑一个每10ms计数一次的协程，返回fn期间的计数
+ */
+static int run_with_ticker(const std::function<void()> &fn) {
+    std::atomic<int> ticks{0};
+    std::atomic<bool> done{false};
+    {
+        libcocao::IOManager iom(1, false, "resolver");
+        iom.schedule([&]() {
+            fn();
+            done = true;
+        });
+        iom.schedule([&]() {
+            while (!done) {
+                usleep(10 * 1000);
+                ++ ticks;
+            }
+        });
+    }
+    return ticks;
+}
+
+static void setup(libcocao::Resolver& resolver, FakeDns& dns) {
+    resolver.setNameservers({libcocao::IPv4Address::Create("127.0.0.1", dns.getPort())});
+    resolver.setSearch({});
+    resolver.setTimeout(300);
+    resolver.setAttempts(1);
+    std::ofstream ofs("/tmp/test_resolver_hosts");
+    ofs << "# comment\n10.9.9.9 myhost.local MyAlias\n::2\tmyhost.local # v6\n";
+    ofs.close();
+    resolver.loadHosts("/tmp/test_resolver_hosts");
+}
+
+void test_hosts(FakeDns& dns) {
+    libcocao::Resolver resolver;
+    setup(resolver, dns);
+    std::vector<libcocao::IPAddress::ptr> v4, all, numeric;
+    resolver.lookup("myalias", AF_INET, v4, 80);
+    resolver.lookup("MyHost.Local.", AF_UNSPEC, all);
+    resolver.lookup("1.2.3.4", AF_INET, numeric, 8080);
+    std::cout << "hosts: v4=" << to_string(v4) << " (expect 10.9.9.9:80) all=" << to_string(all)
+              << " (expect 10.9.9.9:0,[::2]:0) numeric=" << to_string(numeric)
+              << " (expect 1.2.3.4:8080) queries=" << dns.count("myhost.local") << " (expect 0)" << std::endl;
+    assert(to_string(v4) == "10.9.9.9:80");
+    assert(to_string(all) == "10.9.9.9:0,[::2]:0");
+    assert(to_string(numeric) == "1.2.3.4:8080");
+    assert(dns.count("myhost.local") == 0);
+}
+
+void test_ttl(FakeDns& dns) {
+    libcocao::Resolver resolver;
+    setup(resolver, dns);
+    std::vector<libcocao::IPAddress::ptr> first, second, third;
+    int ticks = run_with_ticker([&]() {
+        resolver.lookup("a.test", AF_INET, first);
+        resolver.lookup("a.test", AF_INET, second);
+        int cached = dns.count("a.test");
+        //TTL为1秒，过期后重新查询
+        usleep(1100 * 1000);
+        resolver.lookup("A.TEST", AF_INET, third);
+        std::cout << "ttl: first=" << to_string(first) << " second=" << to_string(second)
+                  << " cached_queries=" << cached << " (expect 1) queries=" << dns.count("a.test")
+                  << " (expect 2) third=" << third.size() << " (expect 2)";
+        assert(to_string(first) == "10.0.0.1:0,10.0.0.2:0" && to_string(second) == to_string(first));
+        assert(cached == 1 && dns.count("a.test") == 2 && third.size() == 2);
+    });
+    std::cout << " ticks=" << ticks << " (expect ~110)" << std::endl;
+    assert(ticks >= 55);
+}
+
+void test_coalesce(FakeDns& dns) {
+    libcocao::Resolver resolver;
+    setup(resolver, dns);
+    std::atomic<int> ok{0};
+    int ticks = run_with_ticker([&]() {
+        libcocao::FiberSemaphore done;
+        for (int i = 0; i < 10; ++ i) {
+            libcocao::IOManager::GetThis()->schedule([&]() {
+                std::vector<libcocao::IPAddress::ptr> addrs;
+                if (resolver.lookup("slow.test", AF_INET, addrs) && to_string(addrs) == "10.0.0.3:0") {
+                    ++ ok;
+                }
+                done.notify();
+            });
+        }
+        for (int i = 0; i < 10; ++ i) done.wait();
+    });
+    std::cout << "coalesce: ok=" << ok << " (expect 10) queries=" << dns.count("slow.test")
+              << " (expect 1) ticks=" << ticks << " (expect ~20)" << std::endl;
+    assert(ok == 10 && dns.count("slow.test") == 1);
+    assert(ticks >= 10);
+}
+
+void test_records(FakeDns& dns) {
+    libcocao::Resolver resolver;
+    setup(resolver, dns);
+    run_with_ticker([&]() {
+        std::vector<libcocao::IPAddress::ptr> alias, big, v6, spoof, search;
+        resolver.lookup("alias.test", AF_INET, alias);
+        resolver.lookup("big.test", AF_INET, big);
+        resolver.lookup("v6.test", AF_UNSPEC, v6);
+        resolver.lookup("spoof.test", AF_INET, spoof);
+        resolver.setSearch({"Search.Test"});
+        resolver.lookup("host", AF_INET, search);
+        std::cout << "records: cname=" << to_string(alias) << " (expect 10.0.0.1:0) tcp=" << to_string(big)
+                  << " (expect 10.0.0.4:0) tcp_queries=" << dns.tcpCount() << " (expect 1) v6=" << to_string(v6)
+                  << " (expect [::1]:0) spoof=" << to_string(spoof) << " (expect 10.0.0.6:0) search="
+                  << to_string(search) << " (expect 10.0.0.5:0)" << std::endl;
+        assert(to_string(alias) == "10.0.0.1:0");
+        assert(to_string(big) == "10.0.0.4:0" && dns.tcpCount() == 1);
+        assert(to_string(v6) == "[::1]:0");
+        assert(to_string(spoof) == "10.0.0.6:0");
+        assert(to_string(search) == "10.0.0.5:0");
+    });
+}
+
+void test_negative(FakeDns& dns) {
+    libcocao::Resolver resolver;
+    setup(resolver, dns);
+    std::vector<libcocao::IPAddress::ptr> addrs;
+    bool found = false;
+    uint64_t used = 0;
+    int ticks = run_with_ticker([&]() {
+        found |= resolver.lookup("none.test", AF_INET, addrs);
+        found |= resolver.lookup("none.test", AF_INET, addrs);
+        int cached = dns.count("none.test");
+        usleep(1100 * 1000);
+        found |= resolver.lookup("none.test", AF_INET, addrs);
+        uint64_t begin = libcocao::GetMonotonicMS();
+        found |= resolver.lookup("drop.test", AF_INET, addrs);
+        used = libcocao::GetMonotonicMS() - begin;
+        std::cout << "negative: found=" << found << " (expect 0) cached_queries=" << cached
+                  << " (expect 1) queries=" << dns.count("none.test") << " (expect 2) timeout_used="
+                  << used << "ms (expect ~300) drop_queries=" << dns.count("drop.test") << " (expect 1)";
+        assert(!found && cached == 1 && dns.count("none.test") == 2);
+        assert(used >= 300 && dns.count("drop.test") == 1);
+    });
+    std::cout << " ticks=" << ticks << " (expect ~140)" << std::endl;
+    assert(ticks >= 70);
+}
+
+void test_address_lookup(FakeDns& dns) {
+    libcocao::Resolver* resolver = libcocao::ResolverMgr::GetInstance();
+    resolver->setNameservers({libcocao::IPv4Address::Create("127.0.0.1", dns.getPort())});
+    resolver->setSearch({});
+    run_with_ticker([&]() {
+        libcocao::Address::ptr addr = libcocao::Address::LookupAny("alias.test:8080");
+        libcocao::IPAddress::ptr ip = libcocao::Address::LookupAnyIPAddress("127.0.0.1");
+        std::cout << "address: lookup=" << (addr ? addr->toString() : "null") << " (expect 10.0.0.1:8080) ip="
+                  << (ip ? ip->toString() : "null") << " (expect 127.0.0.1:0)" << std::endl;
+        assert(addr && addr->toString() == "10.0.0.1:8080");
+        assert(ip && ip->toString() == "127.0.0.1:0");
+    });
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::INFO);
+    FakeDns dns;
+    test_hosts(dns);
+    test_ttl(dns);
+    test_coalesce(dns);
+    test_records(dns);
+    test_negative(dns);
+    test_address_lookup(dns);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "libcocao/libcocao.h"
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+static std::atomic<int> s_count{0};
+static std::atomic<int> s_misplaced{0};
+
+/**
+ * @brief 任务里再调度任务，新任务放入当前线程的本地队列，空闲线程会把它窃取走
+ */
+void test_task(int i) {
+    ++ s_count;
+    if (i % 1000 == 0) {
+        libcocao::Scheduler::GetThis()->schedule([] {
+            ++ s_count;
+        });
+    }
+}
+
+/**
+ * @brief 指定线程的任务进入该线程的收件箱，只会在该线程执行
+ */
+void test_pinned(int thread, int left) {
+    if (libcocao::GetThreadId() != thread) {
+        LIBCOCAO_LOG_ERROR(g_logger) << "pinned task run on " << libcocao::GetThreadId()
+                                     << " expect " << thread;
+        ++ s_misplaced;
+    }
+    ++ s_count;
+    if (left > 0) {
+        libcocao::Scheduler::GetThis()->schedule(std::bind(&test_pinned, thread, left - 1), thread);
+    }
+}
+
+void test_scheduler(size_t threads, bool use_caller) {
+    s_count = 0;
+    s_misplaced = 0;
+    uint64_t begin = libcocao::GetCurrentMS();
+    {
+        libcocao::Scheduler sc(threads, use_caller, "test");
+        sc.start();
+        for (int i = 0; i < 100000; ++ i) {
+            sc.schedule(std::bind(&test_task, i));
+        }
+        for (int i = 0; i < 10; ++ i) {
+            sc.schedule([] {
+                test_pinned(libcocao::GetThreadId(), 1000);
+            });
+        }
+        sc.stop();
+    }
+    LIBCOCAO_LOG_INFO(g_logger) << "threads=" << threads << " use_caller=" << use_caller
+                                << " count=" << s_count << " used=" << libcocao::GetCurrentMS() - begin << "ms";
+    //100000个任务，每1000个多调度一个，10条指定线程的链各1001个
+    assert(s_count == 100000 + 100 + 10 * 1001);
+    assert(s_misplaced == 0);
+}
+
+int main() {
+    libcocao::Thread::setName("main");
+
+    test_scheduler(1, true);
+    test_scheduler(4, false);
+    test_scheduler(4, true);
+    test_scheduler(16, false);
+    return 0;
+}
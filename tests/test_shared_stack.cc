@@ -0,0 +1,109 @@
+/**
+ * @file test_shared_stack.cc
+ * @brief 共享栈协程测试：切换时栈上的局部变量拷出拷回不走样，开始运行后只在所属线程恢复
+ * @details 每个协程在栈上放一个大数组和指向自己栈帧的指针，交错挂起恢复后逐一核对
+ */
+#include "libcocao/libcocao.h"
+#include <assert.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+static const size_t s_array_size = 16 * 1024;
+
+static std::atomic<int> s_broken{0};
+static std::atomic<int> s_migrated{0};
+static std::atomic<int> s_finished{0};
+
+/**
+ * @brief 栈上的数据按id填充，每次挂起回来都检查一遍
+ * @param[in] resched 挂起前把自己重新放回调度器，在调度器里运行时使用
+ */
+static void stack_user(int id, int rounds, bool resched) {
+    char big[s_array_size];
+    for (size_t i = 0; i < sizeof(big); ++ i) big[i] = (char)(id * 31 + i);
+    int local = id;
+    int *self = &local;
+    char *mid = big + sizeof(big) / 2;
+    int thread = libcocao::GetThreadId();
+
+    for (int r = 0; r < rounds; ++ r) {
+        //每轮挂起前改一点，拷回来的必须是最新的内容
+        local = id + r * 1000;
+        big[r] = (char)(id ^ r);
+        if (resched) {
+            libcocao::Scheduler::GetThis()->schedule(libcocao::Fiber::GetThis());
+        }
+        libcocao::Fiber::GetThis()->yield();
+
+        if (libcocao::GetThreadId() != thread) ++ s_migrated;
+        //恢复到同一个地址，指向自己栈帧的指针仍然有效
+        if (self != &local || *self != id + r * 1000 || mid != big + sizeof(big) / 2) ++ s_broken;
+        for (size_t i = 0; i < sizeof(big); ++ i) {
+            char expect = (int)i <= r ? (char)(id ^ (int)i) : (char)(id * 31 + i);
+            if (big[i] != expect) {
+                ++ s_broken;
+                break;
+            }
+        }
+    }
+    ++ s_finished;
+}
+
+/**
+ * @brief 不用调度器，手动按不同顺序恢复，逼着每次切换都要换出占用者
+ */
+void test_interleave(int fibers, int rounds) {
+    s_broken = 0;
+    s_finished = 0;
+    libcocao::Fiber::GetThis();
+    std::vector<libcocao::Fiber::ptr> list;
+    for (int i = 0; i < fibers; ++ i) {
+        list.emplace_back(new libcocao::Fiber(std::bind(&stack_user, i, rounds, false), 0, false, true));
+    }
+    for (int r = 0; r <= rounds; ++ r) {
+        //正序、倒序、隔一个交替
+        for (int i = 0; i < fibers; ++ i) {
+            int idx = r % 3 == 0 ? i : r % 3 == 1 ? fibers - 1 - i : (i * 2 + i / ((fibers + 1) / 2)) % fibers;
+            list[idx]->resume();
+        }
+    }
+    int term = 0;
+    for (auto &i : list) {
+        if (i->getState() == libcocao::Fiber::TERM) ++ term;
+    }
+    std::cout << "interleave: fibers=" << fibers << " finished=" << s_finished << " term=" << term
+              << " broken=" << s_broken << " (expect " << fibers << " " << fibers << " 0)" << std::endl;
+    assert(s_finished == fibers && term == fibers);
+    assert(s_broken == 0);
+}
+
+/**
+ * @brief 多线程调度器里的共享栈协程反复重新调度自己，每次都应回到第一次运行的线程
+ */
+void test_pinned(int threads, int fibers, int rounds) {
+    s_broken = 0;
+    s_migrated = 0;
+    s_finished = 0;
+    {
+        libcocao::Scheduler sc(threads, false, "shared_stack");
+        sc.start();
+        for (int i = 0; i < fibers; ++ i) {
+            sc.schedule(libcocao::Fiber::ptr(new libcocao::Fiber(
+                    std::bind(&stack_user, i, rounds, true), 0, true, true)));
+        }
+        sc.stop();
+    }
+    std::cout << "pinned: threads=" << threads << " fibers=" << fibers << " finished=" << s_finished
+              << " migrated=" << s_migrated << " broken=" << s_broken
+              << " (expect " << fibers << " 0 0)" << std::endl;
+    assert(s_finished == fibers);
+    assert(s_migrated == 0 && s_broken == 0);
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::INFO);
+    test_interleave(64, 20);
+    test_pinned(4, 64, 50);
+    return 0;
+}
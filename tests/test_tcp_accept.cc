@@ -0,0 +1,191 @@
+/**
+ * @file test_tcp_accept.cc
+ * @brief TcpServer批量accept、最大连接数和fd耗尽时的测试
+ * @details 普通线程做客户端；先检查连接数上限下并发处理的连接不超过上限且所有连接最终都被处理，
+ *          再调低RLIMIT_NOFILE制造EMFILE，检查backlog里多出来的连接被立即关闭而不是挂着，之后服务器还能正常工作
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cstring>
+#include <assert.h>
+#include <thread>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+/**
+ * @brief 回显到对端关闭为止的服务器，统计同时处理的连接数峰值
+ */
+class EchoServer : public libcocao::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    EchoServer(libcocao::IOManager *worker, uint64_t delay_us)
+        : TcpServer(worker, worker)
+        , m_delay(delay_us) {}
+
+    int getPeak() const { return m_peak; }
+    int getHandled() const { return m_handled; }
+
+protected:
+    void handleClient(libcocao::Socket::ptr client) override {
+        int n = ++ m_active;
+        int peak = m_peak;
+        while (n > peak && !m_peak.compare_exchange_weak(peak, n));
+        char buf[64];
+        while ((n = client->recv(buf, sizeof(buf))) > 0) {
+            if (m_delay) usleep(m_delay);
+            client->send(buf, n);
+        }
+        client->close();
+        -- m_active;
+        ++ m_handled;
+    }
+
+private:
+    uint64_t m_delay;
+    std::atomic<int> m_active{0};
+    std::atomic<int> m_peak{0};
+    std::atomic<int> m_handled{0};
+};
+
+static sockaddr_in loopback(uint16_t port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+//找一个空闲端口
+static uint16_t free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = loopback(0);
+    bind(fd, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+//连上发一次收一次，成功返回true
+static bool ping(uint16_t port) {
+    sockaddr_in addr = loopback(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    char buf[8];
+    bool ok = connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0
+              && send(fd, "ping", 4, 0) == 4
+              && recv(fd, buf, 4, MSG_WAITALL) == 4;
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief 在调度器线程里bind，监听socket才会被hook接管
+ */
+static void bind_server(libcocao::IOManager &iom, EchoServer::ptr server, uint16_t port, bool start) {
+    libcocao::FiberSemaphore done;
+    iom.schedule([&]() {
+        if (!server->bind(libcocao::IPv4Address::Create("127.0.0.1", port))) {
+            std::cout << "bind failed" << std::endl;
+        }
+        if (start) server->start();
+        done.notify();
+    });
+    done.wait();
+}
+
+void test_max_connections() {
+    const int max = 4, clients = 16, count = 20;
+    uint16_t port = free_port();
+    EchoServer::ptr server;
+    std::atomic<int> ok{0};
+    {
+        libcocao::IOManager iom(2, false, "max_conn");
+        server.reset(new EchoServer(&iom, 2000));
+        server->setMaxConnections(max);
+        bind_server(iom, server, port, true);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < clients; ++ i) {
+            threads.emplace_back([&]() {
+                for (int j = 0; j < count; ++ j) {
+                    if (ping(port)) ++ ok;
+                }
+            });
+        }
+        for (auto &i : threads) i.join();
+        while (server->getHandled() < ok) usleep(1000);
+        server->stop();
+    }
+    std::cout << "max_connections: ok=" << ok << " (expect " << clients * count
+              << ") peak=" << server->getPeak() << " (expect <= " << max
+              << ") connections=" << server->getConnections() << " (expect 0)" << std::endl;
+    assert(ok == clients * count);
+    assert(server->getPeak() <= max && server->getConnections() == 0);
+}
+
+void test_emfile() {
+    const int pending = 30, spare = 8;
+    uint16_t port = free_port();
+    EchoServer::ptr server;
+    int closed = 0, alive = 0;
+    bool after = false;
+    {
+        libcocao::IOManager iom(1, false, "emfile");
+        server.reset(new EchoServer(&iom, 0));
+        server->setRecvTimeout(-1);
+        bind_server(iom, server, port, false);
+
+        //连接先在backlog里排好，再把fd上限压到只够服务端再接受spare个
+        std::vector<int> fds;
+        sockaddr_in addr = loopback(port);
+        int max_fd = 0;
+        for (int i = 0; i < pending; ++ i) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            connect(fd, (sockaddr*)&addr, sizeof(addr));
+            fds.push_back(fd);
+            max_fd = std::max(max_fd, fd);
+        }
+        rlimit old;
+        getrlimit(RLIMIT_NOFILE, &old);
+        rlimit low = old;
+        low.rlim_cur = max_fd + 1 + spare;
+        setrlimit(RLIMIT_NOFILE, &low);
+
+        iom.schedule([server]() { server->start(); });
+        usleep(300 * 1000);
+        for (int fd : fds) {
+            pollfd pfd = {fd, POLLIN, 0};
+            char c;
+            //被丢弃的连接收到EOF或RST，被接受的连接服务端在等数据
+            if (poll(&pfd, 1, 0) == 1 && recv(fd, &c, 1, MSG_DONTWAIT) <= 0) ++ closed;
+            else ++ alive;
+        }
+
+        setrlimit(RLIMIT_NOFILE, &old);
+        for (int fd : fds) close(fd);
+        after = ping(port);
+        while (server->getConnections() > 0) usleep(1000);
+        server->stop();
+    }
+    std::cout << "emfile: alive=" << alive << " (expect <= " << spare << ") closed=" << closed
+              << " dropped=" << server->getDropped() << " (expect " << closed
+              << ") alive+closed=" << alive + closed << " (expect " << pending
+              << ") serve_after=" << after << " (expect 1)" << std::endl;
+    //fd不够时多出来的连接被立即关闭，而不是留在backlog里让accept空转
+    assert(alive <= spare && closed > 0);
+    assert(server->getDropped() == (uint64_t)closed && alive + closed == pending);
+    assert(after);
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::ERROR);
+    test_max_connections();
+    test_emfile();
+    return 0;
+}
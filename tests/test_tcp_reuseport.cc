@@ -0,0 +1,147 @@
+/**
+ * @file test_tcp_reuseport.cc
+ * @brief 每线程epoll加SO_REUSEPORT多监听socket的TcpServer测试
+ * @details 普通线程做客户端，短连接发一次收一次；检查连接分到了多个线程，
+ *          且同一个连接的accept、读、写都在同一个线程上；最后和单个accept_worker的模式比较连接速率
+ */
+#include "libcocao/libcocao.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <assert.h>
+#include <map>
+#include <mutex>
+#include <thread>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+/**
+ * @brief 回显一次就关闭的服务器，统计每个线程处理的连接数和线程切换次数
+ */
+class EchoServer : public libcocao::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    EchoServer(libcocao::IOManager *worker)
+        : TcpServer(worker, worker) {}
+
+    std::map<int, int> getThreads() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_threads;
+    }
+    int getMigrated() const { return m_migrated; }
+    int getHandled() const { return m_handled; }
+
+protected:
+    void handleClient(libcocao::Socket::ptr client) override {
+        int thread = libcocao::GetThreadId();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++ m_threads[thread];
+        }
+        char buf[64];
+        int n = client->recv(buf, sizeof(buf));
+        if (libcocao::GetThreadId() != thread) ++ m_migrated;
+        if (n > 0) client->send(buf, n);
+        if (libcocao::GetThreadId() != thread) ++ m_migrated;
+        client->close();
+        ++ m_handled;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::map<int, int> m_threads;
+    std::atomic<int> m_migrated{0};
+    std::atomic<int> m_handled{0};
+};
+
+//找一个空闲端口，SO_REUSEPORT的多个socket要绑定同一个端口，不能用0
+static uint16_t free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fd, (sockaddr*)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    close(fd);
+    return ntohs(addr.sin_port);
+}
+
+/**
+ * @brief clients个普通线程各发起count个短连接，返回成功的个数
+ */
+static int run_clients(uint16_t port, int clients, int count) {
+    std::atomic<int> ok{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; ++ i) {
+        threads.emplace_back([&]() {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            for (int j = 0; j < count; ++ j) {
+                int fd = socket(AF_INET, SOCK_STREAM, 0);
+                char buf[8];
+                if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0
+                        && send(fd, "ping", 4, 0) == 4
+                        && recv(fd, buf, sizeof(buf), MSG_WAITALL) == 4) {
+                    ++ ok;
+                }
+                close(fd);
+            }
+        });
+    }
+    for (auto &i : threads) i.join();
+    return ok;
+}
+
+void test_server(bool reuse_port, int threads, int clients, int count) {
+    uint16_t port = free_port();
+    EchoServer::ptr server;
+    int ok = 0;
+    uint64_t used = 0;
+    {
+        libcocao::IOManager iom(threads, false, reuse_port ? "reuseport" : "shared",
+                                libcocao::IOManager::EPOLL, libcocao::TimerManager::HEAP,
+                                reuse_port ? libcocao::IOManager::PER_THREAD_EPOLL : libcocao::IOManager::SHARED_EPOLL);
+        server.reset(new EchoServer(&iom));
+        server->setReusePort(reuse_port);
+        //监听socket要在调度器线程里创建，hook才会接管它
+        libcocao::FiberSemaphore started;
+        iom.schedule([&]() {
+            if (!server->bind(libcocao::IPv4Address::Create("127.0.0.1", port))) {
+                std::cout << "bind failed" << std::endl;
+            }
+            server->start();
+            started.notify();
+        });
+        started.wait();
+        uint64_t begin = libcocao::GetMonotonicMS();
+        ok = run_clients(port, clients, count);
+        used = libcocao::GetMonotonicMS() - begin;
+        //客户端收到回显时服务端可能还没走完handleClient
+        while (server->getHandled() < ok) usleep(1000);
+        server->stop();
+    }
+    std::map<int, int> dist = server->getThreads();
+    std::cout << (reuse_port ? "reuseport" : "shared") << ": ok=" << ok << " (expect " << clients * count
+              << ") handled=" << server->getHandled() << " threads_used=" << dist.size()
+              << " migrated=" << server->getMigrated() << (reuse_port ? " (expect 0)" : "")
+              << " rate=" << (used ? ok * 1000 / used : 0) << " conn/s dist=";
+    for (auto &i : dist) std::cout << i.second << " ";
+    std::cout << std::endl;
+    assert(ok == clients * count && server->getHandled() == ok);
+    //内核按四元组把连接散到各线程的监听socket上，之后不再跨线程
+    assert(!reuse_port || (dist.size() > 1 && server->getMigrated() == 0));
+}
+
+int main() {
+    g_logger->setLevel(libcocao::LogLevel::INFO);
+    LIBCOCAO_LOG_NAME("system")->setLevel(libcocao::LogLevel::INFO);
+    test_server(true, 4, 8, 500);
+    test_server(false, 4, 8, 500);
+    return 0;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file test_time_format.cc
+ * @brief 按秒缓存的时间格式化测试：同一秒内复用、换秒后重新格式化，日志的毫秒/微秒后缀，HTTP Date
+ */
+#include "libcocao/libcocao.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void set_tz(const char *tz) {
+    setenv("TZ", tz, 1);
+    tzset();
+}
+
+static std::string format_sec(libcocao::TimeFormatCache &cache, time_t sec) {
+    size_t len = 0;
+    const char *buf = cache.format(sec, len);
+    return std::string(buf, len);
+}
+
+/**
+ * @brief 同一秒内中途换时区，缓存的结果不变；换了秒才按新时区重新格式化
+ */
+void test_cache() {
+    set_tz("UTC0");
+    libcocao::TimeFormatCache cache("%Y-%m-%d %H:%M:%S");
+    std::string first = format_sec(cache, 1000);
+    set_tz("CST-8");
+    std::string same = format_sec(cache, 1000);
+    std::string next = format_sec(cache, 1001);
+    std::cout << "cache: first=" << first << " same=" << same << " next=" << next
+              << " (expect 1970-01-01 00:16:40, 00:16:40, 08:16:41)" << std::endl;
+    assert(first == "1970-01-01 00:16:40");
+    assert(same == first);
+    assert(next == "1970-01-01 08:16:41");
+}
+
+static std::string format_event(const char *pattern, uint64_t time_us) {
+    libcocao::LogFormatter formatter(pattern);
+    libcocao::LogEvent event(libcocao::LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0, time_us, "main");
+    std::string str = formatter.format(libcocao::LogLevel::INFO, event);
+    //格式化结果总以换行结尾
+    assert(!str.empty() && str.back() == '\n');
+    str.pop_back();
+    return str;
+}
+
+/**
+ * @brief S和U补零到3位和6位，d是年-月-日
+ */
+void test_suffix() {
+    set_tz("UTC0");
+    std::string a = format_event("dSU", 1000 * 1000000ull + 5);
+    std::string b = format_event("dSU", 1000 * 1000000ull + 5000);
+    std::string c = format_event("dSU", 1000 * 1000000ull + 999999);
+    std::cout << "suffix: " << a << " | " << b << " | " << c << std::endl;
+    assert(a == "1970-01-01 00:16:40.000.000005");
+    assert(b == "1970-01-01 00:16:40.005.005000");
+    assert(c == "1970-01-01 00:16:40.999.999999");
+}
+
+/**
+ * @brief RFC 7231的IMF-fixdate，例如"Sun, 06 Nov 1994 08:49:37 GMT"，本地时区不影响结果
+ */
+void test_http_date() {
+    set_tz("CST-8");
+    time_t before = time(0);
+    std::string date = libcocao::GetHttpDate();
+    time_t after = time(0);
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    time_t parsed = timegm(&tm);
+    char expect[64];
+    strftime(expect, sizeof(expect), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    std::cout << "http date: " << date << " (expect GMT now)" << std::endl;
+    assert(date.size() == 29);
+    assert(end && *end == '\0');
+    assert(date == expect);
+    assert(parsed >= before && parsed <= after);
+}
+
+int main() {
+    test_cache();
+    test_suffix();
+    test_http_date();
+    return 0;
+}
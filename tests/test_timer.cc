@@ -0,0 +1,164 @@
+/**
+ * @file test_timer.cc
+ * @brief 定时器测试，对比最小堆和时间轮两种实现
+ */
+#include "libcocao/libcocao.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/socket.h>
+
+static libcocao::Logger::ptr g_logger = LIBCOCAO_LOG_ROOT();
+
+class TestTimerManager : public libcocao::TimerManager {
+public:
+    TestTimerManager(Type type) : TimerManager(type) {}
+protected:
+    void onTimerInsertAtFront() override {}
+};
+
+/**
+ * @brief 随机超时的定时器，取消一部分，检查其余的都按时触发
+ */
+void test_expire(libcocao::TimerManager::Type type, const char *name) {
+    static const int s_count = 20000;
+    TestTimerManager mgr(type);
+    std::vector<uint64_t> fired(s_count, 0);
+    std::vector<uint64_t> deadline(s_count, 0);
+    std::vector<libcocao::Timer::ptr> timers;
+
+    srand(1);
+    for (int i = 0; i < s_count; ++ i) {
+        //大部分落在第0层，少量跨到上层
+        uint64_t ms = (i % 10 == 0) ? 256 + rand() % 1000 : rand() % 200;
+        deadline[i] = libcocao::GetMonotonicMS() + ms;
+        timers.push_back(mgr.addTimer(ms, [&fired, i]() {
+            fired[i] = libcocao::GetMonotonicMS();
+        }));
+    }
+    for (int i = 0; i < s_count; i += 3) {
+        timers[i]->cancel();
+    }
+
+    int late = 0;
+    int early = 0;
+    int missing = 0;
+    uint64_t end = libcocao::GetMonotonicMS() + 1500;
+    while (libcocao::GetMonotonicMS() < end) {
+        std::vector<std::function<void()>> cbs;
+        mgr.listExpiredCb(cbs);
+        for (auto &cb : cbs) cb();
+        usleep(1000);
+    }
+    for (int i = 0; i < s_count; ++ i) {
+        if (i % 3 == 0) {
+            if (fired[i]) ++ early;
+            continue;
+        }
+        if (!fired[i]) ++ missing;
+        else if (fired[i] < deadline[i]) ++ early;
+        else if (fired[i] > deadline[i] + 20) ++ late;
+    }
+    LIBCOCAO_LOG_INFO(g_logger) << name << " expire: early=" << early << " late=" << late
+                                << " missing=" << missing;
+    //晚到受调度影响不检查，取消的不能触发，没取消的不能提前也不能漏
+    assert(early == 0 && missing == 0);
+}
+
+/**
+ * @brief 模拟do_io，每次加一个超时定时器再马上取消
+ */
+void bench_churn(libcocao::TimerManager::Type type, const char *name) {
+    static const int s_rounds = 1000000;
+    TestTimerManager mgr(type);
+    std::vector<libcocao::Timer::ptr> idle;
+    for (int i = 0; i < 100000; ++ i) {
+        idle.push_back(mgr.addTimer(5000 + i % 60000, [](){}));
+    }
+
+    uint64_t begin = libcocao::GetCurrentUS();
+    for (int i = 0; i < s_rounds; ++ i) {
+        libcocao::Timer::ptr timer = mgr.addTimer(3000, [](){});
+        timer->cancel();
+    }
+    uint64_t used = libcocao::GetCurrentUS() - begin;
+    LIBCOCAO_LOG_INFO(g_logger) << name << " add+cancel: " << used * 1000.0 / s_rounds << " ns";
+}
+
+/**
+ * @brief IOManager里协程usleep，检查idle按最近的定时器唤醒
+ */
+void test_sleep(libcocao::TimerManager::Type type, const char *name) {
+    static const int s_count = 100;
+    std::vector<int64_t> error(s_count, 0);
+    {
+        libcocao::IOManager iom(2, false, "sleep", libcocao::IOManager::EPOLL, type);
+        for (int i = 0; i < s_count; ++ i) {
+            iom.schedule([&error, i]() {
+                uint64_t us = 500 + i * 97;
+                uint64_t begin = libcocao::GetMonotonicUS();
+                usleep(us);
+                error[i] = (int64_t)(libcocao::GetMonotonicUS() - begin) - (int64_t)us;
+            });
+        }
+    }
+    int64_t max = 0;
+    int early = 0;
+    for (auto i : error) {
+        if (i < 0) ++ early;
+        max = std::max(max, i);
+    }
+    LIBCOCAO_LOG_INFO(g_logger) << name << " usleep: early=" << early << " max_late=" << max << "us";
+    assert(early == 0);
+}
+
+//占着线程空转，期间idle不会刷新缓存的时间
+static void busy(uint64_t ms) {
+    uint64_t end = libcocao::GetMonotonicMS() + ms;
+    while (libcocao::GetMonotonicMS() < end);
+}
+
+/**
+ * @brief 线程忙了一阵之后马上睡眠或者带超时地读，不能提前返回
+ */
+void test_sleep_after_busy(libcocao::TimerManager::Type type, const char *name) {
+    uint64_t slept = 0;
+    uint64_t waited = 0;
+    {
+        libcocao::IOManager iom(1, false, "busy", libcocao::IOManager::EPOLL, type);
+        //先让线程进一次idle，缓存了时间再来任务
+        usleep(50 * 1000);
+        iom.schedule([&]() {
+            busy(300);
+            uint64_t begin = libcocao::GetMonotonicUS();
+            usleep(100 * 1000);
+            slept = libcocao::GetMonotonicUS() - begin;
+
+            int fds[2];
+            socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+            struct timeval tv = {0, 100 * 1000};
+            setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            busy(300);
+            begin = libcocao::GetMonotonicUS();
+            char c;
+            recv(fds[0], &c, 1, 0);
+            waited = libcocao::GetMonotonicUS() - begin;
+            close(fds[0]);
+            close(fds[1]);
+        });
+    }
+    LIBCOCAO_LOG_INFO(g_logger) << name << " after busy: usleep=" << slept << "us recv_timeout="
+                                << waited << "us (expect >= 100000)";
+    assert(slept >= 100 * 1000 && waited >= 100 * 1000);
+}
+
+int main() {
+    test_expire(libcocao::TimerManager::HEAP, "heap");
+    test_expire(libcocao::TimerManager::WHEEL, "wheel");
+    test_sleep(libcocao::TimerManager::HEAP, "heap");
+    test_sleep(libcocao::TimerManager::WHEEL, "wheel");
+    test_sleep_after_busy(libcocao::TimerManager::HEAP, "heap");
+    test_sleep_after_busy(libcocao::TimerManager::WHEEL, "wheel");
+    bench_churn(libcocao::TimerManager::HEAP, "heap");
+    bench_churn(libcocao::TimerManager::WHEEL, "wheel");
+    return 0;
+}
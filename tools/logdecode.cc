@@ -0,0 +1,138 @@
+/**
+ * @file logdecode.cc
+ * @brief 把BinaryLogAppender写的文件还原成文本
+ * @details 用法: logdecode <file> [pattern]，pattern同LogFormatter，默认和Logger的默认格式一致
+ */
+#include "libcocao/log.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unordered_map>
+
+typedef libcocao::BinaryLogAppender BinaryLog;
+
+/**
+ * @brief 从文件里读出来的调用点
+ */
+struct SiteDef {
+    SiteDef(const char *file, size_t file_len, int32_t line, libcocao::LogLevel::Level level,
+            const char *fmt, size_t fmt_len)
+        : file(file, file_len)
+        , fmt(fmt, fmt_len)
+        , site(this->file.c_str(), line, level, this->fmt.c_str()) {
+    }
+    std::string file;
+    std::string fmt;
+    libcocao::LogSite site;
+};
+
+static size_t read_delta(const char *p, const char *end, int64_t &delta) {
+    uint64_t v = 0;
+    size_t n = 0;
+    for (int shift = 0; p + n < end && shift < 64; shift += 7) {
+        uint8_t c = p[n++];
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) break;
+    }
+    delta = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    return n;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+        return 1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "open " << argv[1] << " fail: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size == 0) return 0;
+    const char *data = (const char *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "mmap " << argv[1] << " fail: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    libcocao::LogFormatter formatter(argc > 2 ? argv[2] : "dTmTtTlTFTf:rTC");
+    char buf[4096];
+    libcocao::LogStream out(buf, sizeof buf);
+    std::unordered_map<uint32_t, std::unique_ptr<SiteDef>> sites;
+    uint64_t time = 0;
+    size_t count = 0;
+
+    size_t size = BinaryLog::ScanRecords(data, st.st_size);
+    size_t offset = 0;
+    while (offset < size) {
+        BinaryLog::RecordHeader header;
+        memcpy(&header, data + offset, sizeof header);
+        const char *p = data + offset + sizeof header;
+        const char *end = data + offset + header.size;
+        offset += header.size;
+        libcocao::LogLevel::Level level = (libcocao::LogLevel::Level)header.level;
+
+        if (header.kind == BinaryLog::SESSION) {
+            if (end - p < 16 || memcmp(p, BinaryLog::MAGIC, sizeof BinaryLog::MAGIC)) {
+                std::cerr << "bad session at " << offset - header.size << std::endl;
+                return 1;
+            }
+            memcpy(&time, p + 8, 8);
+            sites.clear();
+        } else if (header.kind == BinaryLog::SITE) {
+            uint32_t id = 0;
+            int32_t line = 0;
+            uint16_t file_len = 0;
+            uint16_t fmt_len = 0;
+            memcpy(&id, p, 4);
+            memcpy(&line, p + 4, 4);
+            memcpy(&file_len, p + 8, 2);
+            memcpy(&fmt_len, p + 10, 2);
+            sites[id].reset(new SiteDef(p + 12, file_len, line, level, p + 12 + file_len, fmt_len));
+        } else {
+            uint32_t ids[3];
+            memcpy(ids, p, 12);
+            p += 12;
+            int64_t delta = 0;
+            p += read_delta(p, end, delta);
+            time += delta;
+
+            const libcocao::LogSite *site = nullptr;
+            std::string file;
+            int32_t line = 0;
+            if (header.kind == BinaryLog::EVENT) {
+                auto it = sites.find(ids[0]);
+                if (it == sites.end()) {
+                    std::cerr << "unknown site " << ids[0] << std::endl;
+                    continue;
+                }
+                site = &it->second->site;
+                file = site->file;
+                line = site->line;
+            } else {
+                uint16_t file_len = 0;
+                memcpy(&file_len, p, 2);
+                file.assign(p + 2, file_len);
+                p += 2 + file_len;
+                line = ids[2];
+                ids[2] = ids[1];
+                ids[1] = ids[0];
+            }
+            libcocao::LogEvent event(level, file.c_str(), line, 0, ids[1], ids[2], time, "");
+            event.setSite(site);
+            event.getSS().append(p, end - p);
+            out.clear();
+            formatter.format(out, level, event);
+            fwrite(out.data(), 1, out.size(), stdout);
+            ++ count;
+        }
+    }
+    if (size != (size_t)st.st_size) {
+        std::cerr << count << " records, stopped at " << size << "/" << st.st_size << std::endl;
+    }
+    munmap((void *)data, st.st_size);
+    close(fd);
+    return 0;
+}